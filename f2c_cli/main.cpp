@@ -16,7 +16,9 @@
 #include <sl/helpers/String.h>
 #include <sl/sqlite/SQLConn.h>
 
+#include "Delta.h"
 #include "OutputFormatter.h"
+#include "SeekableZstd.h"
 
 using namespace F2C;
 
@@ -76,11 +78,15 @@ public:
 					"LEFT JOIN supported ON mdmap.supported = supported.id "
 					"ORDER BY branch_cte.version, branch_cte.branch;" },
 			{ selConfigDetails,
-				"SELECT arch.arch, flavor.flavor, map.value "
+				"SELECT arch.arch, flavor.flavor, "
+					"substr(vals.vals, col.col + 1, 1) AS value "
 					"FROM conf_branch_map AS map "
-					"LEFT JOIN arch ON map.arch = arch.id "
-					"LEFT JOIN flavor ON map.flavor = flavor.id "
-					"WHERE map.branch = :branch_id AND map.config = :config_id "
+					"JOIN conf_branch_values AS vals ON map.vals = vals.id "
+					"JOIN conf_branch_column AS col ON map.branch = col.branch "
+					"LEFT JOIN arch ON col.arch = arch.id "
+					"LEFT JOIN flavor ON col.flavor = flavor.id "
+					"WHERE map.branch = :branch_id AND map.config = :config_id AND "
+						"value != '-' "
 					"ORDER BY arch.arch, flavor.flavor;" },
 			{ selRename,
 				"WITH " + branchCTE + ", " +
@@ -176,6 +182,9 @@ private:
 
 struct Opts {
 	bool refresh;
+	std::string dbURL;
+	bool noDeltas;
+	bool zstd;
 
 	std::filesystem::path kernelTree;
 	std::filesystem::path sqlite;
@@ -204,6 +213,12 @@ Opts getOpts(int argc, char **argv)
 		("h,help", "Print this help message")
 		("r,refresh", "Refresh the db file",
 			cxxopts::value(opts.refresh)->default_value("false"))
+		("db-url", "Where the db (and its deltas) is published (URL or directory)",
+			cxxopts::value(opts.dbURL)->default_value("https://kerncvs.suse.de"))
+		("no-deltas", "Refresh by downloading the whole db, not by deltas",
+			cxxopts::value(opts.noDeltas)->default_value("false"))
+		("zstd", "Download and keep the db compressed, it is read without decompressing",
+			cxxopts::value(opts.zstd)->default_value("false"))
 	;
 	options.add_options("Paths")
 		("k,kernel-tree", "Clone of the mainline kernel repo",
@@ -471,6 +486,64 @@ void handleSHAs(const Opts &opts, const F2CSQLConn &sql)
 	});
 }
 
+/**
+ * @brief Download the db to @p cacheDir, or refresh it there
+ *
+ * A stale db is brought up to date by the deltas published next to the db. If there is no
+ * chain of deltas from it, the whole db is downloaded. --db-url without a scheme is a local
+ * directory, the files are copied from there then. With --zstd, the compressed db is
+ * downloaded, see SeekableZstd.
+ */
+std::filesystem::path obtainDB(const Opts &opts, const std::filesystem::path &cacheDir)
+{
+	static constexpr const std::chrono::days maxAge { 7 };
+	const std::string name = opts.zstd ? "conf_file_map.sqlite.zst" : "conf_file_map.sqlite";
+	const auto db = cacheDir / name;
+	const auto local = opts.dbURL.find("://") == std::string::npos;
+
+	const auto stale = [&db]() {
+		return std::filesystem::last_write_time(db) + maxAge <
+				std::filesystem::file_time_type::clock::now();
+	};
+	const auto fetch = [&opts, local](const std::string &file, const std::filesystem::path &dest) {
+		try {
+			if (local)
+				std::filesystem::copy_file(std::filesystem::path(opts.dbURL) / file, dest,
+						std::filesystem::copy_options::overwrite_existing);
+			else
+				SlCurl::LibCurl::fetchFileIfNeeded(dest, opts.dbURL + "/" + file, true,
+								   false, maxAge);
+			return true;
+		} catch (const std::runtime_error &) {
+			return false;
+		}
+	};
+
+	const auto exists = std::filesystem::exists(db);
+	if (exists && !opts.refresh && !stale())
+		return db;
+
+	if (exists && !opts.noDeltas) {
+		try {
+			if (Delta::update(db, fetch, cacheDir / "deltas")) {
+				std::filesystem::last_write_time(db,
+						std::filesystem::file_time_type::clock::now());
+				return db;
+			}
+		} catch (const std::runtime_error &e) {
+			Clr(std::cerr, Clr::YELLOW) << "Cannot apply deltas: " << e.what();
+		}
+	}
+
+	if (local) {
+		if (!fetch(name, db))
+			RunEx("Cannot copy the db from ") << opts.dbURL << raise;
+		return db;
+	}
+
+	return SlCurl::LibCurl::fetchFileIfNeeded(db, opts.dbURL + "/" + name, true, false, maxAge);
+}
+
 void handleEx(int argc, char **argv)
 {
 	auto opts = getOpts(argc, argv);
@@ -481,12 +554,11 @@ void handleEx(int argc, char **argv)
 	if (SGMCacheDir.empty())
 		RunEx("Unable to create a cache dir") << raise;
 
-	if (!opts.hasSqlite) {
-		opts.sqlite = SlCurl::LibCurl::fetchFileIfNeeded(SGMCacheDir / "conf_file_map.sqlite",
-								 "https://kerncvs.suse.de/conf_file_map.sqlite",
-								 opts.refresh, false,
-								 std::chrono::days{7});
-	}
+	// compressed dbs are opened transparently, also by --sqlite
+	SeekableZstd::registerVFS(true);
+
+	if (!opts.hasSqlite)
+		opts.sqlite = obtainDB(opts, SGMCacheDir);
 
 	F2CSQLConn sql;
 	if (!sql.open(opts.sqlite, SlSqlite::OpenFlags::READ_ONLY))
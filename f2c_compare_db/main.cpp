@@ -0,0 +1,546 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <cxxopts.hpp>
+#include <filesystem>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include <sl/helpers/Color.h>
+#include <sl/helpers/Exception.h>
+
+using Clr = SlHelpers::Color;
+using RunEx = SlHelpers::RuntimeException;
+using SlHelpers::raise;
+
+namespace {
+
+/// @brief A compared view with its columns and the --order-* option of its output
+struct Table {
+	std::string_view view;
+	std::string_view columns;
+	std::string_view orderOpt;
+	std::string_view defaultOrder;
+};
+
+static constexpr const Table tables[] = {
+	{ "file_support_map_view", "branch, path, enabled, supported", "order-file-support",
+		"1, 2, 3, 4" },
+	{ "conf_file_map_view", "branch, config, path", "order-conf-file", "1, 2, 3" },
+	{ "conf_branch_map_view", "branch, flavor, arch, config, value", "order-conf-branch",
+		"1, 2, 3, 4, 5" },
+	{ "module_file_map_view", "branch, module, path", "order-module-file", "1, 2, 3" },
+	{ "module_details_map_view", "branch, module, supported", "order-module-details",
+		"1, 2, 3" },
+	{ "ignored_file_branch_map_view", "branch, path", "order-ignored-file-branch", "1, 2" },
+	{ "user_file_map_view", "branch, email, path", "order-user-file", "1, 2, 3" },
+};
+
+struct Opts {
+	std::vector<std::string> branches;
+	std::vector<std::string> ignores;
+	bool stats;
+	/// @brief Zero-based columns to sort the output by, per tables[] entry
+	std::vector<std::vector<unsigned>> orders;
+	std::filesystem::path oldDB;
+	std::filesystem::path newDB;
+};
+
+constexpr unsigned columnCount(const Table &table)
+{
+	return std::count(table.columns.begin(), table.columns.end(), ',') + 1;
+}
+
+/// @brief Parse "1, 2, 3" into { 0, 1, 2 }
+std::vector<unsigned> parseOrder(const Table &table, const std::string &order)
+{
+	if (!std::all_of(order.begin(), order.end(), [](char c) {
+		return std::isdigit(c) || c == ' ' || c == ',';
+	}))
+		RunEx("You can specify order only with numbers, commas and spaces: \"") <<
+			order << '"' << raise;
+
+	std::vector<unsigned> ret;
+	std::istringstream ss(order);
+	for (std::string col; std::getline(ss, col, ','); ) {
+		const auto start = col.find_first_not_of(' ');
+		if (start == col.npos)
+			continue;
+		const auto idx = std::stoul(col.substr(start));
+		if (!idx || idx > columnCount(table))
+			RunEx("Order column ") << idx << " out of range for " << table.view << raise;
+		ret.push_back(idx - 1);
+	}
+
+	return ret;
+}
+
+Opts getOpts(int argc, char **argv)
+{
+	cxxopts::Options options { argv[0], "Compare two conf_file_map databases" };
+	Opts opts {};
+	options.add_options()
+		("h,help", "Print this help message")
+		("b,branch", "compare only these branches", cxxopts::value(opts.branches))
+		("c,color", "force the color output")
+		("I,ignore", "ignore these branches", cxxopts::value(opts.ignores))
+		("s,stats", "print only stats", cxxopts::value(opts.stats)->default_value("false"))
+		("old-db", "database prefixed with '-' in the output",
+			cxxopts::value(opts.oldDB))
+		("new-db", "database prefixed with '+' in the output",
+			cxxopts::value(opts.newDB))
+	;
+	for (const auto &t: tables) {
+		std::string table { t.view.substr(0, t.view.size() - strlen("_view")) };
+		options.add_options("Order")
+			(std::string(t.orderOpt), "order of the output of " + table,
+				cxxopts::value<std::string>()->default_value(std::string(t.defaultOrder)))
+		;
+	}
+	options.parse_positional({ "old-db", "new-db" });
+	options.positional_help("old-db new-db");
+
+	try {
+		auto cxxopts = options.parse(argc, argv);
+		if (cxxopts.contains("help")) {
+			std::cout << options.help();
+			exit(0);
+		}
+		Clr::forceColor(cxxopts.contains("color"));
+		Clr::forceColorValue(cxxopts.contains("color"));
+
+		if (!cxxopts.contains("old-db") || !cxxopts.contains("new-db")) {
+			Clr(std::cerr, Clr::RED) << "Both old-db and new-db have to be specified";
+			std::cerr << options.help();
+			exit(EXIT_FAILURE);
+		}
+
+		if (!opts.branches.empty() && !opts.ignores.empty()) {
+			Clr(std::cerr, Clr::RED) << "You cannot specify both ignores and branches";
+			exit(EXIT_FAILURE);
+		}
+
+		for (const auto &t: tables)
+			opts.orders.push_back(parseOrder(t,
+				cxxopts[std::string(t.orderOpt)].as<std::string>()));
+
+		return opts;
+	} catch (const cxxopts::exceptions::parsing &e) {
+		Clr(std::cerr, Clr::RED) << "arguments error: " << e.what();
+		std::cerr << options.help();
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief A value of a column
+ *
+ * The order of the alternatives and compare() follow the sort order of SQLite, so that rows
+ * returned by ORDER BY can be merged.
+ */
+using Value = std::variant<std::monostate, sqlite3_int64, double, std::string>;
+using Row = std::vector<Value>;
+
+int compare(const Value &a, const Value &b)
+{
+	const auto numeric = [](const Value &v) {
+		return std::holds_alternative<sqlite3_int64>(v) || std::holds_alternative<double>(v);
+	};
+	const auto toDouble = [](const Value &v) {
+		if (auto i = std::get_if<sqlite3_int64>(&v))
+			return static_cast<double>(*i);
+		return std::get<double>(v);
+	};
+
+	if (numeric(a) && numeric(b)) {
+		if (auto ia = std::get_if<sqlite3_int64>(&a))
+			if (auto ib = std::get_if<sqlite3_int64>(&b))
+				return (*ia > *ib) - (*ia < *ib);
+		const auto da = toDouble(a);
+		const auto db = toDouble(b);
+		return (da > db) - (da < db);
+	}
+
+	const auto rank = [&numeric](const Value &v) -> int {
+		return numeric(v) ? 1 : v.index() == 0 ? 0 : 2;
+	};
+	if (rank(a) != rank(b))
+		return rank(a) - rank(b);
+	if (const auto sa = std::get_if<std::string>(&a))
+		return sa->compare(std::get<std::string>(b));
+
+	return 0;
+}
+
+int compare(const Row &a, const Row &b)
+{
+	for (size_t i = 0; i < a.size(); ++i)
+		if (const auto ret = compare(a[i], b[i]))
+			return ret;
+
+	return 0;
+}
+
+/// @brief Format @p v like the python script did
+std::string toString(const Value &v)
+{
+	std::ostringstream ss;
+	std::visit([&ss](const auto &val) {
+		if constexpr (std::is_same_v<std::decay_t<decltype(val)>, std::monostate>)
+			ss << "None";
+		else
+			ss << val;
+	}, v);
+	return ss.str();
+}
+
+/**
+ * @brief Read-only connection to one of the compared databases
+ *
+ * SlSqlite::SQLConn::select() returns all the rows at once. The views are far too big for
+ * that, so this steps through the rows using the sqlite3 API directly.
+ */
+class DB {
+public:
+	DB(const std::filesystem::path &path) {
+		sqlite3 *db;
+		auto ret = sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr);
+		m_db.reset(db);
+		if (ret != SQLITE_OK)
+			RunEx("Unable to open the db ") << path << ": " << lastError() << raise;
+	}
+
+	const char *lastError() const { return sqlite3_errmsg(m_db.get()); }
+
+	class Stmt {
+	public:
+		Stmt(const DB &db, const std::string &sql) : m_db(db) {
+			sqlite3_stmt *stmt;
+			if (sqlite3_prepare_v2(db.m_db.get(), sql.c_str(), -1, &stmt,
+					       nullptr) != SQLITE_OK)
+				RunEx("Cannot prepare '") << sql << "': " << db.lastError() << raise;
+			m_stmt.reset(stmt);
+		}
+
+		void reset() {
+			sqlite3_reset(m_stmt.get());
+		}
+
+		void bind(int idx, const std::string &text) {
+			if (sqlite3_bind_text(m_stmt.get(), idx, text.c_str(), -1,
+					      SQLITE_TRANSIENT) != SQLITE_OK)
+				RunEx("Cannot bind: ") << m_db.lastError() << raise;
+		}
+
+		/// @brief Fetch the next row into @p row, return false at the end
+		bool step(Row &row) {
+			const auto ret = sqlite3_step(m_stmt.get());
+			if (ret == SQLITE_DONE)
+				return false;
+			if (ret != SQLITE_ROW)
+				RunEx("Cannot step: ") << m_db.lastError() << raise;
+
+			auto stmt = m_stmt.get();
+			const auto cols = sqlite3_column_count(stmt);
+			row.resize(cols);
+			for (auto i = 0; i < cols; ++i) {
+				switch (sqlite3_column_type(stmt, i)) {
+				case SQLITE_NULL:
+					row[i] = std::monostate();
+					break;
+				case SQLITE_INTEGER:
+					row[i] = sqlite3_column_int64(stmt, i);
+					break;
+				case SQLITE_FLOAT:
+					row[i] = sqlite3_column_double(stmt, i);
+					break;
+				default:
+					row[i] = std::string(reinterpret_cast<const char *>(
+						sqlite3_column_text(stmt, i)),
+						sqlite3_column_bytes(stmt, i));
+					break;
+				}
+			}
+
+			return true;
+		}
+	private:
+		const DB &m_db;
+		std::unique_ptr<sqlite3_stmt, decltype([](sqlite3_stmt *s) {
+			sqlite3_finalize(s);
+		})> m_stmt;
+	};
+private:
+	std::unique_ptr<sqlite3, decltype([](sqlite3 *db) { sqlite3_close(db); })> m_db;
+};
+
+/**
+ * @brief Reads distinct rows of a view, sorted by all columns
+ *
+ * Ids differ between the databases, so the rows cannot be merged in the order of the indexes
+ * and have to be sorted by their names. To avoid sorting a whole view at once, it is read one
+ * branch at a time (@p branches are sorted). The branch lookup uses the branch indexes of the
+ * mapping tables and only the rows of that branch are sorted.
+ */
+class ViewReader {
+public:
+	ViewReader(const DB &db, const Table &table, const std::vector<std::string> &branches) :
+		m_stmt(db, buildSelect(table)), m_branches(branches), m_branch(0),
+		m_valid(false) {
+		if (!m_branches.empty())
+			m_stmt.bind(1, m_branches.front());
+		next();
+	}
+
+	bool valid() const { return m_valid; }
+	const Row &row() const { return m_row; }
+	Row &row() { return m_row; }
+
+	/// @brief Move to the next row different from the current one (like EXCEPT does)
+	void next() {
+		if (!m_valid) {
+			m_valid = step(m_row);
+			return;
+		}
+		Row row;
+		while ((m_valid = step(row)))
+			if (compare(row, m_row)) {
+				m_row = std::move(row);
+				return;
+			}
+	}
+private:
+	/// @brief Fetch the next row of the current branch, or of the following ones
+	bool step(Row &row) {
+		if (m_branch >= m_branches.size())
+			return false;
+
+		while (!m_stmt.step(row)) {
+			if (++m_branch >= m_branches.size())
+				return false;
+			m_stmt.reset();
+			m_stmt.bind(1, m_branches[m_branch]);
+		}
+
+		return true;
+	}
+
+	static std::string buildSelect(const Table &table) {
+		std::ostringstream sel;
+		sel << "SELECT " << table.columns << " FROM " << table.view <<
+		       " WHERE branch = ? ORDER BY ";
+		for (auto i = 2U; i <= columnCount(table); ++i)
+			sel << (i > 2 ? ", " : "") << i;
+
+		return sel.str();
+	}
+
+	DB::Stmt m_stmt;
+	const std::vector<std::string> &m_branches;
+	size_t m_branch;
+	Row m_row;
+	bool m_valid;
+};
+
+struct TableDiff {
+	std::vector<Row> removed;
+	std::vector<Row> added;
+};
+
+/**
+ * @brief Merge-diff one view of the two databases
+ *
+ * Both sides are streamed in the same order, so only the differing rows are kept in memory.
+ * Each call opens its own connections, so that tables can be compared in parallel.
+ */
+TableDiff compareTable(const Table &table, const std::vector<unsigned> &order,
+		       const std::vector<std::string> &branches, const Opts &opts)
+{
+	DB oldDB(opts.oldDB);
+	DB newDB(opts.newDB);
+	ViewReader oldRows(oldDB, table, branches);
+	ViewReader newRows(newDB, table, branches);
+	TableDiff diff;
+
+	while (oldRows.valid() || newRows.valid()) {
+		const auto cmp = !oldRows.valid() ? 1 : !newRows.valid() ? -1 :
+			compare(oldRows.row(), newRows.row());
+		if (cmp < 0) {
+			diff.removed.push_back(oldRows.row());
+			oldRows.next();
+		} else if (cmp > 0) {
+			diff.added.push_back(newRows.row());
+			newRows.next();
+		} else {
+			oldRows.next();
+			newRows.next();
+		}
+	}
+
+	const auto byOrder = [&order](const Row &a, const Row &b) {
+		for (const auto col: order)
+			if (const auto ret = compare(a[col], b[col]))
+				return ret < 0;
+		return false;
+	};
+	std::stable_sort(diff.removed.begin(), diff.removed.end(), byOrder);
+	std::stable_sort(diff.added.begin(), diff.added.end(), byOrder);
+
+	return diff;
+}
+
+void printTable(const Table &table, TableDiff &&diff, const Opts &opts)
+{
+	if (!opts.stats)
+		Clr(Clr::GREEN) << "=== Comparing \"" << table.view << "\" ===";
+
+	std::vector<std::pair<std::string, unsigned>> changedBranches;
+	const auto printRows = [&changedBranches, &opts](const std::vector<Row> &rows,
+							 bool added) {
+		for (const auto &row: rows) {
+			const auto branch = toString(row[0]);
+			auto it = std::find_if(changedBranches.begin(), changedBranches.end(),
+					       [&branch](const auto &e) {
+				return e.first == branch;
+			});
+			if (it == changedBranches.end())
+				changedBranches.emplace_back(branch, 1);
+			else
+				it->second++;
+
+			if (opts.stats)
+				continue;
+
+			Clr c(added ? Clr::GREEN : Clr::RED);
+			c << (added ? '+' : '-');
+			for (size_t i = 0; i < row.size(); ++i) {
+				if (i)
+					c << ',';
+				c << toString(row[i]);
+			}
+		}
+	};
+
+	printRows(diff.removed, false);
+	printRows(diff.added, true);
+
+	std::ostringstream changes;
+	for (const auto &[branch, count]: changedBranches)
+		changes << (changes.tellp() ? ", " : "") << branch << " (" << count << ')';
+
+	if (!opts.stats)
+		std::cout << "Changed branches: " << changes.str() << '\n';
+	else if (!changedBranches.empty())
+		std::cout << table.view << ": " << changes.str() << '\n';
+}
+
+using Branches = std::map<std::string, std::string>;
+
+/// @brief Read branch -> short SHA of the db at @p path
+Branches readBranches(const std::filesystem::path &path)
+{
+	DB db(path);
+	DB::Stmt stmt(db, "SELECT branch, sha FROM branch;");
+	Branches ret;
+	for (Row row; stmt.step(row); ) {
+		ret.emplace(toString(row[0]), toString(row[1]).substr(0, 12));
+	}
+	return ret;
+}
+
+/// @brief Sorted branches of both dbs, limited by --branch or --ignore
+std::vector<std::string> comparedBranches(const Branches &oldBranches,
+					  const Branches &newBranches, const Opts &opts)
+{
+	std::set<std::string> all;
+	for (const auto branches: { &oldBranches, &newBranches })
+		for (const auto &e: *branches)
+			all.insert(e.first);
+
+	std::vector<std::string> ret;
+	for (const auto &branch: all) {
+		const auto in = [&branch](const std::vector<std::string> &array) {
+			return std::find(array.begin(), array.end(), branch) != array.end();
+		};
+		if (!opts.branches.empty() ? in(opts.branches) : !in(opts.ignores))
+			ret.push_back(branch);
+	}
+
+	return ret;
+}
+
+void dumpSHAs(const Branches &oldBranches, const Branches &newBranches)
+{
+	const auto print = [](const std::string &branch, const std::string *oldSHA,
+			      const std::string *newSHA) {
+		std::string note;
+		if (!oldSHA)
+			note += " <ADDED>";
+		if (!newSHA)
+			note += " <REMOVED>";
+		const std::string none(12, '0');
+		const auto &sha1 = oldSHA ? *oldSHA : none;
+		const auto &sha2 = newSHA ? *newSHA : none;
+		if (sha1 == sha2)
+			note += " <UNCHANGED>";
+		std::cout << std::left << std::setw(30) << branch + ':' << ' ' << sha1 << ".." <<
+			     sha2 << note << '\n';
+	};
+
+	Clr(Clr::GREEN) << "=== Branches SHAS ===";
+	// like ORDER BY of FULL OUTER JOIN: added (NULL in old) first
+	for (const auto &[branch, sha]: newBranches)
+		if (!oldBranches.contains(branch))
+			print(branch, nullptr, &sha);
+	for (const auto &[branch, sha]: oldBranches) {
+		const auto it = newBranches.find(branch);
+		print(branch, &sha, it != newBranches.end() ? &it->second : nullptr);
+	}
+}
+
+void handleEx(int argc, char **argv)
+{
+	const auto opts = getOpts(argc, argv);
+	const auto oldBranches = readBranches(opts.oldDB);
+	const auto newBranches = readBranches(opts.newDB);
+	const auto branches = comparedBranches(oldBranches, newBranches, opts);
+
+	dumpSHAs(oldBranches, newBranches);
+
+	std::vector<std::future<TableDiff>> diffs;
+	for (size_t i = 0; i < std::size(tables); ++i)
+		diffs.push_back(std::async(std::launch::async, compareTable, std::cref(tables[i]),
+					   std::cref(opts.orders[i]), std::cref(branches),
+					   std::cref(opts)));
+
+	if (opts.stats)
+		Clr(Clr::GREEN) << "=== Stats ===";
+	for (size_t i = 0; i < std::size(tables); ++i)
+		printTable(tables[i], diffs[i].get(), opts);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	try {
+		handleEx(argc, argv);
+	} catch (std::runtime_error &e) {
+		Clr(std::cerr, Clr::RED) << e.what();
+		return EXIT_FAILURE;
+	}
+
+	return 0;
+}
@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <unistd.h>
+
+#include <sl/helpers/Exception.h>
+
+#include "AtomicFile.h"
+
+using RunEx = SlHelpers::RuntimeException;
+using SlHelpers::raise;
+
+using namespace F2C;
+
+/**
+ * @brief Write @p file using @p writer, creating its directory if needed
+ *
+ * The temporary file name contains the pid and a counter, so that concurrent writers of the
+ * same file (threads or processes) do not clobber each other's temporaries. Throws on errors.
+ */
+void AtomicFile::write(const std::filesystem::path &file, const Writer &writer)
+{
+	static std::atomic<unsigned> counter;
+
+	const auto dir = file.has_parent_path() ? file.parent_path() : ".";
+	std::filesystem::create_directories(dir);
+
+	auto tmp = dir / ("." + file.filename().string() + '.' + std::to_string(getpid()) + '.' +
+			  std::to_string(counter++) + ".tmp");
+	try {
+		{
+			std::ofstream ofs(tmp);
+			if (!ofs)
+				RunEx("Cannot create ") << tmp << ": " << strerror(errno) << raise;
+
+			writer(ofs);
+			if (!ofs.flush())
+				RunEx("Cannot write ") << tmp << raise;
+		}
+
+		sync(tmp);
+		std::filesystem::rename(tmp, file);
+	} catch (...) {
+		std::error_code ec;
+		std::filesystem::remove(tmp, ec);
+		throw;
+	}
+
+	sync(dir);
+}
+
+/// @brief Like write(), but return false on errors, for optional files like caches
+bool AtomicFile::tryWrite(const std::filesystem::path &file, const Writer &writer)
+{
+	try {
+		write(file, writer);
+	} catch (const std::exception &) {
+		return false;
+	}
+
+	return true;
+}
+
+/// @brief fsync() @p path, a file or a directory. Throws on errors.
+void AtomicFile::sync(const std::filesystem::path &path)
+{
+	const auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		RunEx("Cannot open ") << path << ": " << strerror(errno) << raise;
+
+	const auto ret = fsync(fd);
+	const auto err = errno;
+	close(fd);
+	if (ret)
+		RunEx("Cannot sync ") << path << ": " << strerror(err) << raise;
+}
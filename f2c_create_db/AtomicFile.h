@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <ostream>
+
+namespace F2C {
+
+/**
+ * @brief Files replaced atomically
+ *
+ * The content is written to a hidden temporary file in the same directory, which is then
+ * renamed over the target. So readers, even on other hosts sharing the filesystem, see either
+ * the old or the complete new file, never a partial one. Both the file and the directory are
+ * synced, so that this holds after a crash too.
+ */
+class AtomicFile {
+public:
+	using Writer = std::function<void (std::ostream &)>;
+
+	static void write(const std::filesystem::path &file, const Writer &writer);
+	static bool tryWrite(const std::filesystem::path &file, const Writer &writer);
+
+	static void sync(const std::filesystem::path &path);
+};
+
+} // namespace
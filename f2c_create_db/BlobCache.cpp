@@ -0,0 +1,530 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <unistd.h>
+
+#include <sl/helpers/Color.h>
+#include <sl/helpers/Exception.h>
+#include <sl/helpers/Process.h>
+#include <sl/helpers/PtrStore.h>
+#include <sl/helpers/String.h>
+
+#include "AtomicFile.h"
+#include "BlobCache.h"
+#include "Verbose.h"
+
+using Clr = SlHelpers::Color;
+using RunEx = SlHelpers::RuntimeException;
+using SlHelpers::raise;
+
+using namespace F2C;
+
+namespace {
+
+/// @brief A file created by mkstemp() in the temporary directory, removed on destruction
+class TempFile {
+public:
+	TempFile(const std::string &prefix) {
+		auto tmpl = (std::filesystem::temp_directory_path() / (prefix + "XXXXXX")).string();
+		const auto fd = mkstemp(tmpl.data());
+		if (fd < 0)
+			RunEx("Cannot create ") << tmpl << ": " << strerror(errno) << raise;
+		close(fd);
+		m_path = std::move(tmpl);
+	}
+	~TempFile() {
+		std::error_code ec;
+		std::filesystem::remove(m_path, ec);
+	}
+
+	const std::filesystem::path &path() const { return m_path; }
+private:
+	std::filesystem::path m_path;
+};
+
+/// @brief Run git with @p args in @p workDir and pass each line of its output to @p lineCB
+bool gitLines(const std::string &workDir, std::vector<std::string> args,
+	      const std::function<void (std::string_view line)> &lineCB)
+{
+	args.insert(args.begin(), { "-C", workDir });
+
+	SlHelpers::Process p;
+	p.spawn("/usr/bin/git", args, true);
+
+	SlHelpers::PtrStore<FILE, decltype([](FILE *f) { if (f) fclose(f); })> stream;
+	stream.reset(fdopen(p.readPipe(), "r"));
+	if (!stream)
+		RunEx("Cannot open stdout of git").raise();
+
+	SlHelpers::PtrStore<char, decltype([](char *ptr) { free(ptr); })> lineRaw;
+	size_t len = 0;
+
+	while (getline(lineRaw.ptr(), &len, stream.get()) != -1)
+		lineCB(lineRaw.str());
+
+	return p.waitForFinished() && !p.signalled() && !p.exitStatus();
+}
+
+} // namespace
+
+/**
+ * @brief Find ids of the top-level objects in @p commit using git ls-tree
+ *
+ * Empty ids mean no caching.
+ */
+const BlobCache::ObjectIds &BlobCache::objectIds(const SlGit::Commit &commit)
+{
+	const auto commitId = commit.idStr();
+	if (auto it = m_objectIds.find(commitId); it != m_objectIds.end())
+		return it->second;
+
+	ObjectIds ids;
+
+	// <mode> SP <type> SP <object> TAB <file>
+	const auto ok = gitLines(commit.repo().workDir(), { "ls-tree", commitId, "--",
+				 "config", "supported.conf" }, [&ids](std::string_view line) {
+		auto vec = SlHelpers::String::splitSV(line, " \t\n");
+		if (vec.size() < 4)
+			return;
+		if (vec[3] == "config")
+			ids.config = vec[2];
+		else if (vec[3] == "supported.conf")
+			ids.supported = vec[2];
+	});
+
+	if (!ok) {
+		Clr(Clr::YELLOW) << "Cannot list objects of " << commitId << ", not caching";
+		ids = {};
+	}
+
+	return m_objectIds.emplace(commitId, std::move(ids)).first->second;
+}
+
+/**
+ * @brief Patches in series.conf of @p commit with the ids of their blobs
+ *
+ * Patches not present in the tree are skipped. nullopt means no caching.
+ */
+std::optional<std::vector<BlobCache::Patch>>
+BlobCache::seriesPatches(const SlGit::Commit &commit)
+{
+	const auto series = commit.catFile("series.conf");
+	if (!series)
+		return std::nullopt;
+
+	std::vector<Patch> patches;
+	std::unordered_map<std::string, size_t> byPath;
+	std::set<std::string> dirs;
+	std::istringstream ss(*series);
+	for (std::string line; std::getline(ss, line); ) {
+		std::string_view uncommented(line);
+		uncommented = uncommented.substr(0, uncommented.find('#'));
+		const auto vec = SlHelpers::String::splitSV(uncommented, " \t");
+		if (vec.empty())
+			continue;
+
+		// the last word is the patch, guards may precede it
+		const std::string path(vec.back());
+		dirs.emplace(path.substr(0, path.find('/')));
+		byPath.emplace(path, patches.size());
+		patches.push_back({ .line = std::string(SlHelpers::String::trim(uncommented)),
+				    .blobId = {} });
+	}
+
+	std::vector<std::string> args { "ls-tree", "-r", commit.idStr(), "--" };
+	args.insert(args.end(), dirs.begin(), dirs.end());
+	const auto ok = gitLines(commit.repo().workDir(), args,
+				 [&patches, &byPath](std::string_view line) {
+		auto vec = SlHelpers::String::splitSV(line, " \t\n");
+		if (vec.size() < 4)
+			return;
+		if (auto it = byPath.find(std::string(vec[3])); it != byPath.end())
+			patches[it->second].blobId = vec[2];
+	});
+	if (!ok)
+		return std::nullopt;
+
+	std::erase_if(patches, [](const Patch &patch) { return patch.blobId.empty(); });
+
+	return patches;
+}
+
+/**
+ * @brief Create a commit with only @p patches in series.conf
+ *
+ * It has the tree of @p commit otherwise, so that SlKernCVS::PatchesAuthors reports the
+ * authors of @p patches only. The commit is created by git fast-import.
+ */
+SlGit::Commit BlobCache::seriesCommit(const SlGit::Commit &commit,
+				      const std::vector<const Patch *> &patches)
+{
+	const auto workDir = commit.repo().workDir();
+	const TempFile stream("f2c-series-");
+	const TempFile marks("f2c-series-marks-");
+	// unique too, concurrent fast-imports must not race on the ref
+	const auto ref = "refs/f2c/" + stream.path().filename().string();
+
+	{
+		std::string series;
+		for (const auto patch: patches)
+			series += patch->line + '\n';
+
+		std::ofstream ofs(stream.path());
+		ofs << "commit " << ref << "\n"
+			"mark :1\n"
+			"committer f2c <f2c> 0 +0000\n"
+			"data 0\n"
+			"from " << commit.idStr() << "\n"
+			"M 100644 inline series.conf\n"
+			"data " << series.size() << '\n' << series << '\n';
+		if (!ofs.flush())
+			RunEx("Cannot write ") << stream.path() << raise;
+	}
+
+	SlHelpers::Process p;
+	const auto ok = p.run("/bin/sh", { "-c", "exec /usr/bin/git -C \"$1\" fast-import "
+			      "--quiet --export-marks=\"$2\" < \"$3\"", "sh", workDir,
+			      marks.path().string(), stream.path().string() });
+	// the commit stays until gc, the tree is not polluted by the ref
+	gitLines(workDir, { "update-ref", "-d", ref }, [](std::string_view) {});
+	if (!ok || p.exitStatus())
+		RunEx("Cannot create a commit of patches in ") << workDir << raise;
+
+	// :<mark> SP <commit>
+	std::string mark, id;
+	std::ifstream ifs(marks.path());
+	if (!(ifs >> mark >> id) || mark != ":1")
+		RunEx("Cannot read the commit created in ") << workDir << raise;
+
+	auto c = commit.repo().commitRevparseSingle(id);
+	if (!c)
+		RunEx("Cannot find created commit ") << std::quoted(id) << ": " <<
+			commit.repo().lastError() << raise;
+
+	return std::move(*c);
+}
+
+/// @brief Merge authors of sets of patches: union of users and sums of counts
+BlobCache::Authors BlobCache::mergeAuthors(const std::vector<const Authors *> &authors)
+{
+	Authors merged;
+	std::set<std::string_view> users;
+	std::map<std::pair<std::string_view, std::string_view>, std::pair<unsigned, unsigned>> files;
+
+	for (const auto &a: authors) {
+		for (const auto &user: a->users)
+			if (users.insert(user).second)
+				merged.users.push_back(user);
+		for (const auto &f: a->files) {
+			auto &counts = files[{ f.email, f.path }];
+			counts.first += f.count;
+			counts.second += f.realCount;
+		}
+	}
+
+	merged.files.reserve(files.size());
+	for (const auto &[key, counts]: files)
+		merged.files.push_back({
+			.email = std::string(key.first),
+			.path = std::string(key.second),
+			.count = counts.first,
+			.realCount = counts.second,
+		});
+
+	return merged;
+}
+
+BlobCache::Configs BlobCache::collectConfigs(const SlGit::Commit &commit)
+{
+	SlKernCVS::CollectConfigs cc { commit };
+	Configs configs;
+
+	for (const auto &arch: cc)
+		for (const auto &flavor: arch.second) {
+			auto &fc = configs.emplace_back(arch.first, flavor.first);
+			for (const auto &config: flavor.second)
+				fc.configs.emplace_back(config.first, config.second);
+		}
+
+	return configs;
+}
+
+/**
+ * @brief Load configs saved by saveConfigs()
+ *
+ * The format is a "arch flavor" line for each flavor, followed by "config value" lines and
+ * terminated by an empty line.
+ */
+std::shared_ptr<const BlobCache::Configs>
+BlobCache::loadConfigs(const std::string &treeId) const
+{
+	std::ifstream ifs(m_dir / treeId);
+	if (!ifs)
+		return {};
+
+	auto configs = std::make_shared<Configs>();
+	FlavorConfigs *fc = nullptr;
+	for (std::string line; std::getline(ifs, line); ) {
+		std::istringstream ss(line);
+		std::string first, second;
+		if (line.empty()) {
+			fc = nullptr;
+		} else if (!(ss >> first >> second)) {
+			return {};
+		} else if (!fc) {
+			fc = &configs->emplace_back(std::move(first), std::move(second));
+		} else {
+			if (second.size() != 1)
+				return {};
+			fc->configs.emplace_back(std::move(first),
+						 static_cast<SlKernCVS::ConfigValue>(second[0]));
+		}
+	}
+
+	return configs;
+}
+
+bool BlobCache::saveConfigs(const std::string &treeId, const Configs &configs) const
+{
+	return AtomicFile::tryWrite(m_dir / treeId, [&configs](std::ostream &os) {
+		for (const auto &fc: configs) {
+			os << fc.arch << ' ' << fc.flavor << '\n';
+			for (const auto &[config, value]: fc.configs)
+				os << config << ' ' << static_cast<char>(value) << '\n';
+			os << '\n';
+		}
+	});
+}
+
+/// @brief Where authors of the patches in @p commitId are stored, fanned out like git objects
+std::filesystem::path BlobCache::seriesAuthorsFile(const std::string &commitId) const
+{
+	return m_dir / "series" / commitId.substr(0, 2) / commitId.substr(2);
+}
+
+/**
+ * @brief Load all sets of patches with their authors saved by saveSeriesAuthors()
+ *
+ * The format is a "P blobId line" line per patch with its line in series.conf (guards can
+ * change the result), a "U email" line per user and a "F email count realCount path" line per
+ * file. Broken files are skipped.
+ */
+void BlobCache::loadSeriesAuthors()
+{
+	std::error_code ec;
+	for (const auto &entry: std::filesystem::recursive_directory_iterator(m_dir / "series",
+									       ec)) {
+		// skip temporaries of AtomicFile
+		if (!entry.is_regular_file() || entry.path().filename().string().starts_with('.'))
+			continue;
+
+		std::ifstream ifs(entry.path());
+		auto authors = std::make_shared<SeriesAuthors>();
+		bool ok = true;
+		for (std::string line; ok && std::getline(ifs, line); ) {
+			std::istringstream ss(line);
+			char type;
+			std::string first;
+			if (!(ss >> type >> first)) {
+				ok = false;
+			} else if (type == 'P') {
+				Patch patch { .line = {}, .blobId = std::move(first) };
+				ok = static_cast<bool>(std::getline(ss >> std::ws, patch.line));
+				authors->patches.push_back(std::move(patch));
+			} else if (type == 'U') {
+				authors->authors.users.push_back(std::move(first));
+			} else {
+				AuthorFile file {};
+				file.email = std::move(first);
+				ok = type == 'F' &&
+					(ss >> file.count >> file.realCount >> std::ws) &&
+					std::getline(ss, file.path);
+				authors->authors.files.push_back(std::move(file));
+			}
+		}
+
+		if (ok && !authors->patches.empty())
+			addSeriesAuthors(authors);
+	}
+
+	if (F2C::verbose)
+		std::cout << "Authors of " << m_seriesAuthors.size() << " patches loaded from " <<
+			     m_dir << '\n';
+}
+
+bool BlobCache::saveSeriesAuthors(const std::string &commitId,
+				  const SeriesAuthors &authors) const
+{
+	return AtomicFile::tryWrite(seriesAuthorsFile(commitId), [&authors](std::ostream &os) {
+		for (const auto &patch: authors.patches)
+			os << "P " << patch.blobId << ' ' << patch.line << '\n';
+		for (const auto &user: authors.authors.users)
+			os << "U " << user << '\n';
+		for (const auto &f: authors.authors.files)
+			os << "F " << f.email << ' ' << f.count << ' ' << f.realCount << ' ' <<
+			      f.path << '\n';
+	});
+}
+
+/// @brief Index @p authors by the blob ids of its patches
+void BlobCache::addSeriesAuthors(const std::shared_ptr<const SeriesAuthors> &authors)
+{
+	for (const auto &patch: authors->patches)
+		m_seriesAuthors[patch.blobId].push_back(authors);
+}
+
+/**
+ * @brief Configs of all arch/flavor pairs in config/ of @p commit
+ *
+ * The lock is not held while loading or collecting, so that branches with different config/
+ * trees are processed in parallel. Concurrent callers with the same tree may both collect it.
+ */
+std::shared_ptr<const BlobCache::Configs> BlobCache::configs(const SlGit::Commit &commit)
+{
+	std::string treeId;
+	{
+		std::lock_guard lock(m_lock);
+		treeId = objectIds(commit).config;
+		if (auto it = m_configs.find(treeId); !treeId.empty() && it != m_configs.end())
+			return it->second;
+	}
+
+	if (treeId.empty())
+		return std::make_shared<const Configs>(collectConfigs(commit));
+
+	auto configs = loadConfigs(treeId);
+	if (configs) {
+		if (F2C::verbose)
+			std::cout << "Configs of " << treeId << " loaded from cache\n";
+	} else {
+		auto collected = std::make_shared<const Configs>(collectConfigs(commit));
+		if (!saveConfigs(treeId, *collected))
+			Clr(Clr::YELLOW) << "Cannot save configs to " << m_dir;
+		configs = std::move(collected);
+	}
+
+	std::lock_guard lock(m_lock);
+	return m_configs.emplace(treeId, std::move(configs)).first->second;
+}
+
+/// @brief Parsed supported.conf of @p commit
+std::shared_ptr<const SlKernCVS::SupportedConf> BlobCache::supported(const SlGit::Commit &commit)
+{
+	std::string blobId;
+	{
+		std::lock_guard lock(m_lock);
+		blobId = objectIds(commit).supported;
+		if (auto it = m_supported.find(blobId); !blobId.empty() && it != m_supported.end())
+			return it->second;
+	}
+
+	auto suppConf = commit.catFile("supported.conf");
+	if (!suppConf)
+		RunEx("Cannot obtain supported.conf: ") << commit.repo().lastError() << raise;
+
+	auto supp = std::make_shared<const SlKernCVS::SupportedConf>(*suppConf);
+	if (blobId.empty())
+		return supp;
+
+	std::lock_guard lock(m_lock);
+	return m_supported.emplace(blobId, std::move(supp)).first->second;
+}
+
+/**
+ * @brief Authors of the patches in @p commit
+ *
+ * SlKernCVS::PatchesAuthors reports only the sums over all the patches it is run on. So the
+ * cache holds sets of patches collected together, not single patches. A set is reused when
+ * all its patches are in @p commit with the same lines in series.conf. The sets may overlap,
+ * the largest disjoint ones are taken. @p collect is called once for all the remaining
+ * patches, on a commit with only those in series.conf. They are cached as a new set.
+ */
+std::shared_ptr<const BlobCache::Authors> BlobCache::authors(const SlGit::Commit &commit,
+							     const CollectAuthors &collect)
+{
+	const auto patches = seriesPatches(commit);
+	if (!patches) {
+		Clr(Clr::YELLOW) << "Cannot list patches of " << commit.idStr() << ", not caching";
+		return std::make_shared<const Authors>(collect(commit));
+	}
+
+	std::unordered_map<std::string_view, std::string_view> lines;
+	for (const auto &patch: *patches)
+		lines.emplace(patch.blobId, patch.line);
+	const auto inSeries = [&lines](const Patch &patch) {
+		const auto it = lines.find(patch.blobId);
+		return it != lines.end() && it->second == patch.line;
+	};
+
+	std::vector<std::shared_ptr<const SeriesAuthors>> cached;
+	{
+		std::lock_guard lock(m_lock);
+		if (!m_seriesAuthorsLoaded) {
+			loadSeriesAuthors();
+			m_seriesAuthorsLoaded = true;
+		}
+
+		std::set<const SeriesAuthors *> seen;
+		for (const auto &patch: *patches) {
+			const auto it = m_seriesAuthors.find(patch.blobId);
+			if (it == m_seriesAuthors.end())
+				continue;
+			for (const auto &sa: it->second)
+				if (seen.insert(sa.get()).second &&
+						std::ranges::all_of(sa->patches, inSeries))
+					cached.push_back(sa);
+		}
+	}
+
+	std::ranges::stable_sort(cached, std::greater{}, [](const auto &sa) {
+		return sa->patches.size();
+	});
+
+	std::vector<const Authors *> authors;
+	std::set<std::string_view> covered;
+	const auto isCovered = [&covered](const Patch &patch) {
+		return covered.contains(patch.blobId);
+	};
+	for (const auto &sa: cached) {
+		if (std::ranges::any_of(sa->patches, isCovered))
+			continue;
+		for (const auto &patch: sa->patches)
+			covered.insert(patch.blobId);
+		authors.push_back(&sa->authors);
+	}
+
+	std::vector<const Patch *> missing;
+	for (const auto &patch: *patches)
+		if (!isCovered(patch))
+			missing.push_back(&patch);
+
+	if (F2C::verbose)
+		std::cout << "Authors of " << patches->size() - missing.size() << " of " <<
+			     patches->size() << " patches loaded from cache\n";
+
+	std::shared_ptr<SeriesAuthors> collected;
+	if (!missing.empty()) {
+		const auto seriesC = seriesCommit(commit, missing);
+		collected = std::make_shared<SeriesAuthors>();
+		for (const auto patch: missing)
+			collected->patches.push_back(*patch);
+		collected->authors = collect(seriesC);
+		if (!saveSeriesAuthors(seriesC.idStr(), *collected))
+			Clr(Clr::YELLOW) << "Cannot save authors to " << m_dir;
+
+		std::lock_guard lock(m_lock);
+		addSeriesAuthors(collected);
+		authors.push_back(&collected->authors);
+	}
+
+	return std::make_shared<const Authors>(mergeAuthors(authors));
+}
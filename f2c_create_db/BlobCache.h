@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sl/git/Commit.h>
+#include <sl/kerncvs/CollectConfigs.h>
+#include <sl/kerncvs/SupportedConf.h>
+
+namespace F2C {
+
+/**
+ * @brief Cache of data parsed from kernel-source, keyed by git object ids
+ *
+ * Branches share most of their config/ trees, supported.conf and patch blobs. Their parsed
+ * form is stored under the id of the git object, so that it is parsed only once. Configs and
+ * authors of patches are also stored in a directory to be reused by later runs.
+ */
+class BlobCache {
+public:
+	using ConfigList = std::vector<std::pair<std::string, SlKernCVS::ConfigValue>>;
+
+	struct FlavorConfigs {
+		std::string arch;
+		std::string flavor;
+		ConfigList configs;
+	};
+
+	/// @brief Configs in the order of SlKernCVS::CollectConfigs
+	using Configs = std::vector<FlavorConfigs>;
+
+	struct AuthorFile {
+		std::string email;
+		std::string path;
+		unsigned count;
+		unsigned realCount;
+	};
+
+	/// @brief What SlKernCVS::PatchesAuthors reports for a series
+	struct Authors {
+		std::vector<std::string> users;
+		std::vector<AuthorFile> files;
+	};
+
+	/// @brief Run SlKernCVS::PatchesAuthors on the series of the passed commit
+	using CollectAuthors = std::function<Authors (const SlGit::Commit &commit)>;
+
+	BlobCache() = delete;
+	BlobCache(const std::filesystem::path &dir) : m_dir(dir) {}
+
+	std::shared_ptr<const Configs> configs(const SlGit::Commit &commit);
+	std::shared_ptr<const SlKernCVS::SupportedConf> supported(const SlGit::Commit &commit);
+	std::shared_ptr<const Authors> authors(const SlGit::Commit &commit,
+					       const CollectAuthors &collect);
+private:
+	struct ObjectIds {
+		std::string config;
+		std::string supported;
+	};
+
+	/// @brief A patch of series.conf: its line there and the id of its blob
+	struct Patch {
+		std::string line;
+		std::string blobId;
+	};
+
+	/// @brief Authors of a set of patches, collected by a single SlKernCVS::PatchesAuthors run
+	struct SeriesAuthors {
+		std::vector<Patch> patches;
+		Authors authors;
+	};
+
+	const ObjectIds &objectIds(const SlGit::Commit &commit);
+	static std::optional<std::vector<Patch>> seriesPatches(const SlGit::Commit &commit);
+	static SlGit::Commit seriesCommit(const SlGit::Commit &commit,
+					  const std::vector<const Patch *> &patches);
+	static Authors mergeAuthors(const std::vector<const Authors *> &authors);
+
+	static Configs collectConfigs(const SlGit::Commit &commit);
+	std::shared_ptr<const Configs> loadConfigs(const std::string &treeId) const;
+	bool saveConfigs(const std::string &treeId, const Configs &configs) const;
+	std::filesystem::path seriesAuthorsFile(const std::string &commitId) const;
+	void loadSeriesAuthors();
+	bool saveSeriesAuthors(const std::string &commitId, const SeriesAuthors &authors) const;
+	void addSeriesAuthors(const std::shared_ptr<const SeriesAuthors> &authors);
+
+	const std::filesystem::path m_dir;
+
+	std::mutex m_lock;
+	/// @brief commit id -> ids of config/ and supported.conf
+	std::unordered_map<std::string, ObjectIds> m_objectIds;
+	std::unordered_map<std::string, std::shared_ptr<const Configs>> m_configs;
+	std::unordered_map<std::string,
+		std::shared_ptr<const SlKernCVS::SupportedConf>> m_supported;
+	bool m_seriesAuthorsLoaded = false;
+	/// @brief patch blob id -> the sets of patches it is part of
+	std::unordered_map<std::string,
+		std::vector<std::shared_ptr<const SeriesAuthors>>> m_seriesAuthors;
+};
+
+}
@@ -1,6 +1,9 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <algorithm>
+#include <future>
 #include <iomanip>
+#include <map>
 #include <nlohmann/json.hpp>
 
 #include <sl/helpers/Color.h>
@@ -11,8 +14,8 @@
 #include <sl/kerncvs/PatchesAuthors.h>
 
 #include "parser/kconfig/Config.h"
+#include "parser/kconfig/Finder.h"
 #include "parser/kconfig/Parser.h"
-#include "treewalker/SQLiteMakeVisitor.h"
 #include "treewalker/TreeWalker.h"
 #include "Ignores.h"
 #include "Verbose.h"
@@ -25,15 +28,6 @@ using SlHelpers::raise;
 
 using namespace F2C;
 
-auto BranchProcessor::getSupported(const SlGit::Commit &commit)
-{
-	auto suppConf = commit.catFile("supported.conf");
-	if (!suppConf)
-		RunEx("Cannot obtain supported.conf: ") << commit.repo().lastError() << raise;
-
-	return SlKernCVS::SupportedConf { *suppConf };
-}
-
 SlGit::Commit BranchProcessor::checkout()
 {
 	m_notifier.notify("Checking out");
@@ -87,24 +81,22 @@ bool constexpr BranchProcessor::betterConfig(Kconfig::ConfType oldType, Kconfig:
 		(newType == CT::Tristate || newType == CT::DefTristate);
 }
 
-void BranchProcessor::insertConfig(const Kconfig::Parser &p, Kconfig::Config::Configs &configs)
+void BranchProcessor::insertConfig(Kconfig::Config::Configs &configs, std::string realConf,
+				   Kconfig::ConfType type)
 {
-	p.walkConfigs([&configs](auto conf, auto type) {
-		auto realConf = "CONFIG_" + conf;
-		auto [it, inserted] = configs.try_emplace(realConf, type);
-		if (inserted)
-			return;
-		// For example KVM is defined both as a bool and tristate in different Kconfigs,
-		// so we need to store the "better" one (tristate).
-		if (betterConfig(it->second, type)) {
-			if (F2C::verbose > 1)
-				std::cout << "Config " << std::quoted(realConf) <<
-					" type changed from " <<
-					Kconfig::Config::getName(it->second) << " to " <<
-					Kconfig::Config::getName(type) << '\n';
-			it->second = type;
-		}
-	});
+	auto [it, inserted] = configs.try_emplace(std::move(realConf), type);
+	if (inserted)
+		return;
+	// For example KVM is defined both as a bool and tristate in different Kconfigs,
+	// so we need to store the "better" one (tristate).
+	if (betterConfig(it->second, type)) {
+		if (F2C::verbose > 1)
+			std::cout << "Config " << std::quoted(it->first) <<
+				" type changed from " <<
+				Kconfig::Config::getName(it->second) << " to " <<
+				Kconfig::Config::getName(type) << '\n';
+		it->second = type;
+	}
 }
 
 void BranchProcessor::insertConfigsToSQL(const Kconfig::Config::Configs &configs)
@@ -116,12 +108,69 @@ void BranchProcessor::insertConfigsToSQL(const Kconfig::Config::Configs &configs
 	}
 }
 
-Kconfig::Config::Configs BranchProcessor::parseKconfigs()
+BranchProcessor::KconfigChunk
+BranchProcessor::parseKconfigChunk(std::span<const std::filesystem::path> kconfigs)
 {
 	Kconfig::Parser p;
-	const auto excludeDir = m_expandedDir / "scripts" / "kconfig" / "tests";
-	const auto excludePath = m_expandedDir / "scripts" / "Kconfig.include";
+	KconfigChunk chunk;
+
+	for (const auto &path: kconfigs) {
+		if (!p.parse(path))
+			RunEx("Cannot parse: ") << path << raise;
+
+		p.walk([&chunk](auto conf, auto type) {
+			insertConfig(chunk.configs, "CONFIG_" + conf, type);
+		}, [&chunk, &path](auto source) {
+			chunk.sources.emplace_back(path, std::move(source));
+		});
+	}
+
+	return chunk;
+}
+
+/**
+ * @brief Parse @p kconfigs using all threads
+ *
+ * @p kconfigs are split into contiguous chunks, one per thread, each parsed into its own
+ * KconfigChunk. They are returned in the order of @p kconfigs, so that the result does not
+ * depend on which thread finished first.
+ */
+std::vector<BranchProcessor::KconfigChunk>
+BranchProcessor::parseKconfigsParallel(const std::vector<std::filesystem::path> &kconfigs)
+{
+	const auto chunks = std::max(1UL, std::min<size_t>(m_pool.size(), kconfigs.size()));
+	const std::span<const std::filesystem::path> all{kconfigs};
+
+	std::vector<std::future<KconfigChunk>> futures;
+	futures.reserve(chunks);
+	for (auto i = 0UL; i < chunks; ++i) {
+		const auto begin = i * all.size() / chunks;
+		const auto end = (i + 1) * all.size() / chunks;
+		futures.push_back(m_pool.push([chunk = all.subspan(begin, end - begin)]() {
+			return parseKconfigChunk(chunk);
+		}));
+	}
+
+	// the chunks refer to kconfigs, so let all of them finish before get() can throw
+	for (const auto &f: futures)
+		f.wait();
+
+	std::vector<KconfigChunk> ret;
+	ret.reserve(chunks);
+	for (auto &f: futures)
+		ret.push_back(f.get());
+
+	return ret;
+}
 
+/**
+ * @brief Parse all Kconfigs of the tree
+ *
+ * Kconfig::Finder passes them level by level following the source directives, each level is
+ * parsed in parallel.
+ */
+Kconfig::Config::Configs BranchProcessor::parseKconfigs()
+{
 	for (const auto &e: Kconfig::ConfigRange{}) {
 		std::string name(Kconfig::Config::getName(e));
 		if (!m_sql.insertConfigType(static_cast<unsigned>(e), name))
@@ -130,27 +179,23 @@ Kconfig::Config::Configs BranchProcessor::parseKconfigs()
 	}
 
 	Kconfig::Config::Configs configs;
-
-	for (auto it = std::filesystem::recursive_directory_iterator(m_expandedDir);
-	     it != std::filesystem::end(it); ++it) {
-		const auto &path = it->path();
-		if (it->is_directory()) {
-			if (path == excludeDir)
-				it.disable_recursion_pending();
-			continue;
+	const auto kconfigs = Kconfig::Finder(m_expandedDir).find([this, &configs](const auto &level) {
+		Kconfig::Finder::Sources sources;
+		for (auto &chunk: parseKconfigsParallel(level)) {
+			if (configs.empty())
+				configs = std::move(chunk.configs);
+			else
+				for (auto &[conf, type]: chunk.configs)
+					insertConfig(configs, conf, type);
+
+			sources.insert(sources.end(), std::make_move_iterator(chunk.sources.begin()),
+				       std::make_move_iterator(chunk.sources.end()));
 		}
-		if (!it->is_regular_file())
-			continue;
-		if (path.stem() != "Kconfig" && path.stem() != "Kconfig-nommu")
-			continue;
-		if (path == excludePath)
-			continue;
-
-		if (!p.parse(path, false))
-			RunEx("Cannot parse: ") << path << raise;
+		return sources;
+	});
 
-		insertConfig(p, configs);
-	}
+	if (F2C::verbose)
+		std::cout << "Parsed " << kconfigs.size() << " Kconfigs\n";
 
 	insertConfigsToSQL(configs);
 
@@ -161,7 +206,8 @@ void BranchProcessor::parseKbuilds(const SlKernCVS::SupportedConf &supp,
 				   const Kconfig::Config::Configs &configs,
 				   const EnabledConfigMap &enabledConfigs)
 {
-	TW::TreeWalker tw { m_sql, supp, m_branch, m_expandedDir, configs, enabledConfigs };
+	TW::TreeWalker tw { m_sink, m_pool, supp, m_branch, m_expandedDir, configs,
+			    enabledConfigs };
 	tw.walk();
 }
 
@@ -175,29 +221,66 @@ bool BranchProcessor::isValidUser(std::string_view email)
 	return m_validUsers.empty() || m_validUsers.contains(user);
 }
 
-void BranchProcessor::processAuthors(const SlGit::Commit &commit)
+/**
+ * @brief Find authors of the patches in @p commit
+ *
+ * BlobCache parses only the patches not covered by sets cached from other branches or runs,
+ * unless some of the debugging outputs of SlKernCVS::PatchesAuthors was requested. It does not touch the
+ * database, so it can run in parallel to other stages.
+ */
+std::shared_ptr<const BlobCache::Authors>
+BranchProcessor::collectAuthors(const SlGit::Commit &commit)
 {
-	SlKernCVS::PatchesAuthors PA{ m_repo, m_opts.authorsDumpRefs,
-		m_opts.authorsReportUnhandled };
+	auto collect = [this](const SlGit::Commit &commit) {
+		BlobCache::Authors authors;
+		SlKernCVS::PatchesAuthors PA{ commit.repo(), m_opts.authorsDumpRefs,
+			m_opts.authorsReportUnhandled };
 
-	auto ret = PA.processAuthors(commit, [this](const std::string &email) -> bool {
+		auto ret = PA.processAuthors(commit, [&authors](const std::string &email) -> bool {
+			authors.users.push_back(email);
+			return true;
+		}, [&authors](const std::string &email, std::filesystem::path &&path,
+				unsigned count, unsigned realCount) -> bool {
+			authors.files.push_back({
+				.email = email,
+				.path = path.string(),
+				.count = count,
+				.realCount = realCount,
+			});
+			return true;
+		});
+		if (!ret)
+			RunEx("Cannot process authors").raise();
 
+		return authors;
+	};
+
+	if (m_opts.authorsDumpRefs || m_opts.authorsReportUnhandled)
+		return std::make_shared<const BlobCache::Authors>(collect(commit));
+
+	return m_blobCache.authors(commit, collect);
+}
+
+void BranchProcessor::storeAuthors(const BlobCache::Authors &authors)
+{
+	for (const auto &email: authors.users) {
 		if (!isValidUser(email)) {
 			Clr(Clr::YELLOW) << "Skipping invalid user " << std::quoted(email);
-			return true;
+			continue;
 		}
-		return m_sql.insertUser(email);
-	}, [this](const std::string &email, std::filesystem::path &&path,
-			unsigned count, unsigned realCount) -> bool {
-		if (!isValidUser(email))
-			return true;
-		auto fileDir = m_sql.insertPath(path);
-		return fileDir && m_sql.insertUFMap(m_branch, email, std::move(fileDir->first),
-						    std::move(fileDir->second),
-						    count, realCount);
-	});
-	if (!ret)
-		RunEx("Cannot process authors").raise();
+		if (!m_sql.insertUser(email))
+			RunEx("Cannot process authors").raise();
+	}
+
+	for (const auto &f: authors.files) {
+		if (!isValidUser(f.email))
+			continue;
+		auto fileDir = m_sql.insertPath(f.path);
+		if (!fileDir || !m_sql.insertUFMap(m_branch, f.email, std::move(fileDir->first),
+						   std::move(fileDir->second),
+						   f.count, f.realCount))
+			RunEx("Cannot process authors").raise();
+	}
 }
 
 /// @brief Add a config to the map only if it is enabled and has higher value than the existing one
@@ -216,54 +299,107 @@ void BranchProcessor::addConfig(EnabledConfigMap &enabledConfigs, const std::str
 		old->second = newVal;
 }
 
+/**
+ * @brief Store configs of all arch/flavor pairs of a branch
+ *
+ * Every arch/flavor pair forms a column of the branch. A config is then stored as a single row
+ * with a string of values, one character per column. Identical strings are shared across
+ * configs and branches.
+ */
 EnabledConfigMap BranchProcessor::processConfigs(const SlGit::Commit &commit,
 						 const Kconfig::Config::Configs &configs)
 {
-	SlKernCVS::CollectConfigs cc { commit };
+	const auto cc = m_blobCache.configs(commit);
 
 	EnabledConfigMap enabledConfigs;
+	std::map<std::string, std::string> configVals;
+	const auto cols = cc->size();
+	auto col = 0U;
 
-	for (const auto &arch: cc) {
-		if (!m_sql.insertArch(arch.first))
-			RunEx(__func__) << ": cannot insert arch " << std::quoted(arch.first) << ": "
+	for (const auto &fc: *cc) {
+		if (!m_sql.insertArch(fc.arch))
+			RunEx(__func__) << ": cannot insert arch " << std::quoted(fc.arch) << ": "
 				<< m_sql.lastError() << raise;
 
-		for (const auto &flavor: arch.second) {
-			if (!m_sql.insertFlavor(flavor.first))
-				RunEx(__func__) << ": cannot insert flavor " <<
-					std::quoted(flavor.first) << ": " << m_sql.lastError() <<
-					raise;
-
-			for (const auto &config: flavor.second) {
-				if (!configs.contains(config.first)) {
-					Clr(Clr::YELLOW) << "config " << std::quoted(config.first) <<
-							       " is not defined (" << arch.first <<
-							       '/' << flavor.first << ')';
-					continue;
-				}
-
-				if (!m_sql.insertCBMap(m_branch, arch.first, flavor.first,
-						       config.first,
-						       std::string(1, static_cast<char>(config.second))))
-					RunEx(__func__) << ": cannot insert CB map for " <<
-						std::quoted(config.first) << " (" << arch.first <<
-						'/' << flavor.first << "): " << m_sql.lastError() <<
-						raise;
+		if (!m_sql.insertFlavor(fc.flavor))
+			RunEx(__func__) << ": cannot insert flavor " << std::quoted(fc.flavor) << ": "
+				<< m_sql.lastError() << raise;
 
-				addConfig(enabledConfigs, config.first, config.second);
+		if (!m_sql.insertCBColumn(m_branch, col, fc.arch, fc.flavor))
+			RunEx(__func__) << ": cannot insert CB column " << fc.arch << '/' <<
+				fc.flavor << ": " << m_sql.lastError() << raise;
+
+		for (const auto &config: fc.configs) {
+			if (!configs.contains(config.first)) {
+				Clr(Clr::YELLOW) << "config " << std::quoted(config.first) <<
+						       " is not defined (" << fc.arch << '/' <<
+						       fc.flavor << ')';
+				continue;
 			}
+
+			auto vals = configVals.try_emplace(config.first, cols, '-').first;
+			vals->second[col] = static_cast<char>(config.second);
+
+			addConfig(enabledConfigs, config.first, config.second);
 		}
+		col++;
 	}
 
+	for (const auto &[config, vals]: configVals)
+		if (!m_sql.insertCBMap(m_branch, config, vals))
+			RunEx(__func__) << ": cannot insert CB map for " << std::quoted(config) <<
+				": " << m_sql.lastError() << raise;
+
 	return enabledConfigs;
 }
 
+/**
+ * @brief Push @p task taking the commit @p SHA to m_pool
+ *
+ * SlGit repositories cannot be used by several threads at once and this thread keeps using
+ * m_repo. So the task opens its own handle of the repository and looks up the commit there.
+ */
+template<typename F>
+auto BranchProcessor::pushWithOwnRepo(const std::string &SHA, F &&task)
+{
+	return m_pool.push([this, SHA, task = std::forward<F>(task)]() {
+		auto repo = SlGit::Repo::open(m_repo.workDir());
+		if (!repo)
+			RunEx("Cannot open ") << m_repo.workDir() << ": " <<
+				SlGit::Repo::lastError() << raise;
+
+		auto commit = repo->commitRevparseSingle(SHA);
+		if (!commit)
+			RunEx("Cannot find ") << SHA << ": " << repo->lastError() << raise;
+
+		return task(*commit);
+	});
+}
+
+/**
+ * @brief Run all the stages for @p commit
+ *
+ * Only the Kbuild walk depends on other stages: supported info, Kconfigs and collected configs.
+ * Supported info, authors and ignores need nothing but the commit and the expanded tree, so
+ * they are computed on m_pool while this thread parses Kconfigs and walks Kbuilds. Only this
+ * thread writes to m_sql, the results of the pool tasks are stored once they are ready. The
+ * tasks using git get their own repository handle, see pushWithOwnRepo().
+ */
 void BranchProcessor::processInternal(SlGit::Commit &commit)
 {
+	// in the WAL mode, readers see either the old or the new branch
+	const auto replace = m_sql.inWAL() && m_sql.hasBranch(m_branch);
+	// the old rows are hidden by the delete and purged later, it must not cascade to them
+	if (replace && !m_sql.foreignKeys(false))
+		RunEx("Cannot switch foreign keys off: ") << m_sql.lastError() << raise;
+
 	m_sql.begin();
 	auto SHA = commit.idStr();
 	BranchProps props{ commit };
 
+	if (replace && !m_sql.deleteBranch(m_branch))
+		RunEx("Cannot delete branch '") << m_branch << "': " << m_sql.lastError() << raise;
+
 	if (!m_sql.insertBranch(m_branch, SHA, props.version))
 		RunEx("Cannot add branch '") << m_branch << "' with SHA '" << SHA << '\'' <<
 						raise;
@@ -271,27 +407,53 @@ void BranchProcessor::processInternal(SlGit::Commit &commit)
 	m_branchesProps.emplace(m_branch, std::move(props));
 
 	if (!m_opts.sqliteCreateOnly) {
-		m_notifier.notify("Retrieving supported info");
-		auto supp = getSupported(commit);
-
-		m_notifier.notify("Parsing Kconfigs");
-		auto configs = parseKconfigs();
-
-		m_notifier.notify("Collecting configs");
-		auto enabledConfigs = processConfigs(commit, configs);
-
-		m_notifier.notify("Parsing Kbuilds");
-		parseKbuilds(supp, configs, enabledConfigs);
-
-		m_notifier.notify("Detecting authors of patches");
-		processAuthors(commit);
-
-		if (m_configuration) {
-			m_notifier.notify("Collecting ignored files");
-			Ignores::process(m_sql, m_branch, *m_configuration, m_expandedDir);
+		auto suppFuture = pushWithOwnRepo(SHA, [this](const SlGit::Commit &commit) {
+			return m_blobCache.supported(commit);
+		});
+		auto authorsFuture = pushWithOwnRepo(SHA, [this](const SlGit::Commit &commit) {
+			return collectAuthors(commit);
+		});
+		std::future<Ignores::Paths> ignoredFuture;
+		if (m_configuration)
+			ignoredFuture = m_pool.push([this]() {
+				return Ignores::collect(m_branch, *m_configuration, m_expandedDir);
+			});
+
+		try {
+			m_notifier.notify("Parsing Kconfigs");
+			auto configs = parseKconfigs();
+
+			m_notifier.notify("Collecting configs");
+			auto enabledConfigs = processConfigs(commit, configs);
+
+			m_notifier.notify("Retrieving supported info");
+			auto supp = suppFuture.get();
+
+			m_notifier.notify("Parsing Kbuilds");
+			parseKbuilds(*supp, configs, enabledConfigs);
+
+			m_notifier.notify("Detecting authors of patches");
+			storeAuthors(*authorsFuture.get());
+
+			if (ignoredFuture.valid()) {
+				m_notifier.notify("Collecting ignored files");
+				Ignores::store(m_sql, m_branch, ignoredFuture.get());
+			}
+		} catch (...) {
+			// the tasks refer to this
+			if (suppFuture.valid())
+				suppFuture.wait();
+			if (authorsFuture.valid())
+				authorsFuture.wait();
+			if (ignoredFuture.valid())
+				ignoredFuture.wait();
+			throw;
 		}
 	}
 
 	m_notifier.notify("Committing");
 	m_sql.end();
+
+	if (replace && !m_sql.foreignKeys(true))
+		RunEx("Cannot switch foreign keys on: ") << m_sql.lastError() << raise;
 }
@@ -3,9 +3,12 @@
 #pragma once
 
 #include <filesystem>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include <nlohmann/json_fwd.hpp>
 
@@ -15,16 +18,15 @@
 #include <sl/kerncvs/LDAP.h>
 #include <sl/kerncvs/SupportedConf.h>
 
+#include "BlobCache.h"
 #include "BranchProps.h"
 #include "Configs.h"
 #include "F2CSQLConn.h"
 #include "Opts.h"
 #include "StatusNotifier.h"
+#include "ThreadPool.h"
 #include "parser/kconfig/Config.h"
-
-namespace Kconfig {
-	class Parser;
-}
+#include "treewalker/ResultSink.h"
 
 namespace F2C {
 
@@ -39,12 +41,15 @@ public:
 			BranchesProps &branchesProps,
 			const SlGit::Repo &repo,
 			F2CSQLConn &sql,
+			TW::ResultSink &sink,
+			ThreadPool &pool,
+			BlobCache &blobCache,
 			const Opts &opts,
 			const std::optional<Json> &configuration,
 			const SlKernCVS::LDAPUsers::UserSet &validUsers) :
 		m_branch(branch), m_notifier(notifier), m_scratchArea(scratchArea),
 		m_expandedDir(getExpandedDir()), m_branchesProps(branchesProps),
-		m_repo(repo), m_sql(sql), m_opts(opts), m_configuration(configuration),
+		m_repo(repo), m_sql(sql), m_sink(sink), m_pool(pool), m_blobCache(blobCache), m_opts(opts), m_configuration(configuration),
 		m_validUsers(validUsers) { }
 
 	void process() {
@@ -58,14 +63,23 @@ private:
 		std::replace(branch.begin(), branch.end(), '/', '_');
 		return m_scratchArea / branch;
 	}
-	static auto getSupported(const SlGit::Commit &commit);
 
 	SlGit::Commit checkout();
 	void expand();
 
+	/// @brief Configs and sources (with the Kconfig sourcing them) of a set of Kconfigs
+	struct KconfigChunk {
+		Kconfig::Config::Configs configs;
+		std::vector<std::pair<std::filesystem::path, Kconfig::Source>> sources;
+	};
+
+	static KconfigChunk parseKconfigChunk(std::span<const std::filesystem::path> kconfigs);
+	std::vector<KconfigChunk>
+		parseKconfigsParallel(const std::vector<std::filesystem::path> &kconfigs);
 	Kconfig::Config::Configs parseKconfigs();
 	static bool constexpr betterConfig(Kconfig::ConfType oldType, Kconfig::ConfType newType);
-	static void insertConfig(const Kconfig::Parser &p, Kconfig::Config::Configs &configs);
+	static void insertConfig(Kconfig::Config::Configs &configs, std::string realConf,
+				 Kconfig::ConfType type);
 	void insertConfigsToSQL(const Kconfig::Config::Configs &configs);
 	static void addConfig(EnabledConfigMap &enabledConfigs, const std::string &key,
 			      SlKernCVS::ConfigValue newVal);
@@ -76,7 +90,10 @@ private:
 			  const EnabledConfigMap &enabledConfigs);
 
 	bool isValidUser(std::string_view email);
-	void processAuthors(const SlGit::Commit &commit);
+	std::shared_ptr<const BlobCache::Authors> collectAuthors(const SlGit::Commit &commit);
+	void storeAuthors(const BlobCache::Authors &authors);
+	template<typename F>
+	auto pushWithOwnRepo(const std::string &SHA, F &&task);
 	void processInternal(SlGit::Commit &commit);
 
 	const std::string &m_branch;
@@ -86,6 +103,9 @@ private:
 	BranchesProps &m_branchesProps;
 	const SlGit::Repo &m_repo;
 	F2CSQLConn &m_sql;
+	TW::ResultSink &m_sink;
+	ThreadPool &m_pool;
+	BlobCache &m_blobCache;
 	const Opts &m_opts;
 	const std::optional<Json> &m_configuration;
 	const SlKernCVS::LDAPUsers::UserSet &m_validUsers;
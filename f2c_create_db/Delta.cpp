@@ -0,0 +1,543 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <openssl/evp.h>
+#include <set>
+#include <sstream>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include <sl/helpers/Exception.h>
+#include <sl/helpers/PtrStore.h>
+#include <sl/sqlite/SQLConn.h>
+
+#include "AtomicFile.h"
+#include "Delta.h"
+#include "Merger.h"
+#include "SeekableZstd.h"
+
+using RunEx = SlHelpers::RuntimeException;
+using SlHelpers::raise;
+
+using namespace F2C;
+
+namespace {
+
+class SHA256 {
+public:
+	SHA256() {
+		m_ctx.reset(EVP_MD_CTX_new());
+		if (!m_ctx || !EVP_DigestInit_ex(m_ctx.get(), EVP_sha256(), nullptr))
+			RunEx("Cannot initialize SHA-256").raise();
+	}
+
+	void update(std::string_view data) {
+		if (!EVP_DigestUpdate(m_ctx.get(), data.data(), data.size()))
+			RunEx("Cannot compute SHA-256").raise();
+	}
+
+	std::string hex() {
+		unsigned char md[EVP_MAX_MD_SIZE];
+		unsigned len = 0;
+		if (!EVP_DigestFinal_ex(m_ctx.get(), md, &len))
+			RunEx("Cannot compute SHA-256").raise();
+
+		std::ostringstream ss;
+		ss << std::hex << std::setfill('0');
+		for (auto i = 0U; i < len; ++i)
+			ss << std::setw(2) << static_cast<unsigned>(md[i]);
+		return ss.str();
+	}
+private:
+	SlHelpers::PtrStore<EVP_MD_CTX, decltype([](EVP_MD_CTX *ctx) { EVP_MD_CTX_free(ctx); })> m_ctx;
+};
+
+std::string fileSHA256(const std::filesystem::path &file)
+{
+	std::ifstream ifs(file, std::ios::binary);
+	if (!ifs)
+		RunEx("Cannot open ") << file << raise;
+
+	SHA256 sha;
+	char buf[64 * 1024];
+	while (ifs.read(buf, sizeof(buf)) || ifs.gcount())
+		sha.update({ buf, static_cast<size_t>(ifs.gcount()) });
+
+	return sha.hex();
+}
+
+std::string sqlQuote(std::string_view str)
+{
+	std::string quoted { '\'' };
+	for (const auto c: str) {
+		if (c == '\'')
+			quoted += '\'';
+		quoted += c;
+	}
+	return quoted + '\'';
+}
+
+class DeltaConn : public SlSqlite::SQLConn {
+public:
+	/// @brief Branch name -> SHA-256 of its SHA and of its rows in the mapping views
+	using BranchStates = std::map<std::string, std::string>;
+
+	DeltaConn() {}
+
+	/// @brief The tables only deltas have, the rest is created by Delta::create()
+	virtual bool createDB() override {
+		static const Tables create_tables {
+			{ "delta_meta", {
+				"key TEXT PRIMARY KEY",
+				"value TEXT NOT NULL",
+			}},
+			{ "delta_removed_branch", {
+				"branch TEXT PRIMARY KEY",
+			}},
+		};
+
+		return createTables(create_tables);
+	}
+
+	virtual bool prepDB() override {
+		Statements stmts {
+			{ selBranches, "SELECT branch, sha, version FROM branch ORDER BY branch;" },
+			{ selRenames, "SELECT version, similarity, oldpath, newpath "
+				"FROM rename_file_version_map_view "
+				"ORDER BY version, oldpath, newpath;" },
+		};
+		for (auto i = 0U; i < branchViews.size(); ++i) {
+			const auto &[view, cols] = branchViews[i];
+			stmts.emplace_back(selBranchRows[i], std::string("SELECT ") + cols +
+					   " FROM " + view + " WHERE branch = :branch "
+					   "ORDER BY " + cols + ';');
+		}
+
+		return prepareStatements(stmts);
+	}
+
+	BranchStates branchStates();
+	std::string state(const BranchStates &branches);
+
+	void execOrThrow(const std::string &stmt) {
+		if (!exec(stmt))
+			RunEx("Cannot execute '") << stmt << "': " << lastError() << raise;
+	}
+private:
+	void hashRows(SHA256 &sha, std::string_view type, SlSqlite::SQLStmtHolder &stmt,
+		      const Binding &binding = {});
+	static void hashRow(SHA256 &sha, std::string_view type, const Row &row);
+
+	// the mapping views with the columns to hash, ids differ between dbs
+	static constexpr std::array<std::pair<const char *, const char *>, 7> branchViews {{
+		{ "conf_branch_map_view", "arch, flavor, config, value" },
+		{ "conf_file_map_view", "config, path" },
+		{ "file_support_map_view", "path, enabled, disabled_config, supported" },
+		{ "module_file_map_view", "module, path" },
+		{ "module_details_map_view", "module, supported" },
+		{ "user_file_map_view", "email, path, count, count_no_fixes" },
+		{ "ignored_file_branch_map_view", "path" },
+	}};
+
+	SlSqlite::SQLStmtHolder selBranches;
+	SlSqlite::SQLStmtHolder selRenames;
+	std::array<SlSqlite::SQLStmtHolder, branchViews.size()> selBranchRows;
+};
+
+/**
+ * @brief Hash each branch with all its rows
+ *
+ * Unlike the SHA, this catches rows which change for the same commit, e.g. when the user
+ * list, the ignores or the tool itself change.
+ */
+DeltaConn::BranchStates DeltaConn::branchStates()
+{
+	const auto branches = select(selBranches, {});
+	if (!branches)
+		RunEx("Cannot select branches: ") << lastError() << raise;
+
+	BranchStates states;
+	for (const auto &row: *branches) {
+		const auto &branch = std::get<std::string>(row[0]);
+		SHA256 sha;
+		hashRow(sha, "B", row);
+		for (auto i = 0U; i < branchViews.size(); ++i)
+			hashRows(sha, branchViews[i].first, selBranchRows[i],
+				 { { ":branch", branch } });
+		states.emplace(branch, sha.hex());
+	}
+
+	return states;
+}
+
+std::string DeltaConn::state(const BranchStates &branches)
+{
+	SHA256 sha;
+	for (const auto &[branch, state]: branches)
+		sha.update("B\t" + branch + '\t' + state + '\n');
+	hashRows(sha, "R", selRenames);
+	return sha.hex();
+}
+
+void DeltaConn::hashRows(SHA256 &sha, std::string_view type, SlSqlite::SQLStmtHolder &stmt,
+			 const Binding &binding)
+{
+	const auto res = select(stmt, binding);
+	if (!res)
+		RunEx("Cannot select: ") << lastError() << raise;
+
+	for (const auto &row: *res)
+		hashRow(sha, type, row);
+}
+
+/// @brief Hash a "type\tcol1\tcol2...\n" line, NULL is "\N"
+void DeltaConn::hashRow(SHA256 &sha, std::string_view type, const Row &row)
+{
+	std::string line { type };
+	for (const auto &col: row) {
+		line += '\t';
+		std::visit([&line](const auto &val) {
+			using T = std::decay_t<decltype(val)>;
+			if constexpr (std::is_same_v<T, std::string>)
+				line += val;
+			else if constexpr (std::is_arithmetic_v<T>)
+				line += std::to_string(val);
+			else
+				line += "\\N";
+		}, col);
+	}
+	sha.update(line + '\n');
+}
+
+struct State {
+	std::string state;
+	DeltaConn::BranchStates branches;
+};
+
+State readState(const std::filesystem::path &db)
+{
+	DeltaConn sql;
+	if (!sql.openDB(db, SlSqlite::OpenFlags::READ_ONLY) || !sql.prepDB())
+		RunEx("Cannot open ") << db << ": " << sql.lastError() << raise;
+
+	auto branches = sql.branchStates();
+	auto state = sql.state(branches);
+	return { .state = std::move(state), .branches = std::move(branches) };
+}
+
+struct Index {
+	struct Entry {
+		std::string from;
+		std::string to;
+		std::string sha;
+		std::string file;
+	};
+
+	std::string state;
+	std::vector<Entry> deltas;
+};
+
+Index readIndex(const std::filesystem::path &file)
+{
+	Index index;
+
+	std::ifstream ifs(file);
+	for (std::string line; std::getline(ifs, line); ) {
+		std::istringstream ss(line);
+		std::string type;
+		ss >> type;
+		if (type == "state") {
+			ss >> index.state;
+		} else if (type == "delta") {
+			Index::Entry e;
+			if (!(ss >> e.from >> e.to >> e.sha >> e.file))
+				RunEx("Malformed line in ") << file << ": " << line << raise;
+			index.deltas.push_back(std::move(e));
+		}
+	}
+
+	return index;
+}
+
+void writeIndex(const std::filesystem::path &file, const Index &index)
+{
+	AtomicFile::write(file, [&index](std::ostream &os) {
+		os << "state " << index.state << '\n';
+		for (const auto &e: index.deltas)
+			os << "delta " << e.from << ' ' << e.to << ' ' << e.sha << ' ' << e.file << '\n';
+	});
+}
+
+/// @brief Remove deltas no longer referenced by @p index
+void pruneDeltas(const std::filesystem::path &deltaDir, const Index &index)
+{
+	std::set<std::string> used;
+	for (const auto &e: index.deltas)
+		used.insert(e.file);
+
+	for (const auto &e: std::filesystem::directory_iterator(deltaDir))
+		if (e.path().extension() == ".sqlite" && !used.contains(e.path().filename()))
+			std::filesystem::remove(e.path());
+}
+
+/// @brief Branches added, removed, or with a different state
+std::set<std::string> changedBranches(const State &from, const State &to)
+{
+	std::set<std::string> changed;
+	for (const auto &[branch, state]: from.branches) {
+		const auto it = to.branches.find(branch);
+		if (it == to.branches.end() || it->second != state)
+			changed.insert(branch);
+	}
+	for (const auto &[branch, state]: to.branches)
+		if (!from.branches.contains(branch))
+			changed.insert(branch);
+
+	return changed;
+}
+
+void writeDelta(const std::filesystem::path &oldDB, const std::filesystem::path &newDB,
+		const std::filesystem::path &delta, const State &from, const State &to)
+{
+	// the rows of the changed branches and what they refer to, see Merger
+	static const std::vector<std::string> branchTables {
+		"conf_branch_column", "conf_branch_map", "conf_file_map", "file_support_map",
+		"module_file_map", "module_details_map", "user_file_map", "ignored_file_branch_map",
+	};
+	static const std::vector<std::string> stmts {
+		"INSERT INTO delta_removed_branch(branch) "
+			"SELECT branch FROM olddb.branch "
+			"WHERE branch IN (SELECT branch FROM temp.changed_branch);",
+		"CREATE TABLE branch AS SELECT * FROM newdb.branch "
+			"WHERE branch IN (SELECT branch FROM temp.changed_branch);",
+		"CREATE TABLE supported AS SELECT * FROM newdb.supported;",
+		"CREATE TABLE config_type AS SELECT * FROM newdb.config_type;",
+		// renames differ per version, as the previous version can change too
+		"CREATE TABLE delta_replaced_version AS "
+			"SELECT version FROM ("
+				"SELECT * FROM newdb.rename_file_version_map_view EXCEPT "
+				"SELECT * FROM olddb.rename_file_version_map_view) "
+			"UNION SELECT version FROM ("
+				"SELECT * FROM olddb.rename_file_version_map_view EXCEPT "
+				"SELECT * FROM newdb.rename_file_version_map_view);",
+		"CREATE TABLE rename_file_version_map AS "
+			"SELECT * FROM newdb.rename_file_version_map "
+			"WHERE version IN (SELECT version FROM main.delta_replaced_version);",
+		"CREATE TABLE module AS SELECT * FROM newdb.module WHERE id IN ("
+			"SELECT module FROM main.module_file_map UNION "
+			"SELECT module FROM main.module_details_map);",
+		"CREATE TABLE file AS SELECT * FROM newdb.file WHERE id IN ("
+			"SELECT file FROM main.conf_file_map UNION "
+			"SELECT file FROM main.file_support_map UNION "
+			"SELECT file FROM main.module_file_map UNION "
+			"SELECT file FROM main.user_file_map UNION "
+			"SELECT file FROM main.ignored_file_branch_map UNION "
+			"SELECT oldfile FROM main.rename_file_version_map UNION "
+			"SELECT newfile FROM main.rename_file_version_map);",
+		"CREATE TABLE dir AS SELECT * FROM newdb.dir WHERE id IN ("
+			"SELECT dir FROM main.file UNION SELECT dir FROM main.module);",
+		"CREATE TABLE config AS SELECT * FROM newdb.config WHERE id IN ("
+			"SELECT config FROM main.conf_branch_map UNION "
+			"SELECT config FROM main.conf_file_map UNION "
+			"SELECT disabled_config FROM main.file_support_map UNION "
+			"SELECT config FROM main.module);",
+		"CREATE TABLE arch AS SELECT * FROM newdb.arch WHERE id IN ("
+			"SELECT arch FROM main.conf_branch_column);",
+		"CREATE TABLE flavor AS SELECT * FROM newdb.flavor WHERE id IN ("
+			"SELECT flavor FROM main.conf_branch_column);",
+		"CREATE TABLE conf_branch_values AS SELECT * FROM newdb.conf_branch_values "
+			"WHERE id IN (SELECT vals FROM main.conf_branch_map);",
+		"CREATE TABLE user AS SELECT * FROM newdb.user WHERE id IN ("
+			"SELECT user FROM main.user_file_map);",
+	};
+
+	auto tmp = delta;
+	tmp += ".tmp";
+	std::filesystem::remove(tmp);
+
+	{
+		DeltaConn sql;
+		if (!sql.openDB(tmp, SlSqlite::OpenFlags::CREATE) || !sql.createDB())
+			RunEx("Cannot create the delta at ") << tmp << ": " << sql.lastError() <<
+								raise;
+
+		sql.execOrThrow("ATTACH DATABASE " + sqlQuote(oldDB.string()) + " AS olddb;");
+		sql.execOrThrow("ATTACH DATABASE " + sqlQuote(newDB.string()) + " AS newdb;");
+
+		sql.execOrThrow("BEGIN;");
+		sql.execOrThrow("INSERT INTO delta_meta(key, value) VALUES "
+				"('from', '" + from.state + "'), ('to', '" + to.state + "');");
+		sql.execOrThrow("CREATE TEMP TABLE changed_branch(branch TEXT PRIMARY KEY);");
+		for (const auto &branch: changedBranches(from, to))
+			sql.execOrThrow("INSERT INTO temp.changed_branch(branch) VALUES (" +
+					sqlQuote(branch) + ");");
+		sql.execOrThrow(stmts[0]);
+		sql.execOrThrow(stmts[1]);
+		for (const auto &table: branchTables)
+			sql.execOrThrow("CREATE TABLE " + table + " AS SELECT * FROM newdb." + table +
+					" WHERE branch IN (SELECT id FROM main.branch);");
+		for (auto i = 2U; i < stmts.size(); ++i)
+			sql.execOrThrow(stmts[i]);
+		sql.execOrThrow("COMMIT;");
+
+		sql.execOrThrow("DETACH DATABASE newdb;");
+		sql.execOrThrow("DETACH DATABASE olddb;");
+	}
+
+	std::filesystem::rename(tmp, delta);
+}
+
+} // namespace
+
+std::string Delta::state(const std::filesystem::path &db)
+{
+	return readState(db).state;
+}
+
+/**
+ * @brief Write a delta from @p oldDB to @p newDB into @p deltaDir and update its index
+ *
+ * The chain of deltas continues only if @p oldDB is the last state of the index. It is
+ * restarted otherwise and clients have to download the whole db.
+ */
+void Delta::create(const std::filesystem::path &oldDB, const std::filesystem::path &newDB,
+		   const std::filesystem::path &deltaDir)
+{
+	std::filesystem::create_directories(deltaDir);
+
+	auto index = readIndex(deltaDir / "index");
+	const auto from = readState(oldDB);
+	const auto to = readState(newDB);
+
+	if (index.state != from.state)
+		index.deltas.clear();
+	index.state = to.state;
+
+	if (from.state != to.state) {
+		Index::Entry e {
+			.from = from.state,
+			.to = to.state,
+			.sha = {},
+			.file = from.state.substr(0, 16) + '-' + to.state.substr(0, 16) + ".sqlite",
+		};
+		writeDelta(oldDB, newDB, deltaDir / e.file, from, to);
+		e.sha = fileSHA256(deltaDir / e.file);
+		index.deltas.push_back(std::move(e));
+	}
+
+	writeIndex(deltaDir / "index", index);
+	pruneDeltas(deltaDir, index);
+}
+
+/// @brief Start a new chain of deltas at @p newDB
+void Delta::reset(const std::filesystem::path &newDB, const std::filesystem::path &deltaDir)
+{
+	std::filesystem::create_directories(deltaDir);
+
+	const Index index { .state = state(newDB), .deltas = {} };
+	writeIndex(deltaDir / "index", index);
+	pruneDeltas(deltaDir, index);
+}
+
+/**
+ * @brief Bring @p db to the published state by applying deltas
+ *
+ * The deltas are applied to a copy of @p db, which replaces @p db only if all of them were
+ * verified and applied. A compressed @p db (see SeekableZstd) is decompressed for that and
+ * compressed again, its VFS has to be registered as the default one.
+ *
+ * @return false if there is no chain of deltas from @p db, or a delta is corrupted.
+ */
+bool Delta::update(const std::filesystem::path &db, const Fetch &fetch,
+		   const std::filesystem::path &workDir)
+{
+	std::filesystem::create_directories(workDir);
+
+	const auto indexFile = workDir / "index";
+	if (!fetch("deltas/index", indexFile))
+		return false;
+	const auto index = readIndex(indexFile);
+
+	std::vector<const Index::Entry *> chain;
+	for (auto cur = state(db); cur != index.state; ) {
+		auto it = std::find_if(index.deltas.begin(), index.deltas.end(),
+				       [&cur](const Index::Entry &e) { return e.from == cur; });
+		if (it == index.deltas.end() || chain.size() >= index.deltas.size())
+			return false;
+		chain.push_back(&*it);
+		cur = it->to;
+	}
+
+	if (chain.empty())
+		return true;
+
+	const auto compressed = SeekableZstd::isCompressed(db);
+	auto tmp = db;
+	tmp += ".tmp";
+	if (compressed)
+		SeekableZstd::decompress(db, tmp);
+	else
+		std::filesystem::copy_file(db, tmp,
+					   std::filesystem::copy_options::overwrite_existing);
+
+	try {
+		for (const auto e: chain) {
+			const auto file = workDir / e->file;
+			if (!fetch("deltas/" + e->file, file) || fileSHA256(file) != e->sha) {
+				std::filesystem::remove(tmp);
+				return false;
+			}
+
+			apply(tmp, file);
+			std::filesystem::remove(file);
+
+			if (state(tmp) != e->to) {
+				std::filesystem::remove(tmp);
+				return false;
+			}
+		}
+
+		if (compressed) {
+			auto zstTmp = db;
+			zstTmp += ".tmp.zst";
+			SeekableZstd::compress(tmp, zstTmp);
+			std::filesystem::remove(tmp);
+			tmp = zstTmp;
+		}
+	} catch (...) {
+		std::filesystem::remove(tmp);
+		throw;
+	}
+
+	std::filesystem::rename(tmp, db);
+
+	return true;
+}
+
+void Delta::apply(const std::filesystem::path &db, const std::filesystem::path &delta)
+{
+	DeltaConn sql;
+	if (!sql.openDB(db))
+		RunEx("Cannot open ") << db << ": " << sql.lastError() << raise;
+
+	// the removed branches cascade
+	sql.execOrThrow("PRAGMA foreign_keys = ON;");
+
+	Merger merger(sql);
+	merger.prepare();
+	merger.attach(delta);
+	merger.exec("BEGIN;");
+	merger.exec("DELETE FROM branch WHERE branch IN "
+		    "(SELECT branch FROM shard.delta_removed_branch);");
+	merger.exec("DELETE FROM rename_file_version_map WHERE version IN "
+		    "(SELECT version FROM shard.delta_replaced_version);");
+	merger.mergeAttached();
+	merger.exec("COMMIT;");
+	merger.detach();
+}
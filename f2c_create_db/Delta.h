@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string>
+
+namespace F2C {
+
+/**
+ * @brief Deltas between published dbs
+ *
+ * A delta contains all rows of the branches which were added or changed (by their state), the
+ * dictionary entries they refer to, and the renames of versions which changed. Branches and
+ * rename versions to be dropped before the rows are merged by Merger are listed in
+ * delta_removed_branch and delta_replaced_version.
+ *
+ * A state of a branch is a SHA-256 of its SHA and of its rows in the mapping views. A state of
+ * a db is a SHA-256 of the states of its branches and of its renames. The index file in the
+ * delta directory consists of:
+ *  - "state <state>" of the published db
+ *  - "delta <from state> <to state> <SHA-256 of the file> <file>" per delta, oldest first
+ */
+class Delta {
+public:
+	/// @brief Download @p file (relative to the published db) to @p dest
+	using Fetch = std::function<bool (const std::string &file, const std::filesystem::path &dest)>;
+
+	static std::string state(const std::filesystem::path &db);
+
+	static void create(const std::filesystem::path &oldDB, const std::filesystem::path &newDB,
+			   const std::filesystem::path &deltaDir);
+	static void reset(const std::filesystem::path &newDB, const std::filesystem::path &deltaDir);
+
+	static bool update(const std::filesystem::path &db, const Fetch &fetch,
+			   const std::filesystem::path &workDir);
+private:
+	static void apply(const std::filesystem::path &db, const std::filesystem::path &delta);
+};
+
+} // namespace
@@ -1,5 +1,7 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <vector>
+
 #include <sl/helpers/Exception.h>
 
 #include "F2CSQLConn.h"
@@ -39,15 +41,26 @@ bool F2CSQLConn::createDB()
 			"id INTEGER PRIMARY KEY",
 			"flavor TEXT NOT NULL UNIQUE"
 		}},
-		{ "conf_branch_map", {
-			"id INTEGER PRIMARY KEY",
+		// arch/flavor of each character of conf_branch_values.vals in a branch
+		{ "conf_branch_column", {
 			"branch INTEGER NOT NULL REFERENCES branch(id) ON DELETE CASCADE",
+			"col INTEGER NOT NULL CHECK(col >= 0)",
 			"arch INTEGER NOT NULL REFERENCES arch(id) ON DELETE CASCADE",
 			"flavor INTEGER NOT NULL REFERENCES flavor(id) ON DELETE CASCADE",
+			"PRIMARY KEY(branch, col)",
+			"UNIQUE(branch, arch, flavor)"
+		}},
+		// one of 'n', 'y', 'm', 'v' (with value) per column, '-' if not set at all
+		{ "conf_branch_values", {
+			"id INTEGER PRIMARY KEY",
+			"vals TEXT NOT NULL UNIQUE CHECK(vals NOT GLOB '*[^nymv-]*')",
+		}},
+		{ "conf_branch_map", {
+			"id INTEGER PRIMARY KEY",
+			"branch INTEGER NOT NULL REFERENCES branch(id) ON DELETE CASCADE",
 			"config INTEGER NOT NULL REFERENCES config(id) ON DELETE CASCADE",
-			"value TEXT NOT NULL CHECK(value IN ('n', 'y', 'm') OR "
-				"substr(value, 1, 1) = 'v')",
-			"UNIQUE(branch, config, arch, flavor)"
+			"vals INTEGER NOT NULL REFERENCES conf_branch_values(id)",
+			"UNIQUE(branch, config)"
 		}},
 		{ "dir", {
 			"id INTEGER PRIMARY KEY",
@@ -113,6 +126,10 @@ bool F2CSQLConn::createDB()
 			"file INTEGER NOT NULL REFERENCES file(id) ON DELETE CASCADE",
 			"PRIMARY KEY(branch, file)"
 		}},
+		// replaced branches, see deleteBranch() and purgeRetired()
+		{ "retired_branch", {
+			"id INTEGER PRIMARY KEY",
+		}},
 		{ "rename_file_version_map", {
 			"version INTEGER NOT NULL CHECK(version > 0)",
 			"similarity INTEGER NOT NULL CHECK(similarity BETWEEN 0 AND 100)",
@@ -126,7 +143,6 @@ bool F2CSQLConn::createDB()
 
 	static const Indices create_indexes {
 		{ "conf_branch_map_config_index", "conf_branch_map(config)" },
-		{ "conf_branch_map_branch_config_index", "conf_branch_map(branch, config)" },
 		{ "conf_file_map_file_index", "conf_file_map(file)" },
 		{ "conf_file_map_branch_file_index", "conf_file_map(branch, file)" },
 		{ "module_module_index", "module(module)" },
@@ -136,7 +152,10 @@ bool F2CSQLConn::createDB()
 		{ "user_file_map_file_index", "user_file_map(file)" },
 
 		// these are auto-created:
-		// conf_branch_map: (branch, config, arch, flavor)
+		// conf_branch_column: (branch, col)
+		// conf_branch_column: (branch, arch, flavor)
+		// conf_branch_values: (vals)
+		// conf_branch_map: (branch, config)
 		// conf_file_map: (branch, config, file)
 		// file_support_map: (branch, file)
 		// module: (dir, module)
@@ -154,18 +173,23 @@ bool F2CSQLConn::createDB()
 		{ "config_view", "SELECT config.id, config.config, config_type.type "
 			"FROM config "
 			"LEFT JOIN config_type ON config.type = config_type.id;" },
+		// expands conf_branch_map to one row per (branch, config, arch, flavor)
 		{ "conf_branch_map_view",
-			"SELECT map.id, branch.branch, arch.arch, flavor.flavor, config.config, "
-				"value "
+			"SELECT (map.id << 16) | col.col AS id, branch.branch, arch.arch, "
+				"flavor.flavor, config.config, "
+				"substr(vals.vals, col.col + 1, 1) AS value "
 			"FROM conf_branch_map AS map "
-			"LEFT JOIN branch ON map.branch = branch.id "
+			"JOIN conf_branch_values AS vals ON map.vals = vals.id "
+			"JOIN conf_branch_column AS col ON map.branch = col.branch "
+			"JOIN branch ON map.branch = branch.id "
 			"LEFT JOIN config ON map.config = config.id "
-			"LEFT JOIN arch ON map.arch = arch.id "
-			"LEFT JOIN flavor ON map.flavor = flavor.id;" },
+			"LEFT JOIN arch ON col.arch = arch.id "
+			"LEFT JOIN flavor ON col.flavor = flavor.id "
+			"WHERE value != '-';" },
 		{ "conf_file_map_view_raw_file",
 			"SELECT map.id, branch.branch, config.config, map.file "
 			"FROM conf_file_map AS map "
-			"LEFT JOIN branch ON map.branch = branch.id "
+			"JOIN branch ON map.branch = branch.id "
 			"LEFT JOIN config ON map.config = config.id;" },
 		{ "conf_file_map_view",
 			"SELECT map.id, map.branch, map.config, dir.dir || '/' || file.file AS path "
@@ -176,7 +200,7 @@ bool F2CSQLConn::createDB()
 			"dir.dir || '/' || file.file AS path, enabled, "
 				"config.config AS disabled_config, supported.supported "
 			"FROM file_support_map AS map "
-			"LEFT JOIN branch ON map.branch = branch.id "
+			"JOIN branch ON map.branch = branch.id "
 			"LEFT JOIN file ON map.file = file.id "
 			"LEFT JOIN dir ON file.dir = dir.id "
 			"LEFT JOIN config ON map.disabled_config = config.id "
@@ -192,7 +216,7 @@ bool F2CSQLConn::createDB()
 			"FROM module_details_map AS map "
 			"LEFT JOIN module ON map.module = module.id "
 			"LEFT JOIN dir AS module_dir ON module.dir = module_dir.id "
-			"LEFT JOIN branch ON map.branch = branch.id "
+			"JOIN branch ON map.branch = branch.id "
 			"LEFT JOIN supported ON map.supported = supported.id;" },
 		{ "module_file_map_view",
 			"SELECT branch.branch, "
@@ -201,7 +225,7 @@ bool F2CSQLConn::createDB()
 			"FROM module_file_map AS map "
 			"LEFT JOIN module ON map.module = module.id "
 			"LEFT JOIN dir AS module_dir ON module.dir = module_dir.id "
-			"LEFT JOIN branch ON map.branch = branch.id "
+			"JOIN branch ON map.branch = branch.id "
 			"LEFT JOIN file ON map.file = file.id "
 			"LEFT JOIN dir ON file.dir = dir.id;" },
 		{ "user_file_map_view",
@@ -210,7 +234,7 @@ bool F2CSQLConn::createDB()
 				"map.count, map.count_no_fixes "
 			"FROM user_file_map AS map "
 			"LEFT JOIN user ON map.user = user.id "
-			"LEFT JOIN branch ON map.branch = branch.id "
+			"JOIN branch ON map.branch = branch.id "
 			"LEFT JOIN file ON map.file = file.id "
 			"LEFT JOIN dir ON file.dir = dir.id;" },
 		{ "user_file_map_view_grouped",
@@ -220,7 +244,7 @@ bool F2CSQLConn::createDB()
 		{ "ignored_file_branch_map_view",
 			"SELECT branch.branch, dir.dir || '/' || file.file AS path "
 			"FROM ignored_file_branch_map AS map "
-			"LEFT JOIN branch ON map.branch = branch.id "
+			"JOIN branch ON map.branch = branch.id "
 			"LEFT JOIN file ON map.file = file.id "
 			"LEFT JOIN dir ON file.dir = dir.id;" },
 		{ "rename_file_version_map_view",
@@ -234,27 +258,136 @@ bool F2CSQLConn::createDB()
 			"LEFT JOIN dir AS newdir ON newfile.dir = newdir.id;" },
 	};
 
-	return createTables(create_tables) && createIndices(create_indexes) &&
-			createViews(create_views);
+	// views are only definitions, recreate them, so that existing DBs get the current ones
+	for (const auto &view: create_views)
+		if (!exec("DROP VIEW IF EXISTS " + view.first + ";"))
+			return false;
+
+	// DBs from before conf_branch_column have one conf_branch_map row per arch/flavor
+	const auto oldCBMap = hasOldConfBranchMap();
+	if (!oldCBMap)
+		return false;
+	if (*oldCBMap == OldCBMap::Present &&
+			!exec("ALTER TABLE conf_branch_map RENAME TO conf_branch_map_old;"))
+		return false;
+
+	if (!createTables(create_tables))
+		return false;
+
+	if (*oldCBMap != OldCBMap::None && !migrateConfBranchMap())
+		return false;
+
+	return createIndices(create_indexes) && createViews(create_views);
+}
+
+/**
+ * @brief Detect conf_branch_map with arch and flavor columns
+ *
+ * @return Renamed if conf_branch_map_old is left from an interrupted migrateConfBranchMap(),
+ * nullopt on errors.
+ */
+std::optional<F2CSQLConn::OldCBMap> F2CSQLConn::hasOldConfBranchMap()
+{
+	SlSqlite::SQLStmtHolder selOldCBMap;
+	if (!prepareStatements({
+			{ selOldCBMap, "SELECT name FROM sqlite_master WHERE type = 'table' AND ("
+				"name = 'conf_branch_map_old' OR "
+				"(name = 'conf_branch_map' AND sql LIKE '%flavor INTEGER%'));" },
+		}))
+		return std::nullopt;
+
+	const auto res = select(selOldCBMap, {});
+	if (!res)
+		return std::nullopt;
+	if (res->empty())
+		return OldCBMap::None;
+	if (std::get<std::string>(res->front().front()) == "conf_branch_map_old")
+		return OldCBMap::Renamed;
+
+	return OldCBMap::Present;
+}
+
+/**
+ * @brief Convert conf_branch_map_old rows to conf_branch_column/values/map
+ *
+ * The columns of a branch are its arch/flavor pairs in the order of their ids. The value
+ * strings are built by a recursive CTE, column by column. It runs in one transaction and drops
+ * conf_branch_map_old last, so an interrupted migration is simply redone.
+ */
+bool F2CSQLConn::migrateConfBranchMap()
+{
+	static const std::vector<std::string> stmts {
+		"DELETE FROM conf_branch_map;",
+		"DELETE FROM conf_branch_column;",
+		"INSERT INTO conf_branch_column(branch, col, arch, flavor) "
+			"SELECT branch, row_number() OVER ("
+				"PARTITION BY branch ORDER BY arch, flavor) - 1, arch, flavor "
+			"FROM (SELECT DISTINCT branch, arch, flavor FROM conf_branch_map_old);",
+		"CREATE TEMP TABLE conf_branch_cell AS "
+			"SELECT cfg.branch, cfg.config, col.col, "
+				"IFNULL(substr(old.value, 1, 1), '-') AS val "
+			"FROM (SELECT DISTINCT branch, config FROM conf_branch_map_old) AS cfg "
+			"JOIN conf_branch_column AS col ON col.branch = cfg.branch "
+			"LEFT JOIN conf_branch_map_old AS old ON old.branch = cfg.branch AND "
+				"old.config = cfg.config AND old.arch = col.arch AND "
+				"old.flavor = col.flavor;",
+		"CREATE INDEX temp.conf_branch_cell_index ON conf_branch_cell(branch, config, col);",
+		"CREATE TEMP TABLE conf_branch_vals AS "
+			"WITH RECURSIVE vals(branch, config, col, vals) AS ("
+				"SELECT branch, config, col, val FROM conf_branch_cell "
+					"WHERE col = 0 "
+				"UNION ALL "
+				"SELECT vals.branch, vals.config, cell.col, vals.vals || cell.val "
+					"FROM vals "
+					"JOIN conf_branch_cell AS cell ON "
+						"cell.branch = vals.branch AND "
+						"cell.config = vals.config AND "
+						"cell.col = vals.col + 1) "
+			"SELECT vals.branch, vals.config, vals.vals FROM vals "
+			"JOIN (SELECT branch, max(col) AS col FROM conf_branch_column "
+				"GROUP BY branch) AS last "
+				"ON last.branch = vals.branch AND last.col = vals.col;",
+		"INSERT OR IGNORE INTO conf_branch_values(vals) "
+			"SELECT vals FROM temp.conf_branch_vals;",
+		"INSERT INTO conf_branch_map(branch, config, vals) "
+			"SELECT cb.branch, cb.config, v.id FROM temp.conf_branch_vals AS cb "
+			"JOIN conf_branch_values AS v ON v.vals = cb.vals;",
+		"DROP TABLE temp.conf_branch_vals;",
+		"DROP TABLE temp.conf_branch_cell;",
+		"DROP TABLE conf_branch_map_old;",
+	};
+
+	// on errors, the transaction is rolled back when the connection is closed
+	if (!exec("BEGIN;"))
+		return false;
+
+	for (const auto &stmt: stmts)
+		if (!exec(stmt))
+			return false;
+
+	return exec("COMMIT;");
 }
 
 bool F2CSQLConn::prepDB()
 {
 	const Statements stmts {
 		{ insSupported,	"INSERT INTO supported(id, supported) VALUES (:id, :supported);" },
-		{ insBranch,	"INSERT INTO branch(branch, sha, version) VALUES "
-				"(:branch, :sha, :version);" },
 		{ insConfigType,"INSERT INTO config_type(id, type) VALUES (:id, :type);" },
 		{ insConfig,	"INSERT INTO config(config, type) VALUES (:config, :type);" },
 		{ insArch,	"INSERT INTO arch(arch) VALUES (:arch);" },
 		{ insFlavor,	"INSERT INTO flavor(flavor) VALUES (:flavor);" },
-		{ insCBMap,	"INSERT INTO conf_branch_map(branch, config, arch, flavor, value) "
+		{ insCBColumn,	"INSERT INTO conf_branch_column(branch, col, arch, flavor) "
 					"VALUES ("
 					"(SELECT id FROM branch WHERE branch = :branch), "
-					"(SELECT id FROM config WHERE config = :config), "
+					":col, "
 					"(SELECT id FROM arch WHERE arch = :arch), "
-					"(SELECT id FROM flavor WHERE flavor = :flavor), "
-					":value);" },
+					"(SELECT id FROM flavor WHERE flavor = :flavor));" },
+		{ insCBValues,	"INSERT INTO conf_branch_values(vals) VALUES (:vals);" },
+		{ insCBMap,	"INSERT INTO conf_branch_map(branch, config, vals) "
+					"VALUES ("
+					"(SELECT id FROM branch WHERE branch = :branch), "
+					"(SELECT id FROM config WHERE config = :config), "
+					"(SELECT id FROM conf_branch_values WHERE vals = :vals));" },
 		{ insDir,	"INSERT INTO dir(dir) VALUES (:dir);" },
 		{ insFile,	"INSERT INTO file(file, dir) VALUES ("
 					":file, "
@@ -311,7 +444,37 @@ bool F2CSQLConn::prepDB()
 		{ selBranch,	"SELECT 1 FROM branch WHERE branch = :branch;" },
 	};
 
-	return prepareStatements(stmts);
+	const Statements branchStmts {
+		{ insBranch,	"INSERT INTO branch(branch, sha, version) VALUES "
+				"(:branch, :sha, :version);" },
+	};
+
+	// ids of retired branches must not be reused until their rows are purged
+	const Statements branchStmtsRetired {
+		{ insBranch,	"INSERT INTO branch(id, branch, sha, version) VALUES ("
+					"(SELECT IFNULL(max(id), 0) + 1 FROM "
+						"(SELECT id FROM branch UNION ALL "
+						"SELECT id FROM retired_branch)), "
+					":branch, :sha, :version);" },
+		{ insRetired,	"INSERT OR IGNORE INTO retired_branch(id) "
+					"SELECT id FROM branch WHERE branch = :branch;" },
+		{ selRetiredIds,"SELECT id FROM retired_branch;" },
+	};
+
+	if (!prepareStatements({
+			{ selRetired, "SELECT 1 FROM sqlite_master "
+				"WHERE type = 'table' AND name = 'retired_branch';" },
+		}))
+		return false;
+
+	// DBs created before retired_branch existed delete branches by cascades
+	const auto resRetired = select(selRetired, {});
+	if (!resRetired)
+		return false;
+	retiring = resRetired->size();
+
+	return prepareStatements(stmts) &&
+			prepareStatements(retiring ? branchStmtsRetired : branchStmts);
 }
 
 bool F2CSQLConn::insertSupported(int id, const std::string &supported)
@@ -357,19 +520,28 @@ bool F2CSQLConn::insertFlavor(const std::string &flavor)
 	return insert(insFlavor, { { ":flavor", flavor } });
 }
 
-bool F2CSQLConn::insertCBMap(const std::string &branch, const std::string &arch,
-			     const std::string &flavor, const std::string &config,
-			     const std::string &value)
+bool F2CSQLConn::insertCBColumn(const std::string &branch, unsigned col,
+				const std::string &arch, const std::string &flavor)
 {
-	return insert(insCBMap, {
+	return insert(insCBColumn, {
 			      { ":branch", branch },
+			      { ":col", col },
 			      { ":arch", arch },
 			      { ":flavor", flavor },
-			      { ":config", config },
-			      { ":value", value },
 		      });
 }
 
+bool F2CSQLConn::insertCBMap(const std::string &branch, const std::string &config,
+			     const std::string &vals)
+{
+	return insert(insCBValues, { { ":vals", vals } }) &&
+		insert(insCBMap, {
+			       { ":branch", branch },
+			       { ":config", config },
+			       { ":vals", vals },
+		       });
+}
+
 bool F2CSQLConn::insertDir(const std::string &dir)
 {
 	return insert(insDir, { { ":dir", dir } });
@@ -500,11 +672,102 @@ bool F2CSQLConn::insertRFVMap(unsigned version, unsigned similarity,
 		      });
 }
 
+/**
+ * @brief Delete @p branch, so that it can be inserted again
+ *
+ * Cascading the delete to all the mapping tables costs more than inserting the branch. So
+ * only the branch row is deleted and its id is retired. The rows pointing to it are invisible:
+ * the views inner-join the branch table and other queries start from it. They are dropped
+ * later by purgeRetired().
+ *
+ * This relies on foreign keys being off, see foreignKeys(). They cannot be switched here, as
+ * PRAGMA foreign_keys is a no-op inside the transaction of the branch, so callers switch
+ * them around it if retiresBranches(). With foreign keys on, the delete would cascade and the
+ * retired id would be kept for nothing.
+ */
 bool F2CSQLConn::deleteBranch(const std::string &branch)
 {
+	if (retiring && !insert(insRetired, { { ":branch", branch } }))
+		return false;
+
 	return insert(delBranch, { { ":branch", branch } });
 }
 
+/**
+ * @brief Drop rows of all branches retired by deleteBranch()
+ *
+ * This does not make the deletes cheaper than the cascades would have been, it only defers
+ * them. They are moved out of the transactions of the branches, where they would delay the
+ * commit visible to readers, and done in one pass over each mapping table (using the indexes
+ * on the branch column) for all the replaced branches.
+ */
+bool F2CSQLConn::purgeRetired()
+{
+	if (!retiring)
+		return true;
+
+	static const std::vector<std::string> branchTables {
+		"conf_branch_column", "conf_branch_map", "module_details_map", "user_file_map",
+		"ignored_file_branch_map", "conf_file_map", "file_support_map", "module_file_map",
+	};
+
+	// deleteBranch() might have failed after retiring the id
+	if (!exec("DELETE FROM retired_branch WHERE id IN (SELECT id FROM branch);"))
+		return false;
+
+	const auto retired = select(selRetiredIds, {});
+	if (!retired)
+		return false;
+	if (retired->empty())
+		return true;
+
+	for (const auto &table: branchTables)
+		if (!exec("DELETE FROM " + table + " WHERE branch IN "
+			  "(SELECT id FROM retired_branch);"))
+			return false;
+
+	// gives the pages back to the filesystem if auto_vacuum = INCREMENTAL, no-op otherwise
+	return exec("DELETE FROM retired_branch;") && exec("PRAGMA incremental_vacuum;");
+}
+
+/**
+ * @brief Switch the opened DB to the WAL mode (after prepDB())
+ *
+ * Readers then keep their snapshot while branches are written in their long transactions.
+ * The WAL is truncated to @p sizeLimit bytes once checkpointed.
+ */
+bool F2CSQLConn::enableWAL(unsigned long sizeLimit)
+{
+	if (!exec("PRAGMA journal_mode = WAL;") ||
+			!exec("PRAGMA journal_size_limit = " + std::to_string(sizeLimit) + ";"))
+		return false;
+
+	wal = true;
+
+	return true;
+}
+
+/**
+ * @brief Switch foreign key enforcement @p on or off
+ *
+ * It has to be called outside of transactions, it has no effect inside them. Keep them off
+ * only for the transaction replacing a branch, so that deleteBranch() does not cascade.
+ */
+bool F2CSQLConn::foreignKeys(bool on)
+{
+	return exec(on ? "PRAGMA foreign_keys = ON;" : "PRAGMA foreign_keys = OFF;");
+}
+
+/**
+ * @brief Move the committed WAL content to the DB and truncate the WAL
+ *
+ * Readers still using older snapshots make it a partial checkpoint, a later one catches up.
+ */
+bool F2CSQLConn::checkpoint()
+{
+	return !wal || exec("PRAGMA wal_checkpoint(TRUNCATE);");
+}
+
 bool F2CSQLConn::hasBranch(const std::string &branch)
 {
 	const auto res = select(selBranch, { { ":branch", branch } });
@@ -513,3 +776,64 @@ bool F2CSQLConn::hasBranch(const std::string &branch)
 
 	return res->size() && std::get<int>((*res)[0][0]) == 1;
 }
+
+/**
+ * @brief Record the version string of @p branch in a shard
+ *
+ * The branch table has only the version number, but Renames needs the string to name the
+ * tags. The table exists only in shards, the Merger does not copy it.
+ */
+bool F2CSQLConn::insertShardVersion(const std::string &branch, const std::string &version)
+{
+	static const Tables create_tables {
+		{ "shard_version", {
+			"branch TEXT PRIMARY KEY",
+			"version TEXT NOT NULL",
+		}},
+	};
+
+	SlSqlite::SQLStmtHolder insShardVersion;
+	if (!createTables(create_tables) || !prepareStatements({
+			{ insShardVersion, "INSERT OR REPLACE INTO shard_version(branch, version) "
+				"VALUES (:branch, :version);" },
+		}))
+		return false;
+
+	return insert(insShardVersion, { { ":branch", branch }, { ":version", version } });
+}
+
+/**
+ * @brief Branches and version strings stored by insertShardVersion()
+ *
+ * Empty for shards created before shard_version existed, nullopt on errors.
+ */
+std::optional<std::vector<std::pair<std::string, std::string>>> F2CSQLConn::shardVersions()
+{
+	SlSqlite::SQLStmtHolder selTable, selShardVersions;
+	if (!prepareStatements({
+			{ selTable, "SELECT 1 FROM sqlite_master "
+				"WHERE type = 'table' AND name = 'shard_version';" },
+		}))
+		return std::nullopt;
+
+	const auto table = select(selTable, {});
+	if (!table)
+		return std::nullopt;
+	if (table->empty())
+		return std::vector<std::pair<std::string, std::string>>{};
+
+	if (!prepareStatements({
+			{ selShardVersions, "SELECT branch, version FROM shard_version;" },
+		}))
+		return std::nullopt;
+
+	const auto res = select(selShardVersions, {});
+	if (!res)
+		return std::nullopt;
+
+	std::vector<std::pair<std::string, std::string>> ret;
+	for (const auto &row: *res)
+		ret.emplace_back(std::get<std::string>(row[0]), std::get<std::string>(row[1]));
+
+	return ret;
+}
@@ -3,6 +3,9 @@
 #pragma once
 
 #include <optional>
+#include <string>
+#include <utility>
+#include <vector>
 #include <sl/sqlite/SQLConn.h>
 #include <sl/sqlite/SQLiteSmart.h>
 
@@ -16,6 +19,11 @@ public:
 	F2CSQLConn(F2CSQLConn &&) = default;
 	F2CSQLConn &operator=(F2CSQLConn &&) = default;
 
+	/// @brief Whether enableWAL() was called
+	bool inWAL() const { return wal; }
+	/// @brief Whether deleteBranch() retires the branch id (needs foreign keys off)
+	bool retiresBranches() const { return retiring; }
+
 	virtual bool createDB() override;
 	virtual bool prepDB() override;
 
@@ -25,8 +33,10 @@ public:
 	bool insertConfig(const std::string &config, unsigned type);
 	bool insertArch(const std::string &arch);
 	bool insertFlavor(const std::string &flavor);
-	bool insertCBMap(const std::string &branch, const std::string &arch,
-			 const std::string &flavor, const std::string &config, const std::string &value);
+	bool insertCBColumn(const std::string &branch, unsigned col, const std::string &arch,
+			    const std::string &flavor);
+	bool insertCBMap(const std::string &branch, const std::string &config,
+			 const std::string &vals);
 	bool insertDir(const std::string &dir);
 	bool insertFile(const std::string &dir, const std::string &file);
 	std::optional<std::pair<std::string, std::string>>
@@ -52,8 +62,23 @@ public:
 			  const std::string &olddir, const std::string &oldfile,
 			  const std::string &newdir, const std::string &newfile);
 	bool deleteBranch(const std::string &branch);
+	bool purgeRetired();
+	bool enableWAL(unsigned long sizeLimit);
+	bool foreignKeys(bool on);
+	bool checkpoint();
 	bool hasBranch(const std::string &branch);
+	bool insertShardVersion(const std::string &branch, const std::string &version);
+	std::optional<std::vector<std::pair<std::string, std::string>>> shardVersions();
 private:
+	enum class OldCBMap {
+		None,
+		Present,
+		Renamed,
+	};
+
+	std::optional<OldCBMap> hasOldConfBranchMap();
+	bool migrateConfBranchMap();
+
 	template<typename T>
 	static BindVal valOrMonostate(const std::optional<T> &opt) {
 		if (opt)
@@ -68,6 +93,8 @@ private:
 	SlSqlite::SQLStmtHolder insConfig;
 	SlSqlite::SQLStmtHolder insArch;
 	SlSqlite::SQLStmtHolder insFlavor;
+	SlSqlite::SQLStmtHolder insCBColumn;
+	SlSqlite::SQLStmtHolder insCBValues;
 	SlSqlite::SQLStmtHolder insCBMap;
 	SlSqlite::SQLStmtHolder insDir;
 	SlSqlite::SQLStmtHolder insFile;
@@ -82,6 +109,12 @@ private:
 	SlSqlite::SQLStmtHolder insRFVMap;
 	SlSqlite::SQLStmtHolder delBranch;
 	SlSqlite::SQLStmtHolder selBranch;
+	SlSqlite::SQLStmtHolder insRetired;
+	SlSqlite::SQLStmtHolder selRetired;
+	SlSqlite::SQLStmtHolder selRetiredIds;
+
+	bool retiring = false;
+	bool wal = false;
 };
 
 }
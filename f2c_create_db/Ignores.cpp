@@ -1,5 +1,6 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <algorithm>
 #include <fnmatch.h>
 #include <nlohmann/json.hpp>
 
@@ -12,23 +13,119 @@ using SlHelpers::raise;
 
 using namespace F2C;
 
-void Ignores::processOne(F2CSQLConn &sql, const std::string &branch,
-			 const std::vector<Json> &patterns, const std::filesystem::path &relPath)
+/**
+ * @brief Add @p pattern to @p trie
+ *
+ * Patterns are matched against relative paths with FNM_PATHNAME, so no wildcard matches a
+ * slash and each segment can be matched separately. Patterns with empty, "." or ".."
+ * segments can never match and are skipped.
+ */
+void Ignores::addPattern(Node &trie, std::string_view pattern)
 {
-	for (const auto &pattern: patterns)
-		if (!fnmatch(pattern.get_ref<const Json::string_t &>().c_str(),
-			     relPath.c_str(), FNM_PATHNAME)) {
-			const auto dirFile = sql.insertPath(relPath);
-			if (!dirFile || !sql.insertIFBMap(branch, dirFile->first, dirFile->second))
-				RunEx("Cannot insert ignore: ") << sql.lastError() << raise;
+	std::vector<std::string_view> segments;
+	for (;;) {
+		const auto slash = pattern.find('/');
+		const auto segment = pattern.substr(0, slash);
+		if (segment.empty() || segment == "." || segment == "..")
+			return;
+		segments.push_back(segment);
+		if (slash == pattern.npos)
+			break;
+		pattern.remove_prefix(slash + 1);
+	}
+
+	auto node = &trie;
+	for (const auto &segment: segments) {
+		if (segment.find_first_of("*?[\\") == segment.npos) {
+			node = &node->literals.try_emplace(std::string(segment)).first->second;
+			continue;
 		}
+
+		auto it = std::find_if(node->globs.begin(), node->globs.end(),
+				       [&segment](const auto &glob) {
+			return glob.first == segment;
+		});
+		if (it == node->globs.end())
+			it = node->globs.emplace(node->globs.end(), std::string(segment), Node());
+		node = &it->second;
+	}
+	node->terminal = true;
 }
 
-void Ignores::process(F2CSQLConn &sql, const std::string &branch, const Json &json,
-		      const std::filesystem::path &root)
+/**
+ * @brief Match entries of @p relDir against children of @p nodes
+ *
+ * If there are only literal children, the directory is not listed at all.
+ */
+void Ignores::walk(const std::filesystem::path &root, const std::filesystem::path &relDir,
+		   const Nodes &nodes, Paths &paths)
 {
-	if (!json.contains("ignored_files"))
+	const auto hasGlobs = std::any_of(nodes.begin(), nodes.end(), [](const Node *node) {
+		return !node->globs.empty();
+	});
+
+	if (!hasGlobs) {
+		std::map<std::string_view, Nodes> children;
+		for (const auto node: nodes)
+			for (const auto &[name, child]: node->literals)
+				children[name].push_back(&child);
+		for (const auto &[name, next]: children)
+			visit(root, relDir / name, next, paths);
+		return;
+	}
+
+	for (const auto &e: std::filesystem::directory_iterator(root / relDir)) {
+		const auto name = e.path().filename().string();
+		Nodes next;
+		for (const auto node: nodes) {
+			if (auto it = node->literals.find(name); it != node->literals.end())
+				next.push_back(&it->second);
+			for (const auto &[glob, child]: node->globs)
+				if (!fnmatch(glob.c_str(), name.c_str(), FNM_PATHNAME))
+					next.push_back(&child);
+		}
+		if (!next.empty())
+			visit(root, relDir / name, next, paths);
+	}
+}
+
+/// @brief Store @p relPath if it is a matched file, or descend if it is a directory
+void Ignores::visit(const std::filesystem::path &root, const std::filesystem::path &relPath,
+		    const Nodes &nodes, Paths &paths)
+{
+	const auto path = root / relPath;
+	std::error_code ec;
+	const auto status = std::filesystem::symlink_status(path, ec);
+	if (ec)
+		return;
+
+	// like recursive_directory_iterator: files are followed, directories are not
+	if (std::filesystem::is_directory(status)) {
+		walk(root, relPath, nodes, paths);
 		return;
+	}
+
+	const auto terminal = std::any_of(nodes.begin(), nodes.end(), [](const Node *node) {
+		return node->terminal;
+	});
+	if (terminal && std::filesystem::is_regular_file(path, ec))
+		paths.push_back(relPath);
+}
+
+/**
+ * @brief Find files in @p root matching the ignore patterns for @p branch in @p json
+ *
+ * The patterns are compiled into a trie first, so that only directories which can contain a
+ * match are walked. It does not touch the database, so it can run in parallel to other
+ * stages.
+ */
+Ignores::Paths Ignores::collect(const std::string &branch, const Json &json,
+				const std::filesystem::path &root)
+{
+	Paths paths;
+
+	if (!json.contains("ignored_files"))
+		return paths;
 	const auto ignoredFiles = json["ignored_files"];
 	const auto allIt = ignoredFiles.find("all");
 	const auto all = (allIt != ignoredFiles.end()) ?
@@ -38,15 +135,22 @@ void Ignores::process(F2CSQLConn &sql, const std::string &branch, const Json &js
 	const auto forBranch = (forBranchIt != ignoredFiles.end()) ?
 				&forBranchIt->get_ref<const Json::array_t &>() : nullptr;
 
-	for (const auto &e: std::filesystem::recursive_directory_iterator(root)) {
-		if (!e.is_regular_file())
-			continue;
+	Node trie;
+	for (const auto patterns: { all, forBranch })
+		if (patterns)
+			for (const auto &pattern: *patterns)
+				addPattern(trie, pattern.get_ref<const Json::string_t &>());
 
-		const auto relPath = e.path().lexically_relative(root);
+	walk(root, {}, { &trie }, paths);
 
-		if (all)
-			processOne(sql, branch, *all, relPath);
-		if (forBranch)
-			processOne(sql, branch, *forBranch, relPath);
+	return paths;
+}
+
+void Ignores::store(F2CSQLConn &sql, const std::string &branch, const Paths &paths)
+{
+	for (const auto &relPath: paths) {
+		const auto dirFile = sql.insertPath(relPath);
+		if (!dirFile || !sql.insertIFBMap(branch, dirFile->first, dirFile->second))
+			RunEx("Cannot insert ignore: ") << sql.lastError() << raise;
 	}
 }
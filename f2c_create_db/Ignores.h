@@ -1,7 +1,10 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
 #include <filesystem>
+#include <map>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 #include <nlohmann/json_fwd.hpp>
@@ -16,12 +19,29 @@ private:
 public:
 	Ignores() = delete;
 
-	static void process(F2CSQLConn &sql, const std::string &branch, const Json &json,
-			    const std::filesystem::path &root);
+	using Paths = std::vector<std::filesystem::path>;
+
+	static Paths collect(const std::string &branch, const Json &json,
+			     const std::filesystem::path &root);
+	static void store(F2CSQLConn &sql, const std::string &branch, const Paths &paths);
 private:
-	static void processOne(F2CSQLConn &sql, const std::string &branch,
-			       const std::vector<Json> &patterns,
-			       const std::filesystem::path &relPath);
+	/**
+	 * @brief Trie of pattern segments, i.e. the parts between slashes
+	 *
+	 * Literal segments are looked up directly, only the others need fnmatch().
+	 */
+	struct Node {
+		std::map<std::string, Node, std::less<>> literals;
+		std::vector<std::pair<std::string, Node>> globs;
+		bool terminal = false;
+	};
+	using Nodes = std::vector<const Node *>;
+
+	static void addPattern(Node &trie, std::string_view pattern);
+	static void walk(const std::filesystem::path &root, const std::filesystem::path &relDir,
+			 const Nodes &nodes, Paths &paths);
+	static void visit(const std::filesystem::path &root, const std::filesystem::path &relPath,
+			  const Nodes &nodes, Paths &paths);
 };
 
 } // namespace
@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <string>
+#include <vector>
+
+#include <sl/helpers/Exception.h>
+
+#include "Merger.h"
+
+using RunEx = SlHelpers::RuntimeException;
+using SlHelpers::raise;
+
+using namespace F2C;
+
+namespace {
+
+/// @brief Tables mapping ids of a shard (old) to the ids in the output (new)
+const std::vector<std::string> idMaps {
+	"branch", "config", "arch", "flavor", "conf_branch_values", "dir", "file", "module", "user",
+};
+
+} // namespace
+
+void Merger::prepare()
+{
+	for (const auto &map: idMaps)
+		exec("CREATE TEMP TABLE map_" + map + "(old INTEGER PRIMARY KEY, "
+		     "new INTEGER NOT NULL);");
+}
+
+/// @brief Merge the shard attached by attach(), the caller handles the transaction
+void Merger::mergeAttached()
+{
+	static const std::vector<std::string> stmts {
+		// ids of these are fixed
+		"INSERT OR IGNORE INTO supported(id, supported) "
+			"SELECT id, supported FROM shard.supported;",
+		"INSERT OR IGNORE INTO config_type(id, type) "
+			"SELECT id, type FROM shard.config_type;",
+
+		// a branch must come from one shard only
+		"INSERT INTO branch(branch, sha, version) "
+			"SELECT branch, sha, version FROM shard.branch;",
+		"INSERT INTO map_branch SELECT s.id, m.id FROM shard.branch AS s "
+			"JOIN main.branch AS m ON m.branch = s.branch;",
+
+		"INSERT OR IGNORE INTO config(config, type) SELECT config, type FROM shard.config;",
+		"INSERT INTO map_config SELECT s.id, m.id FROM shard.config AS s "
+			"JOIN main.config AS m ON m.config = s.config;",
+		"INSERT OR IGNORE INTO arch(arch) SELECT arch FROM shard.arch;",
+		"INSERT INTO map_arch SELECT s.id, m.id FROM shard.arch AS s "
+			"JOIN main.arch AS m ON m.arch = s.arch;",
+		"INSERT OR IGNORE INTO flavor(flavor) SELECT flavor FROM shard.flavor;",
+		"INSERT INTO map_flavor SELECT s.id, m.id FROM shard.flavor AS s "
+			"JOIN main.flavor AS m ON m.flavor = s.flavor;",
+		"INSERT OR IGNORE INTO conf_branch_values(vals) "
+			"SELECT vals FROM shard.conf_branch_values;",
+		"INSERT INTO map_conf_branch_values SELECT s.id, m.id "
+			"FROM shard.conf_branch_values AS s "
+			"JOIN main.conf_branch_values AS m ON m.vals = s.vals;",
+		"INSERT OR IGNORE INTO dir(dir) SELECT dir FROM shard.dir;",
+		"INSERT INTO map_dir SELECT s.id, m.id FROM shard.dir AS s "
+			"JOIN main.dir AS m ON m.dir = s.dir;",
+		"INSERT OR IGNORE INTO file(file, dir) SELECT s.file, d.new FROM shard.file AS s "
+			"JOIN map_dir AS d ON s.dir = d.old;",
+		"INSERT INTO map_file SELECT s.id, m.id FROM shard.file AS s "
+			"JOIN map_dir AS d ON s.dir = d.old "
+			"JOIN main.file AS m ON m.file = s.file AND m.dir = d.new;",
+		"INSERT OR IGNORE INTO module(dir, module, config) "
+			"SELECT d.new, s.module, c.new FROM shard.module AS s "
+			"JOIN map_dir AS d ON s.dir = d.old "
+			"JOIN map_config AS c ON s.config = c.old;",
+		"INSERT INTO map_module SELECT s.id, m.id FROM shard.module AS s "
+			"JOIN map_dir AS d ON s.dir = d.old "
+			"JOIN main.module AS m ON m.dir = d.new AND m.module = s.module;",
+		"INSERT OR IGNORE INTO user(email) SELECT email FROM shard.user;",
+		"INSERT INTO map_user SELECT s.id, m.id FROM shard.user AS s "
+			"JOIN main.user AS m ON m.email = s.email;",
+
+		"INSERT INTO conf_branch_column(branch, col, arch, flavor) "
+			"SELECT b.new, s.col, a.new, f.new FROM shard.conf_branch_column AS s "
+			"JOIN map_branch AS b ON s.branch = b.old "
+			"JOIN map_arch AS a ON s.arch = a.old "
+			"JOIN map_flavor AS f ON s.flavor = f.old;",
+		"INSERT INTO conf_branch_map(branch, config, vals) "
+			"SELECT b.new, c.new, v.new FROM shard.conf_branch_map AS s "
+			"JOIN map_branch AS b ON s.branch = b.old "
+			"JOIN map_config AS c ON s.config = c.old "
+			"JOIN map_conf_branch_values AS v ON s.vals = v.old;",
+		"INSERT INTO conf_file_map(branch, config, file) "
+			"SELECT b.new, c.new, f.new FROM shard.conf_file_map AS s "
+			"JOIN map_branch AS b ON s.branch = b.old "
+			"JOIN map_config AS c ON s.config = c.old "
+			"JOIN map_file AS f ON s.file = f.old;",
+		"INSERT INTO file_support_map(branch, file, enabled, disabled_config, supported) "
+			"SELECT b.new, f.new, s.enabled, c.new, s.supported "
+			"FROM shard.file_support_map AS s "
+			"JOIN map_branch AS b ON s.branch = b.old "
+			"JOIN map_file AS f ON s.file = f.old "
+			"LEFT JOIN map_config AS c ON s.disabled_config = c.old;",
+		"INSERT INTO module_file_map(branch, module, file) "
+			"SELECT b.new, m.new, f.new FROM shard.module_file_map AS s "
+			"JOIN map_branch AS b ON s.branch = b.old "
+			"JOIN map_module AS m ON s.module = m.old "
+			"JOIN map_file AS f ON s.file = f.old;",
+		"INSERT INTO module_details_map(branch, module, supported) "
+			"SELECT b.new, m.new, s.supported FROM shard.module_details_map AS s "
+			"JOIN map_branch AS b ON s.branch = b.old "
+			"JOIN map_module AS m ON s.module = m.old;",
+		"INSERT INTO user_file_map(branch, user, file, count, count_no_fixes) "
+			"SELECT b.new, u.new, f.new, s.count, s.count_no_fixes "
+			"FROM shard.user_file_map AS s "
+			"JOIN map_branch AS b ON s.branch = b.old "
+			"JOIN map_user AS u ON s.user = u.old "
+			"JOIN map_file AS f ON s.file = f.old;",
+		"INSERT INTO ignored_file_branch_map(branch, file) "
+			"SELECT b.new, f.new FROM shard.ignored_file_branch_map AS s "
+			"JOIN map_branch AS b ON s.branch = b.old "
+			"JOIN map_file AS f ON s.file = f.old;",
+		"INSERT OR IGNORE INTO rename_file_version_map(version, similarity, oldfile, newfile) "
+			"SELECT s.version, s.similarity, o.new, n.new "
+			"FROM shard.rename_file_version_map AS s "
+			"JOIN map_file AS o ON s.oldfile = o.old "
+			"JOIN map_file AS n ON s.newfile = n.old;",
+	};
+
+	for (const auto &map: idMaps)
+		exec("DELETE FROM map_" + map + ";");
+	for (const auto &stmt: stmts)
+		exec(stmt);
+}
+
+void Merger::merge(const std::filesystem::path &shard)
+{
+	attach(shard);
+	exec("BEGIN;");
+	mergeAttached();
+	exec("COMMIT;");
+	detach();
+}
+
+/// @brief Attach @p shard as the "shard" schema
+void Merger::attach(const std::filesystem::path &shard)
+{
+	std::string quoted;
+	for (const auto c: shard.string()) {
+		if (c == '\'')
+			quoted += '\'';
+		quoted += c;
+	}
+	exec("ATTACH DATABASE '" + quoted + "' AS shard;");
+}
+
+void Merger::detach()
+{
+	exec("DETACH DATABASE shard;");
+}
+
+void Merger::exec(const std::string &stmt)
+{
+	if (!m_sql.exec(stmt))
+		RunEx("Cannot execute '") << stmt << "': " << m_sql.lastError() << raise;
+}
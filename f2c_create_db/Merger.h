@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+#include <sl/sqlite/SQLConn.h>
+
+namespace F2C {
+
+/**
+ * @brief Merges shards into one db
+ *
+ * Every shard has its own ids. The dictionary tables (dir, file, config, module, ...) are
+ * interned into the output by their UNIQUE keys first. Temporary tables then map the ids of
+ * the shard to the ids of the output, so that the mapping tables can be appended by plain
+ * integer joins.
+ *
+ * A shard is anything having the tables of F2CSQLConn::createDB() with their columns, e.g. the
+ * deltas of Delta.
+ */
+class Merger {
+public:
+	Merger(SlSqlite::SQLConn &sql) : m_sql(sql) {}
+
+	void prepare();
+	void merge(const std::filesystem::path &shard);
+
+	void attach(const std::filesystem::path &shard);
+	void mergeAttached();
+	void detach();
+
+	void exec(const std::string &stmt);
+private:
+	SlSqlite::SQLConn &m_sql;
+};
+
+} // namespace
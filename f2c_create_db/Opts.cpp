@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
 #include <cxxopts.hpp>
+#include <unistd.h>
 
 #include <sl/helpers/Color.h>
 
@@ -22,11 +23,22 @@ Opts Opts::getOpts(int argc, char **argv)
 			cxxopts::value(opts.dest)->default_value("$SCRATCH_AREA/fill-db"))
 		("f,force", "force branch creation (delete old data)",
 			cxxopts::value(opts.force)->default_value("false"))
+		("j,jobs", "number of worker threads (0 = one per CPU)",
+			cxxopts::value(opts.jobs)->default_value("0"))
 		("no-fetch", "work offline, no updates of repos",
 			cxxopts::value(opts.noFetch)->default_value("false"))
 		("no-renames", "do not detect and store file renames",
 			cxxopts::value(opts.noRenames)->default_value("false"))
 		("q,quiet", "quiet mode", cxxopts::value(F2C::quiet)->default_value("false"))
+		("rename-jobs", "number of parallel git log runs collecting renames (0 = --jobs)",
+			cxxopts::value(opts.renameJobs)->default_value("0"))
+		("shard-dir", "write each branch (and renames) to its own db in this directory, "
+			"see f2c_merge_db", cxxopts::value(opts.shardDir))
+		("sink", "where to store the results of the Makefile walk (sqlite, ndjson, null, "
+			"memory = walk into memory, then store to sqlite)",
+			cxxopts::value(opts.sink)->default_value("sqlite"))
+		("sink-file", "output of the ndjson sink",
+			cxxopts::value(opts.sinkFile)->default_value("conf_file_map.ndjson"))
 		("v,verbose", "verbose mode")
 	;
 	options.add_options("authors")
@@ -39,17 +51,42 @@ Opts Opts::getOpts(int argc, char **argv)
 		("authors-LDAP-password-file", "file containting the password to the SUSE LDAP",
 			cxxopts::value(opts.authorsLDAPPasswordFile));
 	;
+	options.add_options("distributed")
+		("coordinator", "hand out branches to --worker processes through --spool-dir",
+			cxxopts::value(opts.coordinator)->default_value("false"))
+		("worker", "process branches handed out through --spool-dir into --shard-dir",
+			cxxopts::value(opts.worker)->default_value("false"))
+		("worker-id", "unique id of the worker, its scratch area is <dest>/worker-<id>",
+			cxxopts::value(opts.workerId)->default_value("$HOSTNAME"))
+		("spawn-workers", "number of local workers started by the coordinator",
+			cxxopts::value(opts.spawnWorkers)->default_value("0"))
+		("retries", "how many times to retry a failed branch",
+			cxxopts::value(opts.retries)->default_value("2"))
+		("spool-dir", "directory shared by the coordinator and workers",
+			cxxopts::value(opts.spoolDir))
+	;
 	options.add_options("files")
 		("configuration", "path to JSON containing configuration to be used",
 			cxxopts::value(opts.configurationJSON))
 	;
 	options.add_options("sqlite")
+		("publish", "publish a compacted copy of the db here (replaced atomically)",
+			cxxopts::value(opts.publish))
+		("publish-deltas", "publish also deltas from the previous db to deltas/ next to it "
+			"(with --publish)",
+			cxxopts::value(opts.publishDeltas)->default_value("false"))
+		("publish-zstd", "publish also a seekable zstd copy as PATH.zst (with --publish)",
+			cxxopts::value(opts.publishZstd)->default_value("false"))
 		("s,sqlite", "db name",
 			cxxopts::value(opts.sqlite)->default_value("conf_file_map.sqlite"))
 		("S,sqlite-create", "create the db if not exists",
 			cxxopts::value(opts.sqliteCreate)->default_value("false"))
 		("O,sqlite-create-only", "only create the db (do not fill it)",
 			cxxopts::value(opts.sqliteCreateOnly)->default_value("false"))
+		("sqlite-wal", "update the db in the WAL mode, so that readers are not blocked",
+			cxxopts::value(opts.sqliteWAL)->default_value("false"))
+		("sqlite-wal-limit", "size of the WAL kept after checkpoints (in MiB)",
+			cxxopts::value(opts.sqliteWALLimit)->default_value("64"))
 	;
 
 	try {
@@ -59,6 +96,11 @@ Opts Opts::getOpts(int argc, char **argv)
 		Clr::forceColorValue(cxxopts.contains("force-color"));
 		opts.hasDest = cxxopts.contains("dest");
 		opts.hasConfiguration = cxxopts.contains("configuration");
+		if (!cxxopts.contains("worker-id")) {
+			char host[256] {};
+			gethostname(host, sizeof(host) - 1);
+			opts.workerId = host;
+		}
 		return opts;
 	} catch (const cxxopts::exceptions::parsing &e) {
 		Clr(std::cerr, Clr::RED) << "arguments error: " << e.what();
@@ -14,9 +14,14 @@ struct Opts {
 	std::filesystem::path dest;
 	bool hasDest;
 	bool force;
+	unsigned jobs;
 	bool noFetch;
 	bool noRenames;
 	bool quiet;
+	unsigned renameJobs;
+	std::filesystem::path shardDir;
+	std::string sink;
+	std::filesystem::path sinkFile;
 	unsigned verbose;
 
 	bool authorsDumpRefs;
@@ -24,12 +29,24 @@ struct Opts {
 	std::filesystem::path authorsValidUsers;
 	std::filesystem::path authorsLDAPPasswordFile;
 
+	bool coordinator;
+	bool worker;
+	std::string workerId;
+	unsigned spawnWorkers;
+	unsigned retries;
+	std::filesystem::path spoolDir;
+
 	std::filesystem::path configurationJSON;
 	bool hasConfiguration;
 
+	std::filesystem::path publish;
+	bool publishDeltas;
+	bool publishZstd;
 	std::filesystem::path sqlite;
 	bool sqliteCreate;
 	bool sqliteCreateOnly;
+	bool sqliteWAL;
+	unsigned sqliteWALLimit;
 
 	static Opts getOpts(int argc, char **argv);
 };
@@ -1,11 +1,15 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <fstream>
+#include <future>
+
 #include <sl/helpers/Color.h>
 #include <sl/helpers/Exception.h>
 #include <sl/helpers/Process.h>
 #include <sl/helpers/PtrStore.h>
 #include <sl/helpers/String.h>
 
+#include "AtomicFile.h"
 #include "Renames.h"
 
 using Clr = SlHelpers::Color;
@@ -14,11 +18,8 @@ using SlHelpers::raise;
 
 using namespace F2C;
 
-void Renames::processRenamesBetween(F2CSQLConn &sql, const SlGit::Repo &lrepo,
-				    const BranchProps &begin, std::string_view end,
-				    RenameMap &renames)
+std::string Renames::getRange(const BranchProps &begin, std::string_view end)
 {
-	auto begVersion = begin.version;
 	std::ostringstream range;
 	range << 'v' << begin.versionStr << "..";
 	if (end.empty())
@@ -26,13 +27,18 @@ void Renames::processRenamesBetween(F2CSQLConn &sql, const SlGit::Repo &lrepo,
 	else
 		range << 'v' << end;
 
-	Clr() << '\t' << range.str();
+	return range.str();
+}
 
+/// @brief Run git log over @p range and parse the renames it reports
+Renames::RenameList Renames::collectRenames(const SlGit::Repo &lrepo, const std::string &range)
+{
 	// libgit2 is *very* slow at comparing trees, we have to call git log.
 	SlHelpers::Process p;
-	p.spawn("/usr/bin/git", { "-C", lrepo.workDir(), "log", "-M30", "-l0", "--oneline",
+	p.spawn("/usr/bin/git", { "-C", lrepo.workDir(), "log",
+				  "-M" + std::to_string(similarityThreshold), "-l0", "--oneline",
 				  "--no-merges", "--raw", "--diff-filter=R",
-				  "--format=", range.str() }, true);
+				  "--format=", range }, true);
 
 	SlHelpers::PtrStore<FILE, decltype([](FILE *f) { if (f) fclose(f); })> stream;
 	stream.reset(fdopen(p.readPipe(), "r"));
@@ -41,6 +47,7 @@ void Renames::processRenamesBetween(F2CSQLConn &sql, const SlGit::Repo &lrepo,
 
 	SlHelpers::PtrStore<char, decltype([](char *ptr) { free(ptr); })> lineRaw;
 	size_t len = 0;
+	RenameList list;
 
 	while (getline(lineRaw.ptr(), &len, stream.get()) != -1) {
 		auto line = lineRaw.str();
@@ -55,9 +62,87 @@ void Renames::processRenamesBetween(F2CSQLConn &sql, const SlGit::Repo &lrepo,
 		std::from_chars(vec[4].data() + 1, vec[4].data() + vec[4].size(), similarity);
 		if (!similarity)
 			RunEx("Bad rename part: ") << std::string(vec[4]) << raise;
-		auto oldFile = vec[5];
-		auto newFile = vec[6];
 
+		list.push_back({ std::string(vec[5]), std::string(vec[6]), similarity });
+	}
+
+	if (!feof(stream.get()) || ferror(stream.get()))
+		RunEx("Not completely read: ") << strerror(errno) << raise;
+
+	if (!p.waitForFinished())
+		RunEx("Cannot wait for git: ") << p.lastError() << raise;
+
+	if (p.signalled())
+		RunEx("git crashed").raise();
+	if (auto e = p.exitStatus())
+		RunEx("git exited with ") << e << raise;
+
+	return list;
+}
+
+/**
+ * @brief Load renames saved by saveRenames()
+ *
+ * The format is a "similarity TAB old TAB new" line per rename.
+ */
+std::optional<Renames::RenameList> Renames::loadRenames(const std::filesystem::path &file)
+{
+	std::ifstream ifs(file);
+	if (!ifs)
+		return {};
+
+	RenameList list;
+	for (std::string line; std::getline(ifs, line); ) {
+		auto vec = SlHelpers::String::splitSV(line, "\t");
+		if (vec.size() != 3)
+			return {};
+
+		unsigned similarity{};
+		std::from_chars(vec[0].data(), vec[0].data() + vec[0].size(), similarity);
+		if (!similarity)
+			return {};
+
+		list.push_back({ std::string(vec[1]), std::string(vec[2]), similarity });
+	}
+
+	return list;
+}
+
+bool Renames::saveRenames(const std::filesystem::path &file, const RenameList &list)
+{
+	return AtomicFile::tryWrite(file, [&list](std::ostream &os) {
+		for (const auto &r: list)
+			os << r.similarity << '\t' << r.oldFile << '\t' << r.newFile << '\n';
+	});
+}
+
+/**
+ * @brief Like collectRenames(), but reuse @p cacheFile if it exists
+ *
+ * Only ranges between two tags can be cached as they never change. An empty @p cacheFile
+ * means no caching.
+ */
+Renames::RenameList Renames::collectRenamesCached(const SlGit::Repo &lrepo,
+						  const std::string &range,
+						  const std::filesystem::path &cacheFile)
+{
+	if (cacheFile.empty())
+		return collectRenames(lrepo, range);
+
+	if (auto list = loadRenames(cacheFile))
+		return std::move(*list);
+
+	auto list = collectRenames(lrepo, range);
+	if (!saveRenames(cacheFile, list))
+		Clr(Clr::YELLOW) << "Cannot save renames to " << cacheFile;
+
+	return list;
+}
+
+/// @brief Extend chains in @p renames (new -> newest) by older renames from @p list
+void Renames::chainRenames(RenameMap &renames, const RenameList &list)
+{
+	for (const auto &[oldFile, newFile, similarity]: list) {
 		auto it = renames.find(newFile);
 		if (it != renames.end()) {
 			auto final = std::move(it->second);
@@ -70,21 +155,13 @@ void Renames::processRenamesBetween(F2CSQLConn &sql, const SlGit::Repo &lrepo,
 				renames.emplace(oldFile, std::move(final));
 			}
 		} else {
-			renames.emplace(oldFile, RenameInfo{std::string(newFile), similarity});
+			renames.emplace(oldFile, RenameInfo{newFile, similarity});
 		}
 	}
+}
 
-	if (!feof(stream.get()) || ferror(stream.get()))
-		RunEx("Not completely read: ") << strerror(errno) << raise;
-
-	if (!p.waitForFinished())
-		RunEx("Cannot wait for git: ") << p.lastError() << raise;
-
-	if (p.signalled())
-		RunEx("git crashed").raise();
-	if (auto e = p.exitStatus())
-		RunEx("git exited with ") << e << raise;
-
+void Renames::storeRenames(F2CSQLConn &sql, unsigned begVersion, const RenameMap &renames)
+{
 	auto trans = sql.beginAuto();
 	for (const auto &e: renames) {
 		auto oldP = sql.insertPath(e.first);
@@ -103,17 +180,64 @@ void Renames::processRenamesBetween(F2CSQLConn &sql, const SlGit::Repo &lrepo,
 	}
 }
 
+/**
+ * @brief Collect and store renames between all the versions of @p branchesProps
+ *
+ * Up to @p jobs (0 = size of @p pool) git log runs are executed in parallel. Their results
+ * are chained and stored in version order, from the newest range to the oldest one. Renames
+ * between two tags are kept in @p cacheDir for later runs.
+ */
 void Renames::processRenames(F2CSQLConn &sql, const SlGit::Repo &lrepo,
-			     const BranchesProps &branchesProps)
+			     const BranchesProps &branchesProps, ThreadPool &pool,
+			     unsigned jobs, const std::filesystem::path &cacheDir)
 {
 	auto uniqTags = getUniqTags(branchesProps);
-	if (uniqTags.size() >= 1) {
-		auto curr = uniqTags.rbegin();
+	if (uniqTags.empty())
+		return;
+
+	struct Range {
+		unsigned begVersion;
+		std::string range;
+		std::filesystem::path cacheFile;
+		std::future<RenameList> list;
+	};
+	std::vector<Range> ranges;
+
+	auto curr = uniqTags.rbegin();
+	ranges.push_back({ curr->version, getRange(*curr, ""), {}, {} });
+	for (auto prev = std::next(curr); prev != uniqTags.rend(); ++curr, ++prev) {
+		auto range = getRange(*prev, curr->versionStr);
+		auto cacheFile = cacheDir / (range + "-M" + std::to_string(similarityThreshold));
+		ranges.push_back({ prev->version, std::move(range), std::move(cacheFile), {} });
+	}
+
+	if (!jobs)
+		jobs = pool.size();
 
+	size_t launched = 0;
+	auto launch = [&pool, &lrepo, &ranges, &launched]() {
+		auto &r = ranges[launched++];
+		r.list = pool.push([&lrepo, &r]() {
+			return collectRenamesCached(lrepo, r.range, r.cacheFile);
+		});
+	};
+
+	try {
 		RenameMap map;
-		processRenamesBetween(sql, lrepo, *curr, "", map);
-		for (auto prev = std::next(curr); prev != uniqTags.rend(); ++curr, ++prev)
-			processRenamesBetween(sql, lrepo, *prev, curr->versionStr, map);
+		for (size_t i = 0; i < ranges.size(); ++i) {
+			while (launched < ranges.size() && launched < i + jobs)
+				launch();
+
+			auto &r = ranges[i];
+			Clr() << '\t' << r.range;
+			chainRenames(map, r.list.get());
+			storeRenames(sql, r.begVersion, map);
+		}
+	} catch (...) {
+		// the tasks refer to ranges
+		for (auto &r: ranges)
+			if (r.list.valid())
+				r.list.wait();
+		throw;
 	}
 }
-
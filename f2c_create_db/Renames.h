@@ -2,10 +2,13 @@
 
 #pragma once
 
+#include <filesystem>
+#include <optional>
 #include <set>
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <vector>
 
 #include <sl/git/Repo.h>
 #include <sl/helpers/String.h>
@@ -13,6 +16,7 @@
 #include "F2CSQLConn.h"
 
 #include "BranchProps.h"
+#include "ThreadPool.h"
 
 namespace F2C {
 
@@ -21,9 +25,13 @@ public:
 	Renames() = delete;
 
 	static void processRenames(F2CSQLConn &sql, const SlGit::Repo &lrepo,
-				   const BranchesProps &branchesProps);
+				   const BranchesProps &branchesProps, ThreadPool &pool,
+				   unsigned jobs, const std::filesystem::path &cacheDir);
 
 private:
+	/// @brief Threshold passed to git log -M
+	static constexpr unsigned similarityThreshold = 30;
+
 	struct RenameInfo {
 		std::string path;
 		unsigned similarity;
@@ -32,9 +40,24 @@ private:
         using RenameMap = std::unordered_map<std::string, RenameInfo, SlHelpers::String::Hash,
 	      SlHelpers::String::Eq>;
 
-	static void processRenamesBetween(F2CSQLConn &sql, const SlGit::Repo &lrepo,
-					  const BranchProps &begin, std::string_view end,
-					  RenameMap &renames);
+	/// @brief One rename as reported by git log
+	struct Rename {
+		std::string oldFile;
+		std::string newFile;
+		unsigned similarity;
+	};
+
+	/// @brief Renames of a range, newest first
+	using RenameList = std::vector<Rename>;
+
+	static std::string getRange(const BranchProps &begin, std::string_view end);
+	static RenameList collectRenames(const SlGit::Repo &lrepo, const std::string &range);
+	static RenameList collectRenamesCached(const SlGit::Repo &lrepo, const std::string &range,
+					       const std::filesystem::path &cacheFile);
+	static std::optional<RenameList> loadRenames(const std::filesystem::path &file);
+	static bool saveRenames(const std::filesystem::path &file, const RenameList &list);
+	static void chainRenames(RenameMap &renames, const RenameList &list);
+	static void storeRenames(F2CSQLConn &sql, unsigned begVersion, const RenameMap &renames);
 
 	static auto getUniqTags(const BranchesProps &branchesProps) {
 		std::set<BranchProps, decltype([](const auto &e1, const auto &e2) {
@@ -0,0 +1,441 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sqlite3.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <zstd.h>
+
+#include <sl/helpers/Exception.h>
+#include <sl/helpers/PtrStore.h>
+
+#include "SeekableZstd.h"
+
+using RunEx = SlHelpers::RuntimeException;
+using SlHelpers::raise;
+
+using namespace F2C;
+
+namespace {
+
+// see zstd's contrib/seekable_format/zstd_seekable_compression_format.md
+constexpr const uint32_t skippableMagic = 0x184D2A5E;
+constexpr const uint32_t seekableMagic = 0x8F92EAB1;
+constexpr const size_t skippableHeaderSize = 8;
+constexpr const size_t footerSize = 9;
+constexpr const uint8_t checksumFlag = 0x80;
+
+/// @brief Decompressed frames kept by one open db
+constexpr const size_t cachedFrames = 32;
+
+void putLE32(std::string &buf, uint32_t val)
+{
+	for (auto i = 0U; i < 4; ++i)
+		buf += static_cast<char>(val >> (8 * i));
+}
+
+uint32_t getLE32(const unsigned char *buf)
+{
+	return buf[0] | buf[1] << 8 | buf[2] << 16 | static_cast<uint32_t>(buf[3]) << 24;
+}
+
+struct Frame {
+	uint64_t offset;
+	uint32_t size;
+	uint64_t dataOffset;
+	uint32_t dataSize;
+};
+
+bool preadAll(int fd, void *buf, size_t len, off_t off)
+{
+	auto ptr = static_cast<char *>(buf);
+	while (len) {
+		const auto ret = pread(fd, ptr, len, off);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+		ptr += ret;
+		len -= ret;
+		off += ret;
+	}
+	return true;
+}
+
+/// @brief The frames of @p fd, or nullopt if @p fd is not in the seekable format
+std::optional<std::vector<Frame>> readSeekTable(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) || static_cast<size_t>(st.st_size) < skippableHeaderSize + footerSize)
+		return std::nullopt;
+	const uint64_t fileSize = st.st_size;
+
+	unsigned char footer[footerSize];
+	if (!preadAll(fd, footer, sizeof(footer), fileSize - footerSize) ||
+			getLE32(footer + 5) != seekableMagic)
+		return std::nullopt;
+
+	const uint64_t cnt = getLE32(footer);
+	const size_t entrySize = footer[4] & checksumFlag ? 12 : 8;
+	const auto tableSize = skippableHeaderSize + cnt * entrySize + footerSize;
+	if (tableSize > fileSize)
+		return std::nullopt;
+
+	std::vector<unsigned char> table(tableSize - footerSize);
+	if (!preadAll(fd, table.data(), table.size(), fileSize - tableSize) ||
+			getLE32(table.data()) != skippableMagic ||
+			getLE32(table.data() + 4) != tableSize - skippableHeaderSize)
+		return std::nullopt;
+
+	std::vector<Frame> frames;
+	uint64_t offset = 0, dataOffset = 0;
+	for (auto i = 0U; i < cnt; ++i) {
+		const auto entry = table.data() + skippableHeaderSize + i * entrySize;
+		const Frame frame {
+			.offset = offset,
+			.size = getLE32(entry),
+			.dataOffset = dataOffset,
+			.dataSize = getLE32(entry + 4),
+		};
+		offset += frame.size;
+		dataOffset += frame.dataSize;
+		frames.push_back(frame);
+	}
+	if (offset != fileSize - tableSize)
+		return std::nullopt;
+
+	return frames;
+}
+
+/// @brief Random access to the decompressed content of a seekable file
+class Reader {
+public:
+	/// @brief Returns nullptr if @p file cannot be opened or is not in the seekable format
+	static std::unique_ptr<Reader> open(const std::filesystem::path &file) {
+		const auto fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return nullptr;
+
+		auto frames = readSeekTable(fd);
+		if (!frames) {
+			close(fd);
+			return nullptr;
+		}
+
+		return std::unique_ptr<Reader>(new Reader(fd, std::move(*frames)));
+	}
+
+	~Reader() { close(m_fd); }
+
+	uint64_t size() const {
+		return m_frames.empty() ? 0 : m_frames.back().dataOffset + m_frames.back().dataSize;
+	}
+
+	bool read(void *buf, size_t len, uint64_t off);
+private:
+	Reader(int fd, std::vector<Frame> &&frames) : m_fd(fd), m_frames(std::move(frames)) {
+		m_dctx.reset(ZSTD_createDCtx());
+		if (!m_dctx)
+			RunEx("Cannot create a zstd context").raise();
+	}
+
+	const std::string &frame(size_t idx);
+
+	int m_fd;
+	std::vector<Frame> m_frames;
+	std::list<std::pair<size_t, std::string>> m_cache;
+	SlHelpers::PtrStore<ZSTD_DCtx, decltype([](ZSTD_DCtx *ctx) { ZSTD_freeDCtx(ctx); })> m_dctx;
+	std::string m_compressed;
+};
+
+/// @brief Read @p len bytes at @p off, the part beyond the end is zeroed and false returned
+bool Reader::read(void *buf, size_t len, uint64_t off)
+{
+	auto ptr = static_cast<char *>(buf);
+
+	auto it = std::upper_bound(m_frames.begin(), m_frames.end(), off,
+				   [](uint64_t off, const Frame &frame) {
+		return off < frame.dataOffset;
+	});
+	if (it != m_frames.begin())
+		--it;
+
+	for (; len && it != m_frames.end(); ++it) {
+		if (off < it->dataOffset || off >= it->dataOffset + it->dataSize)
+			break;
+		const auto &data = frame(it - m_frames.begin());
+		const auto inFrame = off - it->dataOffset;
+		const auto cnt = std::min<uint64_t>(len, it->dataSize - inFrame);
+		memcpy(ptr, data.data() + inFrame, cnt);
+		ptr += cnt;
+		len -= cnt;
+		off += cnt;
+	}
+
+	memset(ptr, 0, len);
+	return !len;
+}
+
+/// @brief Decompressed frame @p idx, the least recently used frames are dropped
+const std::string &Reader::frame(size_t idx)
+{
+	auto it = std::find_if(m_cache.begin(), m_cache.end(), [idx](const auto &e) {
+		return e.first == idx;
+	});
+	if (it != m_cache.end()) {
+		m_cache.splice(m_cache.begin(), m_cache, it);
+		return m_cache.front().second;
+	}
+
+	const auto &frame = m_frames[idx];
+	m_compressed.resize(frame.size);
+	if (!preadAll(m_fd, m_compressed.data(), frame.size, frame.offset))
+		RunEx("Cannot read a zstd frame: ") << strerror(errno) << raise;
+
+	if (m_cache.size() >= cachedFrames)
+		m_cache.pop_back();
+	m_cache.emplace_front(idx, std::string(frame.dataSize, '\0'));
+
+	auto &data = m_cache.front().second;
+	const auto ret = ZSTD_decompressDCtx(m_dctx.get(), data.data(), data.size(),
+					     m_compressed.data(), m_compressed.size());
+	if (ZSTD_isError(ret) || ret != frame.dataSize) {
+		m_cache.pop_front();
+		RunEx("Cannot decompress a zstd frame: ") <<
+			(ZSTD_isError(ret) ? ZSTD_getErrorName(ret) : "size mismatch") << raise;
+	}
+
+	return data;
+}
+
+struct File {
+	sqlite3_file base;
+	Reader *reader;
+};
+
+Reader &reader(sqlite3_file *file)
+{
+	return *reinterpret_cast<File *>(file)->reader;
+}
+
+const sqlite3_io_methods ioMethods {
+	.iVersion = 1,
+	.xClose = [](sqlite3_file *file) {
+		delete reinterpret_cast<File *>(file)->reader;
+		return SQLITE_OK;
+	},
+	.xRead = [](sqlite3_file *file, void *buf, int len, sqlite3_int64 off) {
+		try {
+			return reader(file).read(buf, len, off) ? SQLITE_OK :
+								   SQLITE_IOERR_SHORT_READ;
+		} catch (const std::exception &) {
+			return SQLITE_IOERR_READ;
+		}
+	},
+	.xWrite = [](sqlite3_file *, const void *, int, sqlite3_int64) { return SQLITE_READONLY; },
+	.xTruncate = [](sqlite3_file *, sqlite3_int64) { return SQLITE_READONLY; },
+	.xSync = [](sqlite3_file *, int) { return SQLITE_OK; },
+	.xFileSize = [](sqlite3_file *file, sqlite3_int64 *size) {
+		*size = reader(file).size();
+		return SQLITE_OK;
+	},
+	.xLock = [](sqlite3_file *, int) { return SQLITE_OK; },
+	.xUnlock = [](sqlite3_file *, int) { return SQLITE_OK; },
+	.xCheckReservedLock = [](sqlite3_file *, int *out) {
+		*out = 0;
+		return SQLITE_OK;
+	},
+	.xFileControl = [](sqlite3_file *, int, void *) { return SQLITE_NOTFOUND; },
+	.xSectorSize = [](sqlite3_file *) { return 0; },
+	// no journals nor locks are looked for
+	.xDeviceCharacteristics = [](sqlite3_file *) { return SQLITE_IOCAP_IMMUTABLE; },
+	.xShmMap = nullptr,
+	.xShmLock = nullptr,
+	.xShmBarrier = nullptr,
+	.xShmUnmap = nullptr,
+	.xFetch = nullptr,
+	.xUnfetch = nullptr,
+};
+
+sqlite3_vfs *orig(sqlite3_vfs *vfs)
+{
+	return static_cast<sqlite3_vfs *>(vfs->pAppData);
+}
+
+int vfsOpen(sqlite3_vfs *vfs, const char *name, sqlite3_file *file, int flags, int *outFlags)
+{
+	file->pMethods = nullptr;
+
+	if (name && (flags & SQLITE_OPEN_MAIN_DB)) {
+		try {
+			if (auto r = Reader::open(name)) {
+				auto zFile = reinterpret_cast<File *>(file);
+				zFile->reader = r.release();
+				zFile->base.pMethods = &ioMethods;
+				if (outFlags)
+					*outFlags = (flags & ~(SQLITE_OPEN_READWRITE |
+							       SQLITE_OPEN_CREATE)) |
+						SQLITE_OPEN_READONLY;
+				return SQLITE_OK;
+			}
+		} catch (const std::exception &) {
+			return SQLITE_CANTOPEN;
+		}
+	}
+
+	return orig(vfs)->xOpen(orig(vfs), name, file, flags, outFlags);
+}
+
+} // namespace
+
+bool SeekableZstd::isCompressed(const std::filesystem::path &file)
+{
+	return Reader::open(file) != nullptr;
+}
+
+/// @brief Compress @p src to @p dest, the caller is supposed to rename @p dest into place
+void SeekableZstd::compress(const std::filesystem::path &src, const std::filesystem::path &dest)
+{
+	SlHelpers::PtrStore<ZSTD_CCtx, decltype([](ZSTD_CCtx *ctx) { ZSTD_freeCCtx(ctx); })> cctx;
+	cctx.reset(ZSTD_createCCtx());
+	if (!cctx)
+		RunEx("Cannot create a zstd context").raise();
+
+	std::ifstream ifs(src, std::ios::binary);
+	if (!ifs)
+		RunEx("Cannot open ") << src << ": " << strerror(errno) << raise;
+	std::ofstream ofs(dest, std::ios::binary | std::ios::trunc);
+	if (!ofs)
+		RunEx("Cannot create ") << dest << ": " << strerror(errno) << raise;
+
+	std::string in(frameSize, '\0');
+	std::string out(ZSTD_compressBound(frameSize), '\0');
+	std::string table;
+	uint32_t cnt = 0;
+
+	while (ifs.read(in.data(), in.size()) || ifs.gcount()) {
+		const auto len = static_cast<size_t>(ifs.gcount());
+		const auto ret = ZSTD_compressCCtx(cctx.get(), out.data(), out.size(), in.data(), len,
+						   level);
+		if (ZSTD_isError(ret))
+			RunEx("Cannot compress ") << src << ": " << ZSTD_getErrorName(ret) << raise;
+
+		ofs.write(out.data(), ret);
+		putLE32(table, ret);
+		putLE32(table, len);
+		cnt++;
+	}
+	if (ifs.bad())
+		RunEx("Cannot read ") << src << raise;
+
+	std::string header;
+	putLE32(header, skippableMagic);
+	putLE32(header, table.size() + footerSize);
+	putLE32(table, cnt);
+	table += '\0';
+	putLE32(table, seekableMagic);
+
+	ofs << header << table;
+	if (!ofs.flush())
+		RunEx("Cannot write ") << dest << raise;
+}
+
+void SeekableZstd::decompress(const std::filesystem::path &src, const std::filesystem::path &dest)
+{
+	auto reader = Reader::open(src);
+	if (!reader)
+		RunEx("Not a seekable zstd file: ") << src << raise;
+
+	std::ofstream ofs(dest, std::ios::binary | std::ios::trunc);
+	if (!ofs)
+		RunEx("Cannot create ") << dest << ": " << strerror(errno) << raise;
+
+	std::string buf(frameSize, '\0');
+	for (uint64_t off = 0; off < reader->size(); off += buf.size()) {
+		const auto len = std::min<uint64_t>(buf.size(), reader->size() - off);
+		reader->read(buf.data(), len, off);
+		ofs.write(buf.data(), len);
+	}
+
+	if (!ofs.flush())
+		RunEx("Cannot write ") << dest << raise;
+}
+
+/**
+ * @brief Register the VFS reading the compressed dbs as vfsName
+ *
+ * With @p makeDefault, every db opened read-only can be a compressed one.
+ */
+void SeekableZstd::registerVFS(bool makeDefault)
+{
+	static sqlite3_vfs vfs;
+	static std::once_flag once;
+
+	std::call_once(once, [makeDefault]() {
+		const auto dflt = sqlite3_vfs_find(nullptr);
+		if (!dflt)
+			RunEx("No default sqlite VFS").raise();
+
+		vfs = {
+			.iVersion = 2,
+			.szOsFile = std::max<int>(sizeof(File), dflt->szOsFile),
+			.mxPathname = dflt->mxPathname,
+			.pNext = nullptr,
+			.zName = vfsName,
+			.pAppData = dflt,
+			.xOpen = vfsOpen,
+			.xDelete = [](sqlite3_vfs *vfs, const char *name, int syncDir) {
+				return orig(vfs)->xDelete(orig(vfs), name, syncDir);
+			},
+			.xAccess = [](sqlite3_vfs *vfs, const char *name, int flags, int *out) {
+				return orig(vfs)->xAccess(orig(vfs), name, flags, out);
+			},
+			.xFullPathname = [](sqlite3_vfs *vfs, const char *name, int len, char *out) {
+				return orig(vfs)->xFullPathname(orig(vfs), name, len, out);
+			},
+			.xDlOpen = [](sqlite3_vfs *vfs, const char *name) {
+				return orig(vfs)->xDlOpen(orig(vfs), name);
+			},
+			.xDlError = [](sqlite3_vfs *vfs, int len, char *msg) {
+				orig(vfs)->xDlError(orig(vfs), len, msg);
+			},
+			.xDlSym = [](sqlite3_vfs *vfs, void *handle, const char *sym) -> void (*)() {
+				return orig(vfs)->xDlSym(orig(vfs), handle, sym);
+			},
+			.xDlClose = [](sqlite3_vfs *vfs, void *handle) {
+				orig(vfs)->xDlClose(orig(vfs), handle);
+			},
+			.xRandomness = [](sqlite3_vfs *vfs, int len, char *out) {
+				return orig(vfs)->xRandomness(orig(vfs), len, out);
+			},
+			.xSleep = [](sqlite3_vfs *vfs, int us) {
+				return orig(vfs)->xSleep(orig(vfs), us);
+			},
+			.xCurrentTime = [](sqlite3_vfs *vfs, double *out) {
+				return orig(vfs)->xCurrentTime(orig(vfs), out);
+			},
+			.xGetLastError = [](sqlite3_vfs *vfs, int len, char *msg) {
+				return orig(vfs)->xGetLastError(orig(vfs), len, msg);
+			},
+			.xCurrentTimeInt64 = [](sqlite3_vfs *vfs, sqlite3_int64 *out) {
+				return orig(vfs)->xCurrentTimeInt64(orig(vfs), out);
+			},
+			.xSetSystemCall = nullptr,
+			.xGetSystemCall = nullptr,
+			.xNextSystemCall = nullptr,
+		};
+
+		if (sqlite3_vfs_register(&vfs, makeDefault) != SQLITE_OK)
+			RunEx("Cannot register the ") << vfsName << " sqlite VFS" << raise;
+	});
+}
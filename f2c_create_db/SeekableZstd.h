@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+namespace F2C {
+
+/**
+ * @brief Dbs compressed in the zstd seekable format
+ *
+ * The db is cut into frames of frameSize bytes, each compressed independently. A seek table
+ * stored in a skippable frame at the end maps them to their offsets, so any page can be read by
+ * decompressing a single frame. The file is still a valid zstd stream, i.e. "zstd -d" works.
+ *
+ * The read-only sqlite VFS registered by registerVFS() opens such files directly. Other files
+ * are passed to the default VFS.
+ */
+class SeekableZstd {
+public:
+	static constexpr const char *vfsName = "f2c-zstd";
+	static constexpr const size_t frameSize = 64 * 1024;
+	static constexpr const int level = 12;
+
+	static bool isCompressed(const std::filesystem::path &file);
+	static void compress(const std::filesystem::path &src, const std::filesystem::path &dest);
+	static void decompress(const std::filesystem::path &src, const std::filesystem::path &dest);
+
+	static void registerVFS(bool makeDefault);
+};
+
+} // namespace
@@ -0,0 +1,368 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <condition_variable>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "AtomicFile.h"
+#include "Spool.h"
+
+using namespace F2C;
+
+namespace {
+
+const char *subdirs[] = { "queue", "claimed", "done", "failed", "dead" };
+
+/// @brief host:pid of this process, written to its claims
+std::string owner()
+{
+	char host[256] {};
+	gethostname(host, sizeof(host) - 1);
+
+	return std::string(host) + ':' + std::to_string(getpid());
+}
+
+/**
+ * @brief Set mtime of @p file to now
+ *
+ * Without explicit times, NFS uses the clock of the server, so that workers on other hosts
+ * are not skewed against each other.
+ */
+bool touch(const std::filesystem::path &file)
+{
+	return !utimensat(AT_FDCWD, file.c_str(), nullptr, 0);
+}
+
+std::optional<double> parseSeconds(const std::string &str)
+{
+	double ret;
+	const auto end = str.data() + str.size();
+	const auto [ptr, ec] = std::from_chars(str.data(), end, ret);
+	if (ec != std::errc() || ptr != end || !std::isfinite(ret) || ret < 0)
+		return std::nullopt;
+
+	return ret;
+}
+
+} // namespace
+
+Spool::Heartbeat::Heartbeat(const Spool &spool, const Task &task) :
+	m_thread([file = spool.dir("claimed") / task.name](std::stop_token stop) {
+		std::mutex lock;
+		std::condition_variable_any cond;
+		std::unique_lock guard(lock);
+		while (!cond.wait_for(guard, stop, heartbeatInterval, [&stop]() {
+				return stop.stop_requested();
+			}))
+			touch(file);
+	})
+{
+}
+
+/// @brief Start a new run, the timings of the previous runs are kept
+void Spool::reset() const
+{
+	std::filesystem::remove(m_dir / "finished");
+	for (const auto sub: subdirs) {
+		std::filesystem::remove_all(dir(sub));
+		std::filesystem::create_directories(dir(sub));
+	}
+}
+
+/**
+ * @brief Queue @p branches, the most expensive first
+ *
+ * The cost is the duration from the previous runs. Branches never seen before go first, as
+ * nothing is known about them.
+ */
+void Spool::enqueue(const std::vector<std::string> &branches) const
+{
+	std::unordered_map<std::string, double> timings;
+	for (const auto &line: read(m_dir / "timings")) {
+		const auto tab = line.find('\t');
+		if (tab == line.npos)
+			continue;
+		// a damaged line makes the branch look new, i.e. expensive
+		if (auto seconds = parseSeconds(line.substr(0, tab)))
+			timings[line.substr(tab + 1)] = *seconds;
+	}
+
+	auto sorted = branches;
+	const auto cost = [&timings](const std::string &branch) {
+		auto it = timings.find(branch);
+		return it == timings.end() ? std::numeric_limits<double>::infinity() : it->second;
+	};
+	std::stable_sort(sorted.begin(), sorted.end(), [&cost](const auto &a, const auto &b) {
+		return cost(a) > cost(b);
+	});
+
+	for (auto i = 0U; i < sorted.size(); ++i) {
+		auto name = sorted[i];
+		std::replace(name.begin(), name.end(), '/', '_');
+		std::ostringstream ss;
+		ss << std::setw(5) << std::setfill('0') << i << '-' << name;
+
+		writeTask("queue", {
+			.name = ss.str(),
+			.branch = sorted[i],
+			.no = i + 1,
+			.cnt = static_cast<unsigned>(sorted.size()),
+			.attempt = 0,
+		});
+	}
+}
+
+/**
+ * @brief Move claims not refreshed for staleTimeout to failed/
+ *
+ * Their workers crashed or lost the spool, so the branches are retried like failed ones.
+ *
+ * @return The stale claims.
+ */
+std::vector<Spool::Failed> Spool::failStale() const
+{
+	std::vector<Failed> ret;
+	const auto now = std::filesystem::file_time_type::clock::now();
+
+	for (const auto &name: list("claimed")) {
+		const auto file = dir("claimed") / name;
+		std::error_code ec;
+		const auto mtime = std::filesystem::last_write_time(file, ec);
+		if (ec || now - mtime < staleTimeout)
+			continue;
+
+		const auto lines = read(file);
+		const auto task = readTask("claimed", name);
+		const auto error = "Claim by " + (lines.size() > 4 ? lines[4] : "unknown") +
+			" went stale";
+		moveToFailed("claimed", name, error);
+		ret.push_back({ task ? task->branch : name, task ? task->attempt : 0, error });
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Put failed branches back to the queue
+ *
+ * @return Branches which failed more than @p retries times, they are moved to dead/.
+ * Malformed files are moved there too.
+ */
+std::vector<Spool::Failed> Spool::requeueFailed(unsigned retries) const
+{
+	std::vector<Failed> ret;
+
+	for (const auto &name: list("failed")) {
+		const auto lines = read(dir("failed") / name);
+		auto task = readTask("failed", name);
+		if (!task || lines.size() < 5) {
+			std::filesystem::rename(dir("failed") / name, dir("dead") / name);
+			ret.push_back({ task ? task->branch : name, task ? task->attempt : 0,
+					"Malformed " + (dir("failed") / name).string() });
+			continue;
+		}
+
+		if (task->attempt < retries) {
+			task->attempt++;
+			writeTask("queue", *task);
+			std::filesystem::remove(dir("failed") / name);
+			continue;
+		}
+
+		std::filesystem::rename(dir("failed") / name, dir("dead") / name);
+		ret.push_back({ task->branch, task->attempt, lines[4] });
+	}
+
+	return ret;
+}
+
+/// @brief Nothing is queued, claimed, nor failed
+bool Spool::idle() const
+{
+	return list("queue").empty() && list("claimed").empty() && list("failed").empty();
+}
+
+/// @brief Processed branches, malformed ones are moved to failed/ to be retried
+std::vector<Spool::Done> Spool::done() const
+{
+	std::vector<Done> ret;
+
+	for (const auto &name: list("done")) {
+		auto lines = read(dir("done") / name);
+		const auto seconds = lines.size() >= 6 ? parseSeconds(lines[4]) : std::nullopt;
+		if (!seconds) {
+			moveToFailed("done", name, "Malformed " + (dir("done") / name).string());
+			continue;
+		}
+		ret.push_back({ lines[0], *seconds, lines[5] });
+	}
+
+	return ret;
+}
+
+/// @brief Update the timings of the previous runs by @p done
+void Spool::saveTimings(const std::vector<Done> &done) const
+{
+	std::vector<std::string> lines;
+	for (const auto &line: read(m_dir / "timings")) {
+		const auto tab = line.find('\t');
+		if (tab == line.npos)
+			continue;
+		const auto branch = line.substr(tab + 1);
+		if (std::none_of(done.begin(), done.end(), [&branch](const Done &d) {
+				return d.branch == branch;
+			}))
+			lines.push_back(line);
+	}
+
+	AtomicFile::write(m_dir / "timings", [&lines, &done](std::ostream &os) {
+		for (const auto &line: lines)
+			os << line << '\n';
+		for (const auto &d: done)
+			os << d.seconds << '\t' << d.branch << '\n';
+	});
+}
+
+/// @brief Let the workers exit
+void Spool::finish() const
+{
+	AtomicFile::write(m_dir / "finished", [](std::ostream &) {});
+}
+
+/**
+ * @brief Claim the first queued branch
+ *
+ * Other workers may be faster in renaming the same file, so the next one is tried then. The
+ * claim is rewritten with owner() of this worker. Keep it fresh by Heartbeat.
+ */
+std::optional<Spool::Task> Spool::claim() const
+{
+	for (const auto &name: list("queue")) {
+		// the file keeps its mtime when renamed, it must not look stale to the coordinator
+		if (!touch(dir("queue") / name))
+			continue;
+
+		std::error_code ec;
+		std::filesystem::rename(dir("queue") / name, dir("claimed") / name, ec);
+		if (ec)
+			continue;
+
+		auto task = readTask("claimed", name);
+		if (!task) {
+			moveToFailed("claimed", name, "Malformed " + (dir("claimed") / name).string());
+			continue;
+		}
+
+		writeTask("claimed", *task, { owner() });
+		return task;
+	}
+
+	return std::nullopt;
+}
+
+void Spool::done(const Task &task, double seconds, const std::string &versionStr) const
+{
+	std::ostringstream ss;
+	ss << seconds;
+	writeTask("done", task, { ss.str(), versionStr });
+	std::filesystem::remove(dir("claimed") / task.name);
+}
+
+void Spool::failed(const Task &task, const std::string &error) const
+{
+	moveToFailed("claimed", task.name, error);
+}
+
+bool Spool::finished() const
+{
+	return std::filesystem::exists(m_dir / "finished");
+}
+
+/// @brief Sorted names in @p sub, hidden (temporary) files are skipped
+std::vector<std::string> Spool::list(const char *sub) const
+{
+	std::vector<std::string> ret;
+
+	std::error_code ec;
+	for (const auto &e: std::filesystem::directory_iterator(dir(sub), ec)) {
+		auto name = e.path().filename().string();
+		if (!name.starts_with('.'))
+			ret.push_back(std::move(name));
+	}
+	std::sort(ret.begin(), ret.end());
+
+	return ret;
+}
+
+std::vector<std::string> Spool::read(const std::filesystem::path &file) const
+{
+	std::vector<std::string> ret;
+
+	std::ifstream ifs(file);
+	for (std::string line; std::getline(ifs, line); )
+		ret.push_back(std::move(line));
+
+	return ret;
+}
+
+/// @brief Write @p task to @p sub, followed by @p extra lines
+void Spool::writeTask(const char *sub, const Task &task,
+		      const std::vector<std::string> &extra) const
+{
+	AtomicFile::write(dir(sub) / task.name, [&task, &extra](std::ostream &os) {
+		os << task.branch << '\n' << task.no << '\n' << task.cnt << '\n' <<
+		      task.attempt << '\n';
+		for (const auto &line: extra)
+			os << line << '\n';
+	});
+}
+
+/**
+ * @brief Move the task @p name from @p sub to failed/ with @p error
+ *
+ * If the task cannot be read, the file is moved as is and requeueFailed() puts it to dead/.
+ */
+void Spool::moveToFailed(const char *sub, const std::string &name, const std::string &error) const
+{
+	auto task = readTask(sub, name);
+	if (!task) {
+		std::error_code ec;
+		std::filesystem::rename(dir(sub) / name, dir("failed") / name, ec);
+		return;
+	}
+
+	auto oneLine = error;
+	std::replace(oneLine.begin(), oneLine.end(), '\n', ' ');
+
+	writeTask("failed", *task, { oneLine });
+	std::filesystem::remove(dir(sub) / name);
+}
+
+std::optional<Spool::Task> Spool::readTask(const char *sub, const std::string &name) const
+{
+	auto lines = read(dir(sub) / name);
+	if (lines.size() < 4)
+		return std::nullopt;
+
+	try {
+		return Task {
+			.name = name,
+			.branch = lines[0],
+			.no = static_cast<unsigned>(std::stoul(lines[1])),
+			.cnt = static_cast<unsigned>(std::stoul(lines[2])),
+			.attempt = static_cast<unsigned>(std::stoul(lines[3])),
+		};
+	} catch (const std::logic_error &) {
+		return std::nullopt;
+	}
+}
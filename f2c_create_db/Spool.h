@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace F2C {
+
+/**
+ * @brief Branch queue shared by a coordinator and --worker processes
+ *
+ * The spool is a plain directory, so that workers can run on any host sharing the filesystem.
+ * Every branch is a small file moving between subdirectories by rename(), which is atomic:
+ *  - queue/   branches waiting for a worker, the file name sorts the expensive ones first
+ *  - claimed/ branches being processed by a worker, with its host and pid
+ *  - done/    processed branches, with their timing and version
+ *  - failed/  branches whose processing failed, to be retried by the coordinator
+ *  - dead/    branches which failed too many times
+ *
+ * A worker keeps refreshing the mtime of its claim (see Heartbeat). The coordinator moves
+ * claims not refreshed for staleTimeout, i.e. of crashed workers, to failed/, so that they are
+ * retried like other failures.
+ *
+ * The timings file keeps the durations of the previous runs. Workers exit once the
+ * coordinator creates the finished file.
+ */
+class Spool {
+public:
+	static constexpr const std::chrono::seconds pollInterval { 1 };
+	static constexpr const std::chrono::seconds heartbeatInterval { 30 };
+	static constexpr const std::chrono::seconds staleTimeout { 10 * heartbeatInterval };
+
+	struct Task {
+		std::string name;
+		std::string branch;
+		unsigned no;
+		unsigned cnt;
+		unsigned attempt;
+	};
+
+	struct Done {
+		std::string branch;
+		double seconds;
+		std::string versionStr;
+	};
+
+	struct Failed {
+		std::string branch;
+		unsigned attempt;
+		std::string error;
+	};
+
+	/// @brief Refreshes the claim of a task in a thread, until destroyed
+	class Heartbeat {
+	public:
+		Heartbeat(const Spool &spool, const Task &task);
+	private:
+		std::jthread m_thread;
+	};
+
+	Spool(const std::filesystem::path &dir) : m_dir(dir) {}
+
+	// coordinator
+	void reset() const;
+	void enqueue(const std::vector<std::string> &branches) const;
+	std::vector<Failed> failStale() const;
+	std::vector<Failed> requeueFailed(unsigned retries) const;
+	bool idle() const;
+	std::vector<Done> done() const;
+	void saveTimings(const std::vector<Done> &done) const;
+	void finish() const;
+
+	// worker
+	std::optional<Task> claim() const;
+	void done(const Task &task, double seconds, const std::string &versionStr) const;
+	void failed(const Task &task, const std::string &error) const;
+	bool finished() const;
+private:
+	std::filesystem::path dir(const char *sub) const { return m_dir / sub; }
+	std::vector<std::string> list(const char *sub) const;
+	std::vector<std::string> read(const std::filesystem::path &file) const;
+	void writeTask(const char *sub, const Task &task,
+		       const std::vector<std::string> &extra = {}) const;
+	void moveToFailed(const char *sub, const std::string &name, const std::string &error) const;
+	std::optional<Task> readTask(const char *sub, const std::string &name) const;
+
+	std::filesystem::path m_dir;
+};
+
+} // namespace
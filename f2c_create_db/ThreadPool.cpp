@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+
+#include "ThreadPool.h"
+
+using namespace F2C;
+
+ThreadPool::ThreadPool(unsigned threads) : m_stop(false)
+{
+	if (!threads)
+		threads = defaultThreads();
+
+	m_workers.reserve(threads);
+	for (auto i = 0U; i < threads; ++i)
+		m_workers.emplace_back(&ThreadPool::worker, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard lock(m_lock);
+		m_stop = true;
+	}
+	m_cond.notify_all();
+
+	for (auto &w: m_workers)
+		w.join();
+}
+
+unsigned ThreadPool::defaultThreads()
+{
+	return std::max(1U, std::thread::hardware_concurrency());
+}
+
+void ThreadPool::worker()
+{
+	for (;;) {
+		std::function<void ()> task;
+		{
+			std::unique_lock lock(m_lock);
+			m_cond.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+			if (m_queue.empty())
+				return;
+			task = std::move(m_queue.front());
+			m_queue.pop_front();
+		}
+		task();
+	}
+}
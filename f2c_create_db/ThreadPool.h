@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace F2C {
+
+/**
+ * @brief Fixed set of worker threads executing pushed tasks in FIFO order
+ *
+ * Exceptions thrown by a task are stored in the std::future returned by push() and rethrown
+ * by get(). The destructor finishes all queued tasks before joining the workers.
+ */
+class ThreadPool {
+public:
+	/// @brief @p threads of 0 means one per CPU
+	ThreadPool(unsigned threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	unsigned size() const { return m_workers.size(); }
+
+	template <typename F>
+	auto push(F &&f) -> std::future<std::invoke_result_t<F>> {
+		using R = std::invoke_result_t<F>;
+		auto task = std::make_shared<std::packaged_task<R ()>>(std::forward<F>(f));
+		auto future = task->get_future();
+		{
+			std::lock_guard lock(m_lock);
+			m_queue.emplace_back([task]() { (*task)(); });
+		}
+		m_cond.notify_one();
+		return future;
+	}
+
+	static unsigned defaultThreads();
+private:
+	void worker();
+
+	std::mutex m_lock;
+	std::condition_variable m_cond;
+	std::deque<std::function<void ()>> m_queue;
+	bool m_stop;
+	std::vector<std::thread> m_workers;
+};
+
+} // namespace
@@ -1,9 +1,18 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <memory>
 #include <nlohmann/json.hpp>
+#include <optional>
 #include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 #include <sl/kerncvs/Branches.h>
 #include <sl/git/Git.h>
@@ -16,12 +25,22 @@
 #include <sl/kerncvs/SupportedConf.h>
 #include <sl/sqlite/SQLConn.h>
 
+#include "BlobCache.h"
 #include "F2CSQLConn.h"
 
+#include "parser/ModeCache.h"
 #include "BranchProcessor.h"
+#include "Delta.h"
 #include "Opts.h"
 #include "Renames.h"
+#include "SeekableZstd.h"
+#include "Spool.h"
 #include "StatusNotifier.h"
+#include "ThreadPool.h"
+#include "Verbose.h"
+#include "treewalker/MemorySink.h"
+#include "treewalker/NDJSONSink.h"
+#include "treewalker/SQLiteMakeVisitor.h"
 
 using Clr = SlHelpers::Color;
 using Json = nlohmann::ordered_json;
@@ -43,6 +62,9 @@ std::filesystem::path prepareScratchArea(const Opts &opts)
 		Clr(std::cerr, Clr::YELLOW) << "Neither --dest, nor SCRATCH_AREA defined (defaulting to \"fill-db\")";
 		scratchArea = "fill-db";
 	}
+	// workers may share the filesystem, but not the kernel-source checkout
+	if (opts.worker)
+		scratchArea /= "worker-" + opts.workerId;
 	try {
 		std::filesystem::create_directories(scratchArea);
 	} catch (std::filesystem::filesystem_error &e) {
@@ -98,15 +120,196 @@ F2CSQLConn getSQL(const Opts &opts)
 		RunEx("Cannot open/create the db at ") << opts.sqlite << ": " << sql.lastError() <<
 							  raise;
 
+	// only a db without tables can switch; freed pages are returned by purgeRetired()
+	if (opts.sqliteCreate && !sql.exec("PRAGMA auto_vacuum = INCREMENTAL;"))
+		RunEx("Cannot set auto_vacuum: ") << sql.lastError() << raise;
+
 	if (opts.sqliteCreate && !sql.createDB())
 		RunEx("Cannot create tables: ") << sql.lastError() << raise;
 
 	if (!opts.sqliteCreateOnly && !sql.prepDB())
 		RunEx("Cannot prepare statements: ") << sql.lastError() << raise;
 
+	if (opts.sqliteWAL && !sql.enableWAL(opts.sqliteWALLimit * 1024UL * 1024UL))
+		RunEx("Cannot switch to WAL: ") << sql.lastError() << raise;
+
+	return sql;
+}
+
+/**
+ * @brief Create a fresh db for a shard of the whole db
+ *
+ * It is created under a temporary name, see publishShard().
+ */
+F2CSQLConn openShard(const std::filesystem::path &shard)
+{
+	auto tmp = shard;
+	tmp += ".tmp";
+	std::filesystem::remove(tmp);
+
+	F2CSQLConn sql;
+	if (!sql.openDB(tmp, SlSqlite::OpenFlags::CREATE))
+		RunEx("Cannot create the db at ") << tmp << ": " << sql.lastError() << raise;
+	if (!sql.createDB())
+		RunEx("Cannot create tables: ") << sql.lastError() << raise;
+	if (!sql.prepDB())
+		RunEx("Cannot prepare statements: ") << sql.lastError() << raise;
+
 	return sql;
 }
 
+/// @brief Close @p sql and move it to @p shard, so that only complete shards are merged
+void publishShard(std::optional<F2CSQLConn> &sql, const std::filesystem::path &shard)
+{
+	sql.reset();
+
+	auto tmp = shard;
+	tmp += ".tmp";
+	std::filesystem::rename(tmp, shard);
+}
+
+void syncPath(const std::filesystem::path &path)
+{
+	const auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		RunEx("Cannot open ") << path << ": " << strerror(errno) << raise;
+
+	const auto ret = fsync(fd);
+	const auto err = errno;
+	close(fd);
+	if (ret)
+		RunEx("Cannot sync ") << path << ": " << strerror(err) << raise;
+}
+
+/**
+ * @brief Publish a compacted and analyzed copy of @p sql as --publish
+ *
+ * The copy is written by VACUUM INTO next to the destination and renamed over it. So readers
+ * see either the old or the new db, never a partial one. And the db being built is not
+ * rewritten by a full VACUUM.
+ *
+ * With --publish-deltas, a delta from the previously published db is written to deltas/ next
+ * to it, where f2c_cli looks for them, so that clients need not download the whole db again.
+ * With --publish-zstd, a compressed copy is published along, see SeekableZstd.
+ */
+void publishDB(F2CSQLConn &sql, const Opts &opts)
+{
+	const auto &dest = opts.publish;
+	auto tmp = dest;
+	tmp += ".tmp";
+	std::filesystem::remove(tmp);
+
+	// sqlite_stat1 is copied along
+	if (!sql.exec("ANALYZE;"))
+		RunEx("Cannot ANALYZE the DB: ") << sql.lastError() << raise;
+
+	std::string quoted;
+	for (const auto c: tmp.string()) {
+		if (c == '\'')
+			quoted += '\'';
+		quoted += c;
+	}
+	if (!sql.exec("VACUUM INTO '" + quoted + "';"))
+		RunEx("Cannot VACUUM INTO ") << tmp << ": " << sql.lastError() << raise;
+
+	syncPath(tmp);
+
+	if (opts.publishDeltas) {
+		const auto deltaDir = std::filesystem::absolute(dest).parent_path() / "deltas";
+		if (std::filesystem::exists(dest))
+			Delta::create(dest, tmp, deltaDir);
+		else
+			Delta::reset(tmp, deltaDir);
+	}
+
+	if (opts.publishZstd) {
+		auto zst = dest;
+		zst += ".zst";
+		auto zstTmp = zst;
+		zstTmp += ".tmp";
+		SeekableZstd::compress(tmp, zstTmp);
+		syncPath(zstTmp);
+		std::filesystem::rename(zstTmp, zst);
+	}
+
+	std::filesystem::rename(tmp, dest);
+	syncPath(std::filesystem::absolute(dest).parent_path());
+}
+
+std::filesystem::path shardPath(const Opts &opts, std::string branch)
+{
+	std::replace(branch.begin(), branch.end(), '/', '_');
+	return opts.shardDir / (branch + ".sqlite");
+}
+
+std::filesystem::path renamesShardPath(const Opts &opts)
+{
+	return opts.shardDir / "renames.sqlite";
+}
+
+/**
+ * @brief Versions of the branches of all the shards in --shard-dir
+ *
+ * renames.sqlite is collected for all of them, not only for the branches processed by this
+ * run. Otherwise it would lose the renames of the versions of the other shards.
+ */
+BranchesProps shardsProps(const Opts &opts)
+{
+	BranchesProps ret;
+
+	for (const auto &e: std::filesystem::directory_iterator(opts.shardDir)) {
+		const auto &shard = e.path();
+		if (!e.is_regular_file() || shard.extension() != ".sqlite" ||
+				shard == renamesShardPath(opts))
+			continue;
+
+		F2CSQLConn sql;
+		if (!sql.openDB(shard, SlSqlite::OpenFlags::READ_ONLY))
+			RunEx("Cannot open ") << shard << ": " << sql.lastError() << raise;
+		const auto versions = sql.shardVersions();
+		if (!versions)
+			RunEx("Cannot read versions from ") << shard << ": " << sql.lastError() <<
+								raise;
+		if (versions->empty())
+			Clr(Clr::YELLOW) << "No version in " << shard <<
+					    ", recreate it by -f to collect its renames";
+
+		for (const auto &[branch, version]: *versions)
+			ret.emplace(branch, version);
+	}
+
+	return ret;
+}
+
+/// @brief The sinks storing into @p sql, the memory one walks first and stores afterwards
+std::unique_ptr<TW::ResultSink> getSQLSink(const Opts &opts, F2CSQLConn &sql)
+{
+	auto sqlSink = std::make_unique<TW::SQLiteMakeVisitor>(sql);
+	if (opts.sink == "memory")
+		return std::make_unique<TW::MemorySink>(std::move(sqlSink));
+
+	return sqlSink;
+}
+
+/// @brief @p sql is nullptr in the shard mode, where sqlite sinks are created per branch
+std::unique_ptr<TW::ResultSink> getSink(const Opts &opts, F2CSQLConn *sql,
+				       std::ofstream &ndjson)
+{
+	if (opts.sink == "sqlite" || opts.sink == "memory")
+		return sql ? getSQLSink(opts, *sql) : nullptr;
+	if (opts.sink == "null")
+		return std::make_unique<TW::NullSink>();
+	if (opts.sink == "ndjson") {
+		ndjson.open(opts.sinkFile);
+		if (!ndjson)
+			RunEx("Cannot open ") << opts.sinkFile << ": " << strerror(errno) << raise;
+		return std::make_unique<TW::NDJSONSink>(ndjson);
+	}
+
+	RunEx("Unknown sink: ") << opts.sink << raise;
+	return {};
+}
+
 void fillSupported(F2CSQLConn &sql)
 {
 	for (auto e: SlKernCVS::SupportStateRange{})
@@ -114,8 +317,8 @@ void fillSupported(F2CSQLConn &sql)
 			RunEx("Cannot insert supported: ") << sql.lastError() << raise;
 }
 
-auto obtainBranches(const Opts &opts, const SlGit::Repo &repo,
-		    const std::optional<Json> &configuration)
+SlKernCVS::Branches::BranchesList listBranches(const Opts &opts,
+					       const std::optional<Json> &configuration)
 {
 	SlKernCVS::Branches::BranchesList branches { opts.branches };
 	if (branches.empty()) {
@@ -135,15 +338,27 @@ auto obtainBranches(const Opts &opts, const SlGit::Repo &repo,
 		branches.insert(branches.end(), confBranches.begin(), confBranches.end());
 	}
 
-	if (!opts.noFetch) {
-		Clr(Clr::GREEN) << "== Fetching branches ==";
+	return branches;
+}
+
+void fetchBranches(const SlGit::Repo &repo, const SlKernCVS::Branches::BranchesList &branches)
+{
+	Clr(Clr::GREEN) << "== Fetching branches ==";
 
-		auto remote = repo.remoteLookup("origin");
-		if (!remote)
-			RunEx("No origin").raise();
-		if (!remote->fetchBranches(branches, 1, false))
-			RunEx("Fetch failed: ") << repo.lastError() << raise;
-	}
+	auto remote = repo.remoteLookup("origin");
+	if (!remote)
+		RunEx("No origin").raise();
+	if (!remote->fetchBranches(branches, 1, false))
+		RunEx("Fetch failed: ") << repo.lastError() << raise;
+}
+
+auto obtainBranches(const Opts &opts, const SlGit::Repo &repo,
+		    const std::optional<Json> &configuration)
+{
+	auto branches = listBranches(opts, configuration);
+
+	if (!opts.noFetch)
+		fetchBranches(repo, branches);
 
 	return branches;
 }
@@ -216,7 +431,13 @@ SlKernCVS::LDAPUsers::UserSet loadValidUsers(const Opts &opts)
 bool skipBranch(F2CSQLConn &sql, const std::string &branch, bool force)
 {
 	if (force) {
-		if (!sql.deleteBranch(branch))
+		// BranchProcessor replaces it in the same transaction
+		if (sql.inWAL())
+			return false;
+		// retire it instead of cascading if the DB can, purgeRetired() cleans up
+		const auto retire = sql.retiresBranches();
+		if ((retire && !sql.foreignKeys(false)) || !sql.deleteBranch(branch) ||
+				(retire && !sql.foreignKeys(true)))
 			RunEx("Cannot delete branch '") << branch << "': " << sql.lastError() <<
 							  raise;
 		return false;
@@ -225,12 +446,118 @@ bool skipBranch(F2CSQLConn &sql, const std::string &branch, bool force)
 	return sql.hasBranch(branch);
 }
 
+/// @brief Run this program as a --worker and return its exit status
+int runWorker(int argc, char **argv, unsigned no)
+{
+	std::vector<std::string> args(argv + 1, argv + argc);
+	args.insert(args.end(), { "--worker", "--worker-id", "local-" + std::to_string(no) });
+
+	SlHelpers::Process p;
+	if (!p.spawn("/proc/self/exe", args))
+		RunEx("Cannot start worker ") << no << ": " << p.lastError() << raise;
+	p.waitForFinished();
+
+	return p.exitStatus();
+}
+
+/**
+ * @brief Hand out branches to workers through Spool and wait for them
+ *
+ * --spawn-workers starts local workers, others can be started by hand, also on other hosts
+ * sharing --spool-dir and --shard-dir. Branches of crashed workers are retried once their
+ * claims go stale. Renames of the branches of all the shards are collected in the end.
+ */
+void coordinate(int argc, char **argv, const Opts &opts, const std::optional<Json> &configuration,
+		const SlGit::Repo &lrepo)
+{
+	auto scratchArea = prepareScratchArea(opts);
+	auto branches = listBranches(opts, configuration);
+	std::filesystem::create_directories(opts.shardDir);
+	if (!opts.force)
+		std::erase_if(branches, [&opts](const std::string &branch) {
+			return std::filesystem::exists(shardPath(opts, branch));
+		});
+
+	Spool spool(opts.spoolDir);
+	spool.reset();
+	spool.enqueue(branches);
+
+	Clr(Clr::GREEN) << "== Coordinating " << branches.size() << " branches ==";
+
+	std::vector<std::future<int>> workers;
+	for (auto i = 0U; i < opts.spawnWorkers; ++i)
+		workers.push_back(std::async(std::launch::async, runWorker, argc, argv, i));
+
+	std::vector<Spool::Failed> dead;
+	auto doneCnt = 0U;
+	for (;;) {
+		for (const auto &stale: spool.failStale())
+			Clr(std::cerr, Clr::YELLOW) << stale.branch << ": " << stale.error;
+		for (auto &failed: spool.requeueFailed(opts.retries)) {
+			Clr(std::cerr, Clr::RED) << failed.branch << " failed " <<
+						    failed.attempt + 1 << " times: " << failed.error;
+			dead.push_back(std::move(failed));
+		}
+
+		if (spool.idle())
+			break;
+
+		if (auto cnt = spool.done().size(); cnt != doneCnt) {
+			doneCnt = cnt;
+			Clr(Clr::GREEN) << "== Coordinator -- " << doneCnt << '/' <<
+					   branches.size() << " done ==";
+		}
+
+		if (!workers.empty() && std::all_of(workers.begin(), workers.end(), [](auto &w) {
+				return w.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+			})) {
+			spool.finish();
+			RunEx("All workers exited, but branches remain in ") << opts.spoolDir << raise;
+		}
+
+		std::this_thread::sleep_for(Spool::pollInterval);
+	}
+
+	spool.finish();
+	for (auto i = 0U; i < workers.size(); ++i)
+		if (auto ret = workers[i].get())
+			Clr(std::cerr, Clr::YELLOW) << "Worker " << i << " exited with " << ret;
+
+	const auto done = spool.done();
+	spool.saveTimings(done);
+
+	if (!opts.noRenames && !done.empty()) {
+		Clr(Clr::GREEN) << "== Collecting renames ==";
+
+		const auto branchesProps = shardsProps(opts);
+		ThreadPool pool{opts.jobs};
+		const auto shard = renamesShardPath(opts);
+		std::optional<F2CSQLConn> shardSQL { openShard(shard) };
+		Renames::processRenames(*shardSQL, lrepo, branchesProps, pool, opts.renameJobs,
+					scratchArea / "rename-cache");
+		publishShard(shardSQL, shard);
+	}
+
+	if (!dead.empty()) {
+		std::string failed;
+		for (const auto &d: dead)
+			failed += ' ' + d.branch;
+		RunEx("Failed branches:") << failed << raise;
+	}
+}
+
 void handleEx(int argc, char **argv)
 {
 	const auto opts = Opts::getOpts(argc, argv);
 
+	if ((opts.coordinator || opts.worker) && (opts.spoolDir.empty() || opts.shardDir.empty()))
+		RunEx("--coordinator and --worker need --spool-dir and --shard-dir").raise();
+	if (!opts.publish.empty() && !opts.shardDir.empty())
+		RunEx("--publish cannot be used with --shard-dir, see f2c_merge_db").raise();
+	if ((opts.publishDeltas || opts.publishZstd) && opts.publish.empty())
+		RunEx("--publish-deltas and --publish-zstd need --publish").raise();
+
 	auto configuration = loadConfiguration(opts);
-	auto validUsers = loadValidUsers(opts);
 
 	const auto lpath = SlHelpers::Env::get<std::filesystem::path>("LINUX_GIT");
 	if (!lpath)
@@ -242,39 +569,159 @@ void handleEx(int argc, char **argv)
 							 " (" << SlGit::Repo::lastClass() << ')' <<
 							 raise;
 
+	// spawned workers get --worker appended to the arguments of the coordinator
+	if (opts.coordinator && !opts.worker) {
+		coordinate(argc, argv, opts, configuration, *lrepo);
+		return;
+	}
+
+	auto validUsers = loadValidUsers(opts);
+
 	Clr(Clr::GREEN) << "== Preparing trees ==";
 
 	auto scratchArea = prepareScratchArea(opts);
 	auto repo = prepareKsourceGit(scratchArea);
-	auto branches = obtainBranches(opts, repo, configuration);
-	auto sql = getSQL(opts);
-	fillSupported(sql);
+	// workers fetch only the branches they claim
+	auto branches = opts.worker ? SlKernCVS::Branches::BranchesList{} :
+				      obtainBranches(opts, repo, configuration);
+	const auto sharded = !opts.shardDir.empty();
+	std::optional<F2CSQLConn> sql;
+	if (sharded) {
+		std::filesystem::create_directories(opts.shardDir);
+	} else {
+		sql = getSQL(opts);
+		fillSupported(*sql);
+	}
+	std::ofstream ndjson;
+	auto sink = getSink(opts, sql ? &*sql : nullptr, ndjson);
+	ThreadPool pool{opts.jobs};
+	BlobCache blobCache{scratchArea / "blob-cache"};
 
-	auto branchNo = 0U;
-	auto branchCnt = branches.size();
+	auto &modeCache = Parsers::ModeCache::get();
+	const auto modeCacheFile = scratchArea / "parser-modes.cache";
+	modeCache.load(modeCacheFile);
 
 	BranchesProps branchesProps;
-	for (const auto &branch: branches) {
-		StatusNotifier notifier(branch, ++branchNo, branchCnt);
+	auto processBranch = [&](const std::string &branch, unsigned branchNo, unsigned branchCnt,
+				 bool force) {
+		StatusNotifier notifier(branch, branchNo, branchCnt);
 
 		notifier.notify("Starting");
-		if (skipBranch(sql, branch, opts.force)) {
+		const auto shard = sharded ? shardPath(opts, branch) : std::filesystem::path();
+		if (sharded ? !force && std::filesystem::exists(shard) :
+				skipBranch(*sql, branch, force)) {
 			Clr(Clr::YELLOW) << "Already present, skipping, use -f to force re-creation";
-			continue;
+			return;
+		}
+
+		std::optional<F2CSQLConn> shardSQL;
+		std::unique_ptr<TW::ResultSink> shardSink;
+		if (sharded) {
+			shardSQL = openShard(shard);
+			fillSupported(*shardSQL);
+			if (!sink)
+				shardSink = getSQLSink(opts, *shardSQL);
 		}
 
-		BranchProcessor bp{branch, notifier, scratchArea, branchesProps, repo, sql, opts,
-			configuration, validUsers};
+		BranchProcessor bp{branch, notifier, scratchArea, branchesProps, repo,
+			shardSQL ? *shardSQL : *sql, shardSink ? *shardSink : *sink,
+			pool, blobCache, opts, configuration, validUsers};
 
 		bp.process();
+
+		if (sharded) {
+			shardSink.reset();
+			if (!shardSQL->insertShardVersion(branch, branchesProps.at(branch).versionStr))
+				RunEx("Cannot store the version of the shard: ") <<
+					shardSQL->lastError() << raise;
+			publishShard(shardSQL, shard);
+		} else if (!sql->checkpoint()) {
+			RunEx("Cannot checkpoint the DB: ") << sql->lastError() << raise;
+		}
+
+		if (!modeCache.save(modeCacheFile))
+			Clr(Clr::YELLOW) << "Cannot save " << modeCacheFile;
+	};
+
+	if (opts.worker) {
+		Spool spool(opts.spoolDir);
+		for (;;) {
+			auto task = spool.claim();
+			if (!task) {
+				if (spool.finished())
+					break;
+				std::this_thread::sleep_for(Spool::pollInterval);
+				continue;
+			}
+
+			const auto start = std::chrono::steady_clock::now();
+			try {
+				Spool::Heartbeat heartbeat(spool, *task);
+				if (!opts.noFetch)
+					fetchBranches(repo, { task->branch });
+				// the coordinator queued only branches to be (re)created
+				processBranch(task->branch, task->no, task->cnt, true);
+			} catch (const std::runtime_error &e) {
+				Clr(std::cerr, Clr::RED) << task->branch << ": " << e.what();
+				spool.failed(*task, e.what());
+				continue;
+			}
+			const std::chrono::duration<double> elapsed =
+				std::chrono::steady_clock::now() - start;
+			spool.done(*task, elapsed.count(), branchesProps.at(task->branch).versionStr);
+		}
+	} else {
+		auto branchNo = 0U;
+		for (const auto &branch: branches)
+			processBranch(branch, ++branchNo, branches.size(), opts.force);
+	}
+
+	// rows of the branches replaced by -f
+	if (sql && (!sql->purgeRetired() || !sql->checkpoint()))
+		RunEx("Cannot purge replaced branches: ") << sql->lastError() << raise;
+
+	if (F2C::verbose) {
+		const auto &stats = modeCache.stats();
+		std::cout << "Parser modes: SLL=" << stats.sll.load() <<
+			     " SLL->LL=" << stats.sllFailed.load() <<
+			     " cached LL=" << stats.llCached.load() <<
+			     " forced LL=" << stats.llForced.load() <<
+			     " SLL hit rate=" << modeCache.sllHitRate() * 100 << "%\n";
 	}
 
+	// renames are collected by the coordinator
+	if (opts.worker)
+		return;
+
 	if (!opts.noRenames) {
 		Clr(Clr::GREEN) << "== Collecting renames ==";
-		Renames::processRenames(sql, *lrepo, branchesProps);
+		if (sharded) {
+			// keep the old renames if no branch was processed
+			if (branchesProps.empty())
+				return;
+
+			const auto allProps = shardsProps(opts);
+			const auto shard = renamesShardPath(opts);
+			std::optional<F2CSQLConn> shardSQL { openShard(shard) };
+			Renames::processRenames(*shardSQL, *lrepo, allProps, pool,
+						opts.renameJobs, scratchArea / "rename-cache");
+			publishShard(shardSQL, shard);
+			return;
+		}
+
+		Renames::processRenames(*sql, *lrepo, branchesProps, pool, opts.renameJobs,
+					scratchArea / "rename-cache");
+		if (!sql->checkpoint())
+			RunEx("Cannot checkpoint the DB: ") << sql->lastError() << raise;
+	}
 
-		if (!sql.exec("VACUUM;"))
-			RunEx("Cannot VACUUM the DB: ") << sql.lastError() << raise;
+	if (!opts.publish.empty()) {
+		Clr(Clr::GREEN) << "== Publishing to " << opts.publish << " ==";
+		publishDB(*sql, opts);
+	} else if (!opts.noRenames && !opts.sqliteWAL) {
+		// VACUUM would pass the whole db through the WAL
+		if (!sql->exec("VACUUM;"))
+			RunEx("Cannot VACUUM the DB: ") << sql->lastError() << raise;
 	}
 }
 
@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MMapCharStream.h"
+
+using namespace Parsers;
+
+/// @brief Map @p file, nullptr on failure with errno set
+std::unique_ptr<MMapCharStream> MMapCharStream::open(const std::filesystem::path &file)
+{
+	auto fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		auto err = errno;
+		close(fd);
+		errno = err;
+		return nullptr;
+	}
+
+	const size_t size = st.st_size;
+	const char *data = nullptr;
+	if (size) {
+		auto map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			auto err = errno;
+			close(fd);
+			errno = err;
+			return nullptr;
+		}
+		data = static_cast<const char *>(map);
+	}
+	close(fd);
+
+	return std::unique_ptr<MMapCharStream>(new MMapCharStream(data, size, file.string()));
+}
+
+MMapCharStream::~MMapCharStream()
+{
+	if (m_size)
+		munmap(const_cast<char *>(m_data), m_size);
+}
+
+bool MMapCharStream::isASCII() const
+{
+	for (const auto &c: view())
+		if (static_cast<unsigned char>(c) & 0x80)
+			return false;
+
+	return true;
+}
+
+void MMapCharStream::consume()
+{
+	if (m_pos >= m_size)
+		throw antlr4::IllegalStateException("cannot consume EOF");
+
+	m_pos++;
+}
+
+/// @brief Same semantics as antlr4::ANTLRInputStream::LA()
+size_t MMapCharStream::LA(ssize_t i)
+{
+	if (!i)
+		return 0;
+
+	auto pos = static_cast<ssize_t>(m_pos);
+	if (i < 0) {
+		i++;
+		if (pos + i - 1 < 0)
+			return antlr4::IntStream::EOF;
+	}
+
+	if (pos + i - 1 >= static_cast<ssize_t>(m_size))
+		return antlr4::IntStream::EOF;
+
+	return static_cast<unsigned char>(m_data[pos + i - 1]);
+}
+
+void MMapCharStream::seek(size_t index)
+{
+	if (index <= m_pos) {
+		m_pos = index;
+		return;
+	}
+
+	m_pos = std::min(index, m_size);
+}
+
+std::string MMapCharStream::getText(const antlr4::misc::Interval &interval)
+{
+	if (interval.a < 0 || interval.b < 0)
+		return {};
+
+	size_t start = interval.a;
+	size_t stop = interval.b;
+	if (stop >= m_size)
+		stop = m_size - 1;
+	if (start >= m_size || start > stop)
+		return {};
+
+	return std::string(m_data + start, stop - start + 1);
+}
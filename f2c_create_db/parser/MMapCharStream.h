@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+#include <antlr4-runtime.h>
+
+namespace Parsers {
+
+/**
+ * @brief Read-only mapping of a file serving as an ANTLR char stream
+ *
+ * Unlike antlr4::ANTLRInputStream, the content is neither copied nor decoded to UTF-32. Every
+ * byte is one symbol, so this is usable only for ASCII input, see isASCII().
+ */
+class MMapCharStream : public antlr4::CharStream {
+public:
+	MMapCharStream() = delete;
+	MMapCharStream(const MMapCharStream &) = delete;
+	MMapCharStream &operator=(const MMapCharStream &) = delete;
+	~MMapCharStream();
+
+	static std::unique_ptr<MMapCharStream> open(const std::filesystem::path &file);
+
+	std::string_view view() const { return { m_data, m_size }; }
+	bool isASCII() const;
+
+	virtual void consume() override;
+	virtual size_t LA(ssize_t i) override;
+	virtual ssize_t mark() override { return -1; }
+	virtual void release(ssize_t) override {}
+	virtual size_t index() override { return m_pos; }
+	virtual void seek(size_t index) override;
+	virtual size_t size() override { return m_size; }
+	virtual std::string getSourceName() const override { return m_name; }
+	virtual std::string getText(const antlr4::misc::Interval &interval) override;
+	virtual std::string toString() const override { return std::string(view()); }
+private:
+	MMapCharStream(const char *data, size_t size, std::string name) :
+		m_data(data), m_size(size), m_pos(0), m_name(std::move(name)) {}
+
+	const char *m_data;
+	size_t m_size;
+	size_t m_pos;
+	std::string m_name;
+};
+
+}
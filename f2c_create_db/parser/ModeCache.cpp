@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <fstream>
+#include <sstream>
+
+#include "../AtomicFile.h"
+#include "ModeCache.h"
+
+using namespace Parsers;
+
+ModeCache &ModeCache::get()
+{
+	static ModeCache cache;
+	return cache;
+}
+
+/// @brief 64-bit FNV-1a, so that the persisted hashes do not depend on the std library
+uint64_t ModeCache::hash(std::string_view content)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (const auto &c: content) {
+		h ^= static_cast<unsigned char>(c);
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+std::string ModeCache::key(std::string_view grammar, uint64_t hash)
+{
+	std::ostringstream ss;
+	ss << grammar << ' ' << std::hex << hash;
+	return ss.str();
+}
+
+/**
+ * @brief Load the cache saved by save()
+ *
+ * The format is one "grammar hash path" line per input which needed LL.
+ */
+bool ModeCache::load(const std::filesystem::path &file)
+{
+	std::ifstream ifs(file);
+	if (!ifs)
+		return false;
+
+	std::lock_guard lock(m_lock);
+	for (std::string line; std::getline(ifs, line); ) {
+		std::istringstream ss(line);
+		std::string grammar;
+		uint64_t hash;
+		std::string path;
+		if (!(ss >> grammar >> std::hex >> hash))
+			continue;
+		ss >> std::ws;
+		std::getline(ss, path);
+		m_needLL.insert_or_assign(key(grammar, hash), std::move(path));
+	}
+
+	return true;
+}
+
+bool ModeCache::save(const std::filesystem::path &file) const
+{
+	return F2C::AtomicFile::tryWrite(file, [this](std::ostream &os) {
+		std::lock_guard lock(m_lock);
+		for (const auto &[key, path]: m_needLL)
+			os << key << ' ' << path << '\n';
+	});
+}
+
+bool ModeCache::needsLL(std::string_view grammar, uint64_t hash) const
+{
+	std::lock_guard lock(m_lock);
+	return m_needLL.contains(key(grammar, hash));
+}
+
+void ModeCache::store(std::string_view grammar, uint64_t hash, const std::string &path,
+		      bool needsLL)
+{
+	std::lock_guard lock(m_lock);
+	if (needsLL)
+		m_needLL.insert_or_assign(key(grammar, hash), path);
+	else
+		m_needLL.erase(key(grammar, hash));
+}
+
+double ModeCache::sllHitRate() const
+{
+	const auto sll = m_stats.sll.load();
+	const auto tried = sll + m_stats.sllFailed.load();
+
+	return tried ? static_cast<double>(sll) / tried : 1.0;
+}
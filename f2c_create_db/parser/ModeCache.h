@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace Parsers {
+
+/**
+ * @brief Remembers which inputs needed LL prediction, so they can skip the SLL attempt
+ *
+ * The entries are keyed by the grammar and a hash of the content. The path is stored only to
+ * make the file readable, so that the same Kbuild in different branches shares one entry.
+ * The cache is shared by all parsers and threads, use get().
+ */
+class ModeCache {
+public:
+	struct Stats {
+		std::atomic<unsigned> sll;
+		std::atomic<unsigned> sllFailed;
+		std::atomic<unsigned> llCached;
+		std::atomic<unsigned> llForced;
+	};
+
+	static ModeCache &get();
+
+	static uint64_t hash(std::string_view content);
+
+	bool load(const std::filesystem::path &file);
+	bool save(const std::filesystem::path &file) const;
+
+	bool needsLL(std::string_view grammar, uint64_t hash) const;
+	void store(std::string_view grammar, uint64_t hash, const std::string &path,
+		   bool needsLL);
+
+	Stats &stats() { return m_stats; }
+	/// @brief Ratio of the inputs parsed by the first SLL attempt
+	double sllHitRate() const;
+private:
+	ModeCache() : m_stats{} {}
+
+	static std::string key(std::string_view grammar, uint64_t hash);
+
+	mutable std::mutex m_lock;
+	/// @brief key() -> path
+	std::unordered_map<std::string, std::string> m_needLL;
+	Stats m_stats;
+};
+
+}
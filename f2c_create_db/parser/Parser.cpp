@@ -7,6 +7,8 @@
 #include <sl/helpers/String.h>
 
 #include "ErrorListener.h"
+#include "MMapCharStream.h"
+#include "ModeCache.h"
 #include "Parser.h"
 #include "../Verbose.h"
 #include "kconfig/KconfigLexer.h"
@@ -18,15 +20,31 @@ using namespace Parsers;
 
 using Clr = SlHelpers::Color;
 
+namespace {
+
+/// @brief Gives access to the tracker owning all the tree nodes created by the parser
+template<class AParser>
+class ReusableParser : public AParser {
+public:
+	using AParser::AParser;
+
+	void releaseTrees() { this->_tracker.reset(); }
+};
+
+} // namespace
+
 template<class ALexer, class AParser>
-Parser<ALexer, AParser>::Parser() {}
+Parser<ALexer, AParser>::Parser() : m_tree(nullptr),
+	m_errorListener(std::make_unique<ErrorListener>()) {}
 
 template<class ALexer, class AParser>
 Parser<ALexer, AParser>::~Parser() {}
 
 template<class ALexer, class AParser>
-bool Parser<ALexer, AParser>::parseSLL()
+bool Parser<ALexer, AParser>::parseSLL(bool &neededLL)
 {
+	auto &stats = ModeCache::get().stats();
+
 	auto origErrStrategy = m_parser->getErrorHandler();
 	m_parser->setErrorHandler(std::make_shared<antlr4::BailErrorStrategy>());
 
@@ -35,10 +53,15 @@ bool Parser<ALexer, AParser>::parseSLL()
 	interp->setPredictionMode(antlr4::atn::PredictionMode::SLL);
 	try {
 		m_tree = getTree();
+		stats.sll++;
+		neededLL = false;
 		return true;
 	} catch (antlr4::ParseCancellationException &) {
 	}
 
+	stats.sllFailed++;
+	neededLL = true;
+
 	if (F2C::verbose)
 		Clr(std::cerr, Clr::YELLOW) << m_lexer->getSourceName() <<
 			": SLL not enough, trying LL";
@@ -57,9 +80,9 @@ bool Parser<ALexer, AParser>::parseLL()
 {
 	m_lexer->removeErrorListeners();
 	m_parser->removeErrorListeners();
-	Parsers::ErrorListener EL;
-	m_lexer->addErrorListener(&EL);
-	m_parser->addErrorListener(&EL);
+	// stays registered until the next setInput()
+	m_lexer->addErrorListener(m_errorListener.get());
+	m_parser->addErrorListener(m_errorListener.get());
 
 	try {
 		m_tree = getTree();
@@ -76,42 +99,93 @@ bool Parser<ALexer, AParser>::parseLL()
 	return true;
 }
 
+/**
+ * @brief Point the lexer to @p input, creating or resetting the ANTLR objects
+ *
+ * Resetting is much cheaper than creating the objects for every input. But the previous tree
+ * and all the settings parseSLL() and parseLL() did have to go.
+ */
 template<class ALexer, class AParser>
-bool Parser<ALexer, AParser>::parse(antlr4::ANTLRInputStream &is, bool trySLL)
+void Parser<ALexer, AParser>::setInput(std::unique_ptr<antlr4::CharStream> input)
 {
-	m_lexer = std::make_unique<ALexer>(&is);
-	m_tokens = std::make_unique<antlr4::CommonTokenStream>(m_lexer.get());
-	m_parser = std::make_unique<AParser>(m_tokens.get());
+	m_tree = nullptr;
+
+	if (!m_parser) {
+		m_lexer = std::make_unique<ALexer>(input.get());
+		m_tokens = std::make_unique<antlr4::CommonTokenStream>(m_lexer.get());
+		m_parser = std::make_unique<ReusableParser<AParser>>(m_tokens.get());
+		m_input = std::move(input);
+		return;
+	}
 
-	if (trySLL)
-		return parseSLL();
+	static_cast<ReusableParser<AParser> *>(m_parser.get())->releaseTrees();
+	m_lexer->setInputStream(input.get());
+	m_tokens->setTokenSource(m_lexer.get());
+	m_parser->setTokenStream(m_tokens.get());
+	// nothing refers to the previous input now
+	m_input = std::move(input);
 
-	return parseLL();
+	m_lexer->removeErrorListeners();
+	m_lexer->addErrorListener(&antlr4::ConsoleErrorListener::INSTANCE);
+	m_parser->removeErrorListeners();
+	m_parser->addErrorListener(&antlr4::ConsoleErrorListener::INSTANCE);
+	m_parser->setErrorHandler(std::make_shared<antlr4::DefaultErrorStrategy>());
+	auto interp = m_parser->template getInterpreter<antlr4::atn::ParserATNSimulator>();
+	interp->setPredictionMode(antlr4::atn::PredictionMode::LL);
+}
+
+template<class ALexer, class AParser>
+bool Parser<ALexer, AParser>::parse(std::unique_ptr<antlr4::CharStream> input, bool trySLL)
+{
+	setInput(std::move(input));
+
+	auto &cache = ModeCache::get();
+	if (!trySLL) {
+		cache.stats().llForced++;
+		return parseLL();
+	}
+
+	// files known to need LL would pay for two parses
+	const auto grammar = m_parser->getGrammarFileName();
+	if (m_contentHash && cache.needsLL(grammar, *m_contentHash)) {
+		cache.stats().llCached++;
+		return parseLL();
+	}
+
+	bool neededLL;
+	auto ret = parseSLL(neededLL);
+	if (m_contentHash)
+		cache.store(grammar, *m_contentHash, m_input->getSourceName(), neededLL);
+
+	return ret;
 }
 
 template<class ALexer, class AParser>
 bool Parser<ALexer, AParser>::parse(std::string_view str, bool trySLL)
 {
-	m_input = std::make_unique<antlr4::ANTLRInputStream>(str);
+	m_contentHash.reset();
 
-	return parse(*m_input.get(), trySLL);
+	return parse(std::make_unique<antlr4::ANTLRInputStream>(str), trySLL);
 }
 
 template<class ALexer, class AParser>
 bool Parser<ALexer, AParser>::parse(const std::filesystem::path &file, bool trySLL)
 {
-	std::ifstream ifs;
-
-	ifs.open(file);
-	if (!ifs) {
+	auto mmap = MMapCharStream::open(file);
+	if (!mmap) {
 		std::cerr << "cannot read " << file.string() << ": " << strerror(errno) << "\n";
 		return false;
 	}
 
-	m_input = std::make_unique<antlr4::ANTLRInputStream>(ifs);
-	m_input->name = file.string();
+	m_contentHash = ModeCache::hash(mmap->view());
+	if (mmap->isASCII())
+		return parse(std::move(mmap), trySLL);
+
+	// UTF-8 has to be decoded
+	auto input = std::make_unique<antlr4::ANTLRInputStream>(mmap->view());
+	input->name = file.string();
 
-	return parse(*m_input.get(), trySLL);
+	return parse(std::move(input), trySLL);
 }
 
 template<class ALexer, class AParser>
@@ -2,17 +2,27 @@
 
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
 #include <memory>
+#include <optional>
 
 namespace antlr4 {
-class ANTLRInputStream;
+class CharStream;
 class CommonTokenStream;
 class ParserRuleContext;
 }
 
 namespace Parsers {
 
+class ErrorListener;
+
+/**
+ * @brief ANTLR lexer and parser of one grammar
+ *
+ * The lexer, token stream and parser are created by the first parse() and reused for all the
+ * following inputs. Only the tree of the last input is kept.
+ */
 template <class ALexer, class AParser>
 class Parser {
 public:
@@ -24,17 +34,22 @@ public:
 	void reset();
 
 protected:
-	bool parseSLL();
+	bool parseSLL(bool &neededLL);
 	bool parseLL();
-	bool parse(antlr4::ANTLRInputStream &is, bool trySLL);
+	void setInput(std::unique_ptr<antlr4::CharStream> input);
+	bool parse(std::unique_ptr<antlr4::CharStream> input, bool trySLL);
 
 	virtual antlr4::ParserRuleContext *getTree() = 0;
 
 	antlr4::ParserRuleContext *m_tree;
-	std::unique_ptr<antlr4::ANTLRInputStream> m_input;
+	/// @brief Key to ModeCache, set only when parsing a file
+	std::optional<uint64_t> m_contentHash;
+	std::unique_ptr<antlr4::CharStream> m_input;
 	std::unique_ptr<ALexer> m_lexer;
 	std::unique_ptr<antlr4::CommonTokenStream> m_tokens;
 	std::unique_ptr<AParser> m_parser;
+	/// @brief Not shared, parsers run in parallel
+	std::unique_ptr<ErrorListener> m_errorListener;
 };
 
 }
@@ -47,4 +47,13 @@ public:
 
 using ConfigRange = SlHelpers::EnumRange<ConfType>;
 
+/// @brief One source/rsource/osource/orsource directive
+struct Source {
+	std::string path;
+	/// @brief rsource: relative to the directory of the current file, not to srctree
+	bool relative;
+	/// @brief osource: the file need not exist
+	bool optional;
+};
+
 } // namespace
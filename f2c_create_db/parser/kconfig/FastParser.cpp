@@ -0,0 +1,374 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <fstream>
+
+#include "FastParser.h"
+
+using namespace Kconfig;
+
+namespace {
+
+constexpr bool isWS(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+constexpr bool isIdChar(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+		c == '_';
+}
+
+/// @brief Characters of the longest token in KconfigLexer, i.e. SOURCE
+constexpr bool isRunChar(char c)
+{
+	return isIdChar(c) || c == '.' || c == '/' || c == '-';
+}
+
+size_t skipWS(std::string_view line, size_t pos)
+{
+	while (pos < line.size() && isWS(line[pos]))
+		++pos;
+	return pos;
+}
+
+std::string_view scanRun(std::string_view line, size_t &pos)
+{
+	const auto start = pos;
+	while (pos < line.size() && isRunChar(line[pos]))
+		++pos;
+	return line.substr(start, pos - start);
+}
+
+/// @brief Indentation as computed by getIndent() in KconfigLexer
+unsigned getIndent(std::string_view line, size_t &pos)
+{
+	unsigned indent = 0;
+	for (pos = 0; pos < line.size(); ++pos) {
+		if (line[pos] == ' ')
+			indent++;
+		else if (line[pos] == '\t')
+			indent = (indent & ~7) + 8;
+		else
+			break;
+	}
+	return indent;
+}
+
+bool consume(std::string_view &str, std::string_view prefix)
+{
+	if (!str.starts_with(prefix))
+		return false;
+	str.remove_prefix(prefix.size());
+	return true;
+}
+
+std::string_view trimWS(std::string_view str)
+{
+	str.remove_prefix(skipWS(str, 0));
+	return str;
+}
+
+/// @brief Is the rest of the line the Help token of KconfigLexer?
+bool isHelp(std::string_view rest)
+{
+	if (!consume(rest, "help")) {
+		// old kernels: --- help ---
+		if (!consume(rest, "---"))
+			return false;
+		rest = trimWS(rest);
+		if (!consume(rest, "help"))
+			return false;
+		rest = trimWS(rest);
+		if (!consume(rest, "---"))
+			return false;
+	}
+
+	return trimWS(rest).empty();
+}
+
+/**
+ * @brief Skip the rest of a line like KconfigLexer would
+ *
+ * Strings and $(...) have to end on the same line. Sets @p continued if the line ends with a
+ * backslash.
+ */
+bool skipRest(std::string_view line, size_t pos, bool &continued)
+{
+	while (pos < line.size()) {
+		switch (line[pos]) {
+		case '#':
+			return true;
+		case '"':
+			for (++pos; pos < line.size() && line[pos] != '"'; ++pos)
+				if (line[pos] == '\\' && pos + 1 < line.size() && line[pos + 1] == '"')
+					++pos;
+			if (pos >= line.size())
+				return false;
+			++pos;
+			break;
+		case '\'':
+			pos = line.find('\'', pos + 1);
+			if (pos == line.npos)
+				return false;
+			++pos;
+			break;
+		case '\\': {
+			// \# for old kernels, or a continuation
+			auto p = pos + 1;
+			while (p < line.size() && line[p] == '\\')
+				++p;
+			if (p < line.size() && line[p] == '#')
+				return true;
+			while (p < line.size() && line[p] == ' ')
+				++p;
+			if (p < line.size())
+				return false;
+			continued = true;
+			return true;
+		}
+		case '$':
+			if (pos + 1 < line.size() && line[pos + 1] == '(') {
+				unsigned nest = 0;
+				for (pos += 2; ; ++pos) {
+					if (pos >= line.size())
+						return false;
+					if (line[pos] == '\'') {
+						pos = line.find('\'', pos + 1);
+						if (pos == line.npos)
+							return false;
+					} else if (line[pos] == '(') {
+						nest++;
+					} else if (line[pos] == ')') {
+						if (!nest)
+							break;
+						nest--;
+					}
+				}
+			}
+			++pos;
+			break;
+		default:
+			++pos;
+			break;
+		}
+	}
+
+	return true;
+}
+
+ConfType typeKeyword(std::string_view word)
+{
+	static constexpr const struct {
+		std::string_view keyword;
+		ConfType type;
+	} types[] = {
+		{ "bool", ConfType::Bool },
+		{ "boolean", ConfType::Bool },
+		{ "tristate", ConfType::Tristate },
+		{ "def_bool", ConfType::DefBool },
+		{ "def_boolean", ConfType::DefBool },
+		{ "def_tristate", ConfType::DefTristate },
+		{ "int", ConfType::Int },
+		{ "hex", ConfType::Hex },
+		{ "string", ConfType::String },
+	};
+
+	for (const auto &t: types)
+		if (word == t.keyword)
+			return t.type;
+
+	return ConfType::Unknown;
+}
+
+/// @brief Keywords starting a config_line without a type
+bool isConfigLine(std::string_view word)
+{
+	static constexpr const std::string_view keywords[] = {
+		"prompt", "default", "select", "imply", "range", "depends", "modules", "option",
+		"transitional",
+	};
+
+	for (const auto &k: keywords)
+		if (word == k)
+			return true;
+
+	return false;
+}
+
+} // namespace
+
+bool FastParser::parse(const std::filesystem::path &file)
+{
+	std::ifstream ifs(file, std::ios::binary | std::ios::ate);
+	if (!ifs)
+		return false;
+
+	const auto size = ifs.tellg();
+	if (size < 0)
+		return false;
+
+	m_buf.resize(size);
+	ifs.seekg(0);
+	if (!ifs.read(m_buf.data(), m_buf.size()))
+		return false;
+
+	return parseBuffer();
+}
+
+bool FastParser::parse(std::string_view str)
+{
+	m_buf.assign(str);
+
+	return parseBuffer();
+}
+
+bool FastParser::parseBuffer()
+{
+	m_entries.clear();
+	m_inConfig = m_typed = false;
+	m_inHelp = false;
+
+	if (m_buf.find('\r') != m_buf.npos)
+		return false;
+
+	std::string_view buf { m_buf };
+	auto continued = false;
+	for (;;) {
+		auto nl = buf.find('\n');
+		auto line = buf.substr(0, nl);
+		if (!m_inHelp || !skipHelp(line))
+			if (!parseLine(line, continued))
+				return false;
+		if (nl == buf.npos)
+			break;
+		buf.remove_prefix(nl + 1);
+	}
+
+	return true;
+}
+
+/**
+ * @brief Mimic HELP_MODE of KconfigLexer
+ *
+ * The help text ends by a line indented less than its first line, or by a non-indented line
+ * unless that one immediately follows the help keyword.
+ *
+ * @return true if @p line belongs to the help text
+ */
+bool FastParser::skipHelp(std::string_view line)
+{
+	const auto helpStart = m_helpStart;
+	m_helpStart = false;
+
+	size_t pos;
+	auto indent = getIndent(line, pos);
+	if (pos == line.size())
+		return true;
+
+	if ((!indent && !helpStart) || (m_helpIndent && indent < m_helpIndent)) {
+		m_inHelp = false;
+		return false;
+	}
+
+	if (!m_helpIndent)
+		m_helpIndent = indent;
+
+	return true;
+}
+
+bool FastParser::parseLine(std::string_view line, bool &continued)
+{
+	auto pos = skipWS(line, 0);
+
+	if (continued) {
+		continued = false;
+		return skipRest(line, pos, continued);
+	}
+
+	const auto rest = line.substr(pos);
+	auto word = scanRun(line, pos);
+
+	if (word.starts_with("help") || word.starts_with("---")) {
+		if (!isHelp(rest))
+			return false;
+		m_inHelp = m_helpStart = true;
+		m_helpIndent = 0;
+		return true;
+	}
+
+	if (word == "source" || word == "rsource" || word == "osource" || word == "orsource") {
+		m_inConfig = false;
+		if (!parseSource(line, pos, word))
+			return false;
+	} else if (word == "config" || word == "menuconfig") {
+		if (pos >= line.size() || !isWS(line[pos]))
+			return false;
+		pos = skipWS(line, pos);
+		auto name = scanRun(line, pos);
+		if (name.empty())
+			return false;
+		for (const auto &c: name)
+			if (!isIdChar(c))
+				return false;
+		m_config = name;
+		m_inConfig = true;
+		m_typed = false;
+	} else if (auto type = typeKeyword(word); type != ConfType::Unknown) {
+		/*
+		 * Some configs are declared somewhere and its value defined elsewhere.
+		 * Like ARCH_MMAP_RND_BITS_MIN.
+		 */
+		if (m_inConfig && !m_typed) {
+			m_entries.emplace_back(std::in_place_index<0>, m_config, type);
+			m_typed = true;
+		}
+	} else if (!word.empty() && !isConfigLine(word)) {
+		m_inConfig = false;
+	}
+
+	return skipRest(line, pos, continued);
+}
+
+/// @brief Store source "path", or its old kernels' variant: source path
+bool FastParser::parseSource(std::string_view line, size_t &pos, std::string_view keyword)
+{
+	if (pos >= line.size() || !isWS(line[pos]))
+		return false;
+	pos = skipWS(line, pos);
+
+	std::string_view path;
+	if (pos < line.size() && (line[pos] == '"' || line[pos] == '\'')) {
+		auto end = line.find(line[pos], pos + 1);
+		if (end == line.npos)
+			return false;
+		path = line.substr(pos + 1, end - pos - 1);
+		pos = end + 1;
+	} else {
+		path = scanRun(line, pos);
+	}
+
+	if (path.empty())
+		return false;
+
+	keyword.remove_suffix(std::string_view("source").size());
+	m_entries.emplace_back(Source {
+		.path = std::string(path),
+		.relative = keyword.ends_with('r'),
+		.optional = keyword.starts_with('o'),
+	});
+
+	return true;
+}
+
+void FastParser::walk(const ConfigCB &configCB, const SourceCB &sourceCB) const
+{
+	for (const auto &entry: m_entries) {
+		if (const auto config = std::get_if<0>(&entry)) {
+			if (configCB)
+				configCB(std::string(config->first), config->second);
+		} else if (sourceCB) {
+			sourceCB(std::get<Source>(entry));
+		}
+	}
+}
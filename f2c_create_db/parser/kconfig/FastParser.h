@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "Config.h"
+
+namespace Kconfig {
+
+/**
+ * @brief Line-oriented scanner of config symbols and their types
+ *
+ * It extracts only what KconfigParserConfigListener does: the name of each config/menuconfig
+ * and the first type keyword in its body, and source directives. Help texts are skipped with the indentation rules
+ * of KconfigLexer. parse() returns false for anything it cannot reliably skip (multi-line
+ * strings and $(...), stray backslashes, ...) and the caller shall fall back to ANTLR then.
+ */
+class FastParser {
+public:
+	using ConfigCB = std::function<void (std::string config, ConfType type)>;
+	using SourceCB = std::function<void (Source source)>;
+
+	FastParser() {}
+
+	bool parse(const std::filesystem::path &file);
+	bool parse(std::string_view str);
+
+	void walk(const ConfigCB &configCB, const SourceCB &sourceCB) const;
+private:
+	bool parseBuffer();
+	bool skipHelp(std::string_view line);
+	bool parseLine(std::string_view line, bool &continued);
+	bool parseSource(std::string_view line, size_t &pos, std::string_view keyword);
+
+	/// @brief A config with its type, or a source directive
+	using Entry = std::variant<std::pair<std::string_view, ConfType>, Source>;
+
+	std::string m_buf;
+	/// @brief In the order of the file, as the ANTLR listener reports them
+	std::vector<Entry> m_entries;
+
+	std::string_view m_config;
+	bool m_inConfig;
+	bool m_typed;
+
+	bool m_inHelp;
+	bool m_helpStart;
+	unsigned m_helpIndent;
+};
+
+}
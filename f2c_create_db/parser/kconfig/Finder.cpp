@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+#include <cctype>
+#include <glob.h>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <set>
+#include <string_view>
+
+#include <sl/helpers/Color.h>
+
+#include "Finder.h"
+#include "../../Verbose.h"
+
+using namespace Kconfig;
+using Clr = SlHelpers::Color;
+
+namespace {
+
+/**
+ * @brief Expand $(VAR) and $VAR in a source directive
+ *
+ * @return All possible expansions, or nullopt if an unknown variable is used
+ */
+std::optional<std::vector<std::string>> expandSource(std::string_view path,
+							     const std::vector<std::string> &archs,
+							     const std::string &srctree)
+{
+	std::vector<std::string> res { "" };
+
+	while (!path.empty()) {
+		auto dollar = path.find('$');
+		for (auto &r: res)
+			r.append(path.substr(0, dollar));
+		if (dollar == path.npos)
+			break;
+		path.remove_prefix(dollar + 1);
+
+		std::string_view var;
+		if (path.starts_with('(')) {
+			auto end = path.find(')');
+			if (end == path.npos)
+				return std::nullopt;
+			var = path.substr(1, end - 1);
+			path.remove_prefix(end + 1);
+		} else {
+			auto end = std::find_if_not(path.begin(), path.end(), [](char c) {
+				return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+			}) - path.begin();
+			var = path.substr(0, end);
+			path.remove_prefix(end);
+		}
+
+		std::vector<std::string> values;
+		if (var == "SRCARCH" || var == "ARCH" || var == "SUBARCH" || var == "HEADER_ARCH")
+			values = archs;
+		else if (var == "srctree")
+			values = { srctree };
+		else
+			return std::nullopt;
+
+		std::vector<std::string> newRes;
+		newRes.reserve(res.size() * values.size());
+		for (const auto &r: res)
+			for (const auto &v: values)
+				newRes.push_back(r + v);
+		res = std::move(newRes);
+	}
+
+	return res;
+}
+
+} // namespace
+
+Finder::Finder(const std::filesystem::path &root) :
+	m_root(root), m_excludeDir(root / "scripts" / "kconfig" / "tests"),
+	m_excludePath(root / "scripts" / "Kconfig.include")
+{
+	std::error_code ec;
+	for (const auto &e: std::filesystem::directory_iterator(m_root / "arch", ec))
+		if (e.is_directory())
+			m_archs.push_back(e.path().filename().string());
+
+	std::sort(m_archs.begin(), m_archs.end());
+}
+
+/**
+ * @brief Find all Kconfigs, calling @p parse on each level of them
+ *
+ * @return The Kconfigs in the order they were passed to @p parse.
+ */
+std::vector<std::filesystem::path> Finder::find(const ParseCB &parse) const
+{
+	std::set<std::filesystem::path> seen;
+	std::vector<std::filesystem::path> all;
+	std::vector<std::filesystem::path> level;
+
+	auto addKconfigs = [this, &seen, &level](std::vector<std::filesystem::path> &&paths) {
+		for (auto &path: paths)
+			if (path != m_excludePath && seen.insert(path).second)
+				level.push_back(std::move(path));
+	};
+
+	// the scan of the whole tree is needed only if the source directives are not enough
+	auto needScan = false;
+	std::vector<std::filesystem::path> roots;
+	if (const auto topLevel = m_root / "Kconfig"; std::filesystem::exists(topLevel)) {
+		roots.push_back(topLevel);
+	} else {
+		Clr(Clr::YELLOW) << "No top-level Kconfig, scanning the whole tree";
+		needScan = true;
+	}
+	for (const auto &arch: m_archs)
+		if (auto kconfig = m_root / "arch" / arch / "Kconfig"; std::filesystem::exists(kconfig))
+			roots.push_back(std::move(kconfig));
+	addKconfigs(std::move(roots));
+
+	for (auto scanned = false; ; ) {
+		while (!level.empty()) {
+			const auto sources = parse(level);
+			all.insert(all.end(), level.begin(), level.end());
+			level.clear();
+
+			for (const auto &[kconfig, source]: sources) {
+				std::vector<std::filesystem::path> resolved;
+				if (!resolveSource(kconfig, source, resolved))
+					needScan = true;
+				addKconfigs(std::move(resolved));
+			}
+		}
+
+		if (scanned || !needScan)
+			break;
+
+		// whatever unresolved sources refer to, and orphans along the way
+		addKconfigs(scan(m_root));
+		if (F2C::verbose && !level.empty())
+			std::cout << "Found " << level.size() << " Kconfigs not sourced by others\n";
+		scanned = true;
+	}
+
+	return all;
+}
+
+/// @brief The old way: find all Kconfig-like files in @p dir
+std::vector<std::filesystem::path> Finder::scan(const std::filesystem::path &dir) const
+{
+	std::vector<std::filesystem::path> kconfigs;
+
+	std::error_code ec;
+	for (auto it = std::filesystem::recursive_directory_iterator(dir, ec);
+	     it != std::filesystem::end(it); ++it) {
+		const auto &path = it->path();
+		if (it->is_directory()) {
+			if (path == m_excludeDir)
+				it.disable_recursion_pending();
+			continue;
+		}
+		if (!it->is_regular_file())
+			continue;
+		if (path.stem() != "Kconfig" && path.stem() != "Kconfig-nommu")
+			continue;
+		if (path == m_excludePath)
+			continue;
+
+		kconfigs.push_back(path);
+	}
+
+	std::sort(kconfigs.begin(), kconfigs.end());
+
+	return kconfigs;
+}
+
+/**
+ * @brief Find the Kconfigs @p source in @p kconfig refers to
+ *
+ * Variables are expanded to all possible values, so the files need not exist. Globs are
+ * expanded like kconfig does.
+ *
+ * @return false if @p source has unknown variables, or it is not optional and refers to no
+ * file. Such sources are left to the scan of the tree.
+ */
+bool Finder::resolveSource(const std::filesystem::path &kconfig, const Source &source,
+			   std::vector<std::filesystem::path> &resolved) const
+{
+	const auto base = source.relative ? kconfig.parent_path() : m_root;
+
+	auto expanded = expandSource(source.path, m_archs, m_root.string());
+	if (!expanded) {
+		if (F2C::verbose > 1)
+			std::cout << kconfig.string() << ": cannot expand source " <<
+				     std::quoted(source.path) << '\n';
+		return false;
+	}
+
+	const auto before = resolved.size();
+
+	for (const auto &e: *expanded) {
+		const auto path = (base / e).lexically_normal();
+		if (e.find_first_of("*?[") == std::string::npos) {
+			if (std::filesystem::is_regular_file(path))
+				resolved.push_back(path);
+			else if (F2C::verbose > 1 && !source.optional)
+				std::cout << kconfig.string() << ": sourced " << path <<
+					     " does not exist\n";
+			continue;
+		}
+
+		glob_t g;
+		if (!glob(path.c_str(), 0, nullptr, &g))
+			for (auto i = 0U; i < g.gl_pathc; ++i)
+				resolved.emplace_back(g.gl_pathv[i]);
+		globfree(&g);
+	}
+
+	return source.optional || resolved.size() > before;
+}
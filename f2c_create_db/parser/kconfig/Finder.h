@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Config.h"
+
+namespace Kconfig {
+
+/**
+ * @brief Finds the Kconfigs of a kernel tree
+ *
+ * The Kconfigs reachable by source directives from the top-level Kconfig and
+ * arch/<arch>/Kconfig are found first, level by level, so that a caller can parse each level in
+ * parallel. Only if there is no top-level Kconfig or a source directive cannot be resolved,
+ * the tree is scanned for Kconfig-like files as before and those not reached by the source
+ * directives are processed last.
+ */
+class Finder {
+public:
+	using Sources = std::vector<std::pair<std::filesystem::path, Source>>;
+	/// @brief Parse @p kconfigs and return their source directives (with the sourcing Kconfig)
+	using ParseCB = std::function<Sources (const std::vector<std::filesystem::path> &kconfigs)>;
+
+	Finder(const std::filesystem::path &root);
+
+	std::vector<std::filesystem::path> find(const ParseCB &parse) const;
+	std::vector<std::filesystem::path> scan(const std::filesystem::path &dir) const;
+
+	const std::vector<std::string> &archs() const { return m_archs; }
+private:
+	bool resolveSource(const std::filesystem::path &kconfig, const Source &source,
+			   std::vector<std::filesystem::path> &resolved) const;
+
+	std::filesystem::path m_root;
+	std::filesystem::path m_excludeDir;
+	std::filesystem::path m_excludePath;
+	std::vector<std::string> m_archs;
+};
+
+} // namespace
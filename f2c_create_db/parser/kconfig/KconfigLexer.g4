@@ -81,7 +81,8 @@ LEQ : '<=' ;
 EQ  : '=' ;
 NE  : '!=' ;
 
-Source	: 'source' ;
+// rsource is relative to the current Kconfig, osource is optional
+Source	: 'source' | 'rsource' | 'osource' | 'orsource' ;
 If	: 'if' ;
 Endif	: 'endif' ;
 
@@ -7,6 +7,9 @@ using namespace Kconfig;
 
 void KconfigParserConfigListener::exitConfig(KconfigParser::ConfigContext *ctx)
 {
+	if (!m_configCB)
+		return;
+
 	static const constinit struct {
 		ConfType ctype;
 		unsigned ptype;
@@ -33,3 +36,22 @@ void KconfigParserConfigListener::exitConfig(KconfigParser::ConfigContext *ctx)
 					return;
 				}
 }
+
+void KconfigParserConfigListener::exitSource(KconfigParser::SourceContext *ctx)
+{
+	if (!m_sourceCB)
+		return;
+
+	auto path = ctx->str_or_src()->getText();
+	// STRING includes the quotes
+	if (ctx->str_or_src()->STRING())
+		path = path.substr(1, path.size() - 2);
+
+	auto keyword = ctx->Source()->getText();
+	keyword.resize(keyword.size() - std::string_view("source").size());
+	m_sourceCB({
+		.path = std::move(path),
+		.relative = keyword.ends_with('r'),
+		.optional = keyword.starts_with('o'),
+	});
+}
@@ -10,12 +10,15 @@ namespace Kconfig {
 class KconfigParserConfigListener : public KconfigParserBaseListener {
 public:
 	KconfigParserConfigListener() = delete;
-	KconfigParserConfigListener(Parser::ConfigCB configCB) :
-		KconfigParserBaseListener(), m_configCB(std::move(configCB)) {}
+	KconfigParserConfigListener(Parser::ConfigCB configCB, Parser::SourceCB sourceCB) :
+		KconfigParserBaseListener(), m_configCB(std::move(configCB)),
+		m_sourceCB(std::move(sourceCB)) {}
 
 	virtual void exitConfig(KconfigParser::ConfigContext *ctx) override;
+	virtual void exitSource(KconfigParser::SourceContext *ctx) override;
 private:
 	Parser::ConfigCB m_configCB;
+	Parser::SourceCB m_sourceCB;
 };
 
 }
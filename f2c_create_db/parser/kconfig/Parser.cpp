@@ -1,15 +1,48 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <iostream>
+
+#include <sl/helpers/Color.h>
+
 #include "KconfigParser.h"
 #include "KconfigParserConfigListener.h"
 #include "Parser.h"
+#include "../../Verbose.h"
 
 using namespace Kconfig;
+using Clr = SlHelpers::Color;
+
+bool Parser::parse(std::string_view str, bool trySLL)
+{
+	m_fastParsed = m_fastPath && m_fast.parse(str);
+	if (m_fastParsed)
+		return true;
+
+	return Base::parse(str, trySLL);
+}
 
-void Parser::walkConfigs(ConfigCB configCB) const
+bool Parser::parse(const std::filesystem::path &file, bool trySLL)
 {
+	m_fastParsed = m_fastPath && m_fast.parse(file);
+	if (m_fastParsed)
+		return true;
+
+	if (m_fastPath && F2C::verbose > 1)
+		Clr(std::cerr, Clr::YELLOW) << file.string() <<
+			": not handled by the fast path, using ANTLR";
+
+	return Base::parse(file, trySLL);
+}
+
+void Parser::walk(ConfigCB configCB, SourceCB sourceCB) const
+{
+	if (m_fastParsed) {
+		m_fast.walk(configCB, sourceCB);
+		return;
+	}
+
 	antlr4::tree::ParseTreeWalker walker;
-	KconfigParserConfigListener l{ std::move(configCB) };
+	KconfigParserConfigListener l{ std::move(configCB), std::move(sourceCB) };
 	walker.walk(&l, m_tree);
 }
 
@@ -2,10 +2,12 @@
 
 #pragma once
 
-#include <functional>
+#include <filesystem>
+#include <string_view>
 
 #include "../Parser.h"
 #include "Config.h"
+#include "FastParser.h"
 
 class KconfigLexer;
 class KconfigParser;
@@ -13,12 +15,28 @@ class KconfigParser;
 namespace Kconfig {
 
 class Parser : public Parsers::Parser<KconfigLexer, KconfigParser> {
+	using Base = Parsers::Parser<KconfigLexer, KconfigParser>;
 public:
-	using ConfigCB = std::function<void (std::string config, ConfType type)>;
+	using ConfigCB = FastParser::ConfigCB;
+	using SourceCB = FastParser::SourceCB;
 
-	void walkConfigs(ConfigCB configCB) const;
+	/// @brief @p fastPath tries FastParser first and falls back to ANTLR only if needed
+	Parser(bool fastPath = true) : m_fastPath(fastPath), m_fastParsed(false) {}
+
+	bool parse(std::string_view str, bool trySLL = true);
+	bool parse(const std::filesystem::path &file, bool trySLL = true);
+
+	/// @brief Was the last parse() handled by FastParser?
+	bool fastParsed() const { return m_fastParsed; }
+
+	void walkConfigs(ConfigCB configCB) const { walk(std::move(configCB), nullptr); }
+	void walk(ConfigCB configCB, SourceCB sourceCB) const;
 protected:
 	virtual antlr4::ParserRuleContext *getTree();
+private:
+	FastParser m_fast;
+	bool m_fastPath;
+	bool m_fastParsed;
 };
 
 }
@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <iostream>
+
+#include <sl/helpers/Color.h>
+
+#include "EntryVisitor.h"
+#include "Evaluator.h"
+#include "../../Verbose.h"
+
+using namespace MP;
+using Clr = SlHelpers::Color;
+
+/**
+ * @brief Evaluate $(id)
+ *
+ * @param id Variable name inside the $()
+ * @param atomText The whole atom, used when the variable is unknown
+ * @return Never empty vector of possible values
+ */
+std::vector<std::string> Evaluator::evaluateEvalId(const std::string &id,
+						   std::string_view atomText) const
+{
+	if (id == "CSKYABI")
+		return { "abiv1", "abiv2" };
+	if (id == "SRCARCH")
+		return m_archs;
+	if (id == "BITS")
+		return { "32", "64" };
+	if (id == "src")
+		return { m_curDir };
+	if (id == "srctree")
+		return { m_rootDir };
+
+	if (auto res = m_entryVisitor.getVariable(id); !res.empty())
+		return res;
+
+	return { std::string(atomText) };
+}
+
+/// @brief Concatenate all values of an atom to all already evaluated values of a word
+void Evaluator::appendAtom(std::vector<std::string> &evaluated,
+			   std::vector<std::string> &&evalAtom)
+{
+	if (evaluated.empty()) {
+		evaluated = std::move(evalAtom);
+		return;
+	}
+
+	std::vector<std::string> newRes;
+	newRes.reserve(evalAtom.size() * evaluated.size());
+	for (const auto &entry: evalAtom)
+		for (const auto &evaluatedEntry: evaluated)
+			newRes.push_back(evaluatedEntry + entry);
+
+	evaluated = std::move(newRes);
+}
+
+/**
+ * @brief Compute condition of an expression
+ *
+ * Either it came as obj-$(CONFIG_) or obj-y and is set already (@p cond), or it is some
+ * target-y and we need to compute it from @p lhs.
+ */
+std::string Evaluator::exprCond(std::string_view lhs, std::string cond)
+{
+	if (cond.empty()) {
+		static constexpr std::string_view suffixes[] = { "-y", "-m", "-objs" };
+
+		for (const auto &s: suffixes)
+			if (lhs.ends_with(s))
+				return std::string(s.substr(1));
+	}
+
+	return cond;
+}
+
+bool Evaluator::isCompilerFlagsRule(std::string_view lhs)
+{
+	return lhs.starts_with("subdir-asflags-") || lhs.starts_with("subdir-ccflags-");
+}
+
+void Evaluator::visitWord(const std::any &interesting, const std::string &lhs,
+			  bool simpleAssign, const std::string &cond,
+			  std::vector<std::string> &&evaluated, bool &resetVar) const
+{
+	for (auto &wordText: evaluated) {
+		if (F2C::verbose > 2)
+			std::cout << "\t\t" << __func__ << ": lhs=" << lhs << " rhs=" << wordText
+				<< "\n";
+
+		if (simpleAssign)
+			m_entryVisitor.setVariable(lhs, resetVar, wordText);
+
+		resetVar = false;
+
+		if (!interesting.has_value())
+			continue;
+
+		if (!isCompilerFlagsRule(lhs) &&
+		    (wordText.back() == '/' || lhs.starts_with("subdir-"))) {
+			m_entryVisitor.entry(interesting, cond, EntryType::Directory,
+					     std::move(wordText));
+		} else if (wordText.ends_with(".o")) {
+			m_entryVisitor.entry(interesting, cond, EntryType::Object,
+					     std::move(wordText));
+		}
+	}
+}
+
+void Evaluator::include(std::vector<std::string> &&evaluated, std::string_view text) const
+{
+	for (const auto &e: evaluated) {
+		std::filesystem::path dest { e };
+		if (F2C::verbose > 1)
+			Clr(std::cerr) << __func__ << ": include: " << text << " -> " << dest;
+		if (std::filesystem::exists(dest)) {
+			m_entryVisitor.include(std::move(dest));
+			continue;
+		}
+		// pre-6.3 trees used --include-dir=$(abs_srctree)
+		auto destIncludeDir = m_rootDir / dest;
+		if (std::filesystem::exists(destIncludeDir)) {
+			m_entryVisitor.include(std::move(destIncludeDir));
+			continue;
+		}
+
+		if (F2C::verbose > 0)
+			Clr(std::cerr, Clr::YELLOW) << "include " << dest <<
+				" does not exist, cwd=" << m_curDir;
+	}
+}
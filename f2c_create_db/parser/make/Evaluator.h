@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <any>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace MP {
+
+class EntryVisitor;
+
+/**
+ * @brief Evaluation of Kbuild expressions shared by the ANTLR listener and FastParser
+ *
+ * Both parsers only recognize the structure. The resulting words are evaluated here, so that
+ * EntryVisitor receives exactly the same callbacks whichever parser was used.
+ */
+class Evaluator {
+public:
+	Evaluator() = delete;
+	Evaluator(const std::vector<std::string> &archs, const EntryVisitor &entryVisitor,
+		  const std::filesystem::path &rootDir, const std::filesystem::path &curDir)
+		: m_archs(archs), m_entryVisitor(entryVisitor), m_rootDir(rootDir),
+		m_curDir(curDir) {}
+
+	const EntryVisitor &visitor() const { return m_entryVisitor; }
+
+	std::vector<std::string> evaluateEvalId(const std::string &id,
+						std::string_view atomText) const;
+	static void appendAtom(std::vector<std::string> &evaluated,
+			       std::vector<std::string> &&evalAtom);
+	static std::string exprCond(std::string_view lhs, std::string cond);
+
+	void visitWord(const std::any &interesting, const std::string &lhs, bool simpleAssign,
+		       const std::string &cond, std::vector<std::string> &&evaluated,
+		       bool &resetVar) const;
+	void include(std::vector<std::string> &&evaluated, std::string_view text) const;
+
+	static bool isCompilerFlagsRule(std::string_view lhs);
+private:
+	const std::vector<std::string> &m_archs;
+	const EntryVisitor &m_entryVisitor;
+	const std::filesystem::path &m_rootDir;
+	const std::filesystem::path &m_curDir;
+};
+
+}
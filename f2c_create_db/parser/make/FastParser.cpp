@@ -0,0 +1,570 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <fstream>
+#include <iostream>
+
+#include <sl/helpers/Color.h>
+#include <sl/helpers/String.h>
+
+#include "EntryVisitor.h"
+#include "Evaluator.h"
+#include "FastParser.h"
+#include "../../Verbose.h"
+
+using namespace MP;
+using Clr = SlHelpers::Color;
+
+namespace {
+
+/*
+ * The token classes below mirror MakeLexer.g4. Anything the lexer would turn into a token
+ * not listed here makes the fast path give up.
+ */
+enum class RunType {
+	Id,
+	Special, // CSKYABI, BITS, SRCARCH
+	Config,
+	Bare,
+	Force,
+	Keyword,
+};
+
+constexpr bool isIdChar(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+		c == '-' || c == '+' || c == '_' || c == '/' || c == '.';
+}
+
+constexpr bool isWS(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+size_t skipWS(std::string_view line, size_t pos)
+{
+	while (pos < line.size() && isWS(line[pos]))
+		++pos;
+	return pos;
+}
+
+/// @brief Scan the longest run of ID characters, i.e. one token of MakeLexer
+std::string_view scanRun(std::string_view line, size_t &pos)
+{
+	const auto start = pos;
+	while (pos < line.size() && isIdChar(line[pos]))
+		++pos;
+	return line.substr(start, pos - start);
+}
+
+RunType classify(std::string_view run)
+{
+	static constexpr std::string_view keywords[] = {
+		"-include", "define", "else", "endef", "endif", "export", "ifdef", "ifeq",
+		"ifndef", "ifneq", "include", "override", "private", "undefine", "unexport",
+	};
+	static constexpr std::string_view bares[] = {
+		"core-m", "core-y", "drivers-m", "drivers-y", "lib-m", "lib-y", "libs-m",
+		"libs-y", "net-m", "net-y", "obj-m", "obj-y", "virt-m", "virt-y",
+	};
+	static constexpr std::string_view specials[] = { "BITS", "CSKYABI", "SRCARCH" };
+
+	if (run.empty())
+		return RunType::Keyword;
+	for (const auto &k: keywords)
+		if (run == k)
+			return RunType::Keyword;
+	for (const auto &b: bares)
+		if (run == b)
+			return RunType::Bare;
+	for (const auto &s: specials)
+		if (run == s)
+			return RunType::Special;
+	if (run == "FORCE")
+		return RunType::Force;
+	if (run.size() > 7 && run.starts_with("CONFIG_"))
+		return RunType::Config;
+
+	return RunType::Id;
+}
+
+/// @brief Scan $(id) or ${id}, @p inner is set to id
+bool scanEval(std::string_view line, size_t &pos, std::string_view &inner)
+{
+	if (pos + 1 >= line.size() || line[pos] != '$')
+		return false;
+
+	char close;
+	switch (line[pos + 1]) {
+	case '(':
+		close = ')';
+		break;
+	case '{':
+		close = '}';
+		break;
+	default:
+		return false;
+	}
+
+	auto p = pos + 2;
+	inner = scanRun(line, p);
+	if (inner.empty() || p >= line.size() || line[p] != close)
+		return false;
+
+	pos = p + 1;
+	return true;
+}
+
+bool isConditional(std::string_view keyword)
+{
+	return keyword == "ifeq" || keyword == "ifneq" || keyword == "ifdef" ||
+		keyword == "ifndef";
+}
+
+/// @brief Conditionals can be indented only by TAB* SPACE*, see conditional_or_macro_ws
+bool isConditionalIndent(std::string_view indent)
+{
+	auto firstSpace = indent.find(' ');
+	return firstSpace == indent.npos || indent.find('\t', firstSpace) == indent.npos;
+}
+
+constexpr std::string_view condY { "y" };
+
+} // namespace
+
+bool FastParser::parse(const std::filesystem::path &file)
+{
+	std::ifstream ifs(file, std::ios::binary | std::ios::ate);
+	if (!ifs)
+		return false;
+
+	const auto size = ifs.tellg();
+	if (size < 0)
+		return false;
+
+	m_buf.resize(size);
+	ifs.seekg(0);
+	if (!ifs.read(m_buf.data(), m_buf.size()))
+		return false;
+
+	return parseBuffer();
+}
+
+bool FastParser::parse(std::string_view str)
+{
+	m_buf.assign(str);
+
+	return parseBuffer();
+}
+
+bool FastParser::parseBuffer()
+{
+	m_atoms.clear();
+	m_words.clear();
+	m_stmts.clear();
+	m_depth = 0;
+
+	if (!removeContinuations())
+		return false;
+
+	std::string_view buf { m_buf };
+	for (;;) {
+		auto nl = buf.find('\n');
+		if (!parseLine(buf.substr(0, nl)))
+			return false;
+		if (nl == buf.npos)
+			break;
+		buf.remove_prefix(nl + 1);
+	}
+
+	return !m_depth;
+}
+
+/**
+ * @brief Drop backslash-newline sequences in place, like CONT_LINE in MakeLexer does
+ *
+ * The lexer splits tokens at the continuation. Joining the lines would create a single token
+ * instead, so give up if there is no whitespace on either side. Any other backslash is not
+ * handled by the fast path either.
+ */
+bool FastParser::removeContinuations()
+{
+	if (m_buf.find('\r') != m_buf.npos)
+		return false;
+
+	size_t out = 0;
+	for (size_t in = 0; in < m_buf.size(); ) {
+		if (m_buf[in] != '\\') {
+			m_buf[out++] = m_buf[in++];
+			continue;
+		}
+
+		auto p = in + 1;
+		while (p < m_buf.size() && m_buf[p] == ' ')
+			++p;
+		if (p >= m_buf.size() || m_buf[p] != '\n')
+			return false;
+		++p;
+
+		const auto prevSep = !out || isWS(m_buf[out - 1]) || m_buf[out - 1] == '\n';
+		const auto nextSep = p >= m_buf.size() || isWS(m_buf[p]) || m_buf[p] == '\n';
+		if (!prevSep && !nextSep)
+			return false;
+
+		in = p;
+	}
+	m_buf.resize(out);
+
+	return true;
+}
+
+bool FastParser::parseAtom(std::string_view line, size_t &pos, std::string_view *cond)
+{
+	if (isIdChar(line[pos])) {
+		auto run = scanRun(line, pos);
+		if (classify(run) == RunType::Keyword)
+			return false;
+		m_atoms.push_back({ run, {} });
+		return true;
+	}
+
+	const auto start = pos;
+	std::string_view inner;
+	if (!scanEval(line, pos, inner))
+		return false;
+
+	const auto text = line.substr(start, pos - start);
+	switch (classify(inner)) {
+	case RunType::Keyword:
+		return false;
+	case RunType::Bare:
+		if (cond)
+			*cond = inner.substr(inner.size() - 1);
+		m_atoms.push_back({ text, {} });
+		break;
+	case RunType::Force:
+		if (cond)
+			*cond = {};
+		m_atoms.push_back({ text, {} });
+		break;
+	case RunType::Config:
+		if (cond)
+			*cond = inner;
+		m_atoms.push_back({ text, inner });
+		break;
+	default:
+		if (cond)
+			*cond = {};
+		m_atoms.push_back({ text, inner });
+		break;
+	}
+
+	return true;
+}
+
+bool FastParser::parseWord(std::string_view line, size_t &pos)
+{
+	const auto start = pos;
+	const unsigned firstAtom = m_atoms.size();
+
+	while (pos < line.size() && !isWS(line[pos]))
+		if (!parseAtom(line, pos))
+			return false;
+
+	m_words.push_back({ line.substr(start, pos - start), firstAtom,
+			    static_cast<unsigned>(m_atoms.size() - firstAtom) });
+
+	return true;
+}
+
+/// @brief Parse (l,r) of ifeq/ifneq and compute the condition as MakeExprListener::handleIfeq()
+bool FastParser::parseIfeqCond(std::string_view line, size_t &pos, bool neq,
+			       std::string_view &cond)
+{
+	if (pos >= line.size() || line[pos] != '(')
+		return false;
+	++pos;
+
+	const auto lFirst = m_atoms.size();
+	while (pos < line.size() && line[pos] != ',')
+		if (!parseAtom(line, pos))
+			return false;
+	if (pos >= line.size())
+		return false;
+	const auto lCount = m_atoms.size() - lFirst;
+
+	pos = skipWS(line, pos + 1);
+	const auto rFirst = m_atoms.size();
+	while (pos < line.size() && line[pos] != ')')
+		if (!parseAtom(line, pos))
+			return false;
+	if (pos >= line.size())
+		return false;
+	const auto rCount = m_atoms.size() - rFirst;
+	++pos;
+
+	cond = condY;
+	if (lCount == 1 && rCount == (neq ? 0U : 1U)) {
+		const auto &l = m_atoms[lFirst];
+		if (!l.id.empty() && classify(l.id) == RunType::Config) {
+			// ifneq ($(CONFIG_FOO),)
+			if (neq)
+				cond = l.id;
+			// ifeq ($(CONFIG_FOO),X) where X is y or m
+			else if (m_atoms[rFirst].text == "y" || m_atoms[rFirst].text == "m")
+				cond = l.id;
+		}
+	}
+
+	// the atoms were needed only to compute cond
+	m_atoms.resize(lFirst);
+
+	return true;
+}
+
+bool FastParser::parseConditional(std::string_view line, size_t &pos, std::string_view keyword,
+				  std::string_view &cond)
+{
+	auto p = skipWS(line, pos);
+	if (p == pos)
+		return false;
+
+	if (keyword == "ifeq" || keyword == "ifneq") {
+		if (!parseIfeqCond(line, p, keyword == "ifneq", cond))
+			return false;
+	} else {
+		auto run = scanRun(line, p);
+		auto type = classify(run);
+		if (type != RunType::Id && type != RunType::Config)
+			return false;
+		// we have no way to note negatives (ifndef) in the DB
+		cond = (keyword == "ifdef" && type == RunType::Config) ? run : condY;
+	}
+
+	pos = p;
+	return true;
+}
+
+bool FastParser::parseInclude(std::string_view line, size_t pos)
+{
+	auto p = skipWS(line, pos);
+	if (p == pos || p >= line.size())
+		return false;
+
+	const unsigned firstWord = m_words.size();
+	if (!parseWord(line, p) || p != line.size())
+		return false;
+
+	m_stmts.push_back({ StmtType::Include, false, false, {}, {}, firstWord, 1 });
+
+	return true;
+}
+
+/**
+ * @brief Parse "lhs op words"
+ *
+ * lhs follows atom_lhs from MakeParser.g4: bare | (id | eval)+ | bare eval. Its cond is
+ * computed the same way the grammar does.
+ */
+bool FastParser::parseExpr(std::string_view line, size_t pos)
+{
+	const auto start = pos;
+	std::string_view cond;
+	unsigned parts = 0;
+	bool bare = false;
+
+	while (pos < line.size()) {
+		if (isIdChar(line[pos])) {
+			auto run = scanRun(line, pos);
+			switch (classify(run)) {
+			case RunType::Keyword:
+			case RunType::Force:
+				return false;
+			case RunType::Bare:
+				if (parts)
+					return false;
+				bare = true;
+				cond = run.substr(run.size() - 1);
+				break;
+			default:
+				if (bare)
+					return false;
+				break;
+			}
+		} else if (line[pos] == '$') {
+			if (bare && parts != 1)
+				return false;
+			const unsigned atoms = m_atoms.size();
+			if (!parseAtom(line, pos, &cond))
+				return false;
+			m_atoms.resize(atoms);
+		} else {
+			break;
+		}
+		parts++;
+	}
+
+	if (!parts)
+		return false;
+
+	const auto lhs = line.substr(start, pos - start);
+
+	pos = skipWS(line, pos);
+	if (pos >= line.size())
+		return false;
+
+	bool resetVar = true;
+	switch (line[pos]) {
+	case '=':
+		pos += 1;
+		break;
+	case '+':
+		resetVar = false;
+		[[fallthrough]];
+	case ':':
+	case '?':
+		if (pos + 1 >= line.size() || line[pos + 1] != '=')
+			return false;
+		pos += 2;
+		break;
+	default:
+		return false;
+	}
+
+	const unsigned firstWord = m_words.size();
+	for (;;) {
+		pos = skipWS(line, pos);
+		if (pos >= line.size())
+			break;
+		if (!parseWord(line, pos))
+			return false;
+	}
+
+	m_stmts.push_back({ StmtType::Expr, resetVar, parts == 1, lhs, cond, firstWord,
+			    static_cast<unsigned>(m_words.size() - firstWord) });
+
+	return true;
+}
+
+bool FastParser::parseLine(std::string_view line)
+{
+	if (auto hash = line.find('#'); hash != line.npos)
+		line = line.substr(0, hash);
+
+	const auto pos = skipWS(line, 0);
+	if (pos == line.size())
+		return true;
+
+	if (!isIdChar(line[pos]))
+		return parseExpr(line, pos);
+
+	auto p = pos;
+	const auto keyword = scanRun(line, p);
+	if (classify(keyword) != RunType::Keyword)
+		return parseExpr(line, pos);
+
+	if (keyword == "include" || keyword == "-include")
+		return parseInclude(line, p);
+
+	if (!isConditionalIndent(line.substr(0, pos)))
+		return false;
+
+	std::string_view cond { condY };
+
+	if (isConditional(keyword)) {
+		if (!parseConditional(line, p, keyword, cond) || skipWS(line, p) != line.size())
+			return false;
+		m_stmts.push_back({ StmtType::If, false, false, {}, cond, 0, 0 });
+		++m_depth;
+		return true;
+	}
+
+	if (keyword == "else") {
+		if (!m_depth)
+			return false;
+		auto q = skipWS(line, p);
+		if (q != line.size()) {
+			auto elseKeyword = scanRun(line, q);
+			if (!isConditional(elseKeyword) ||
+			    !parseConditional(line, q, elseKeyword, cond) ||
+			    skipWS(line, q) != line.size())
+				return false;
+		}
+		m_stmts.push_back({ StmtType::Else, false, false, {}, cond, 0, 0 });
+		return true;
+	}
+
+	if (keyword == "endif") {
+		if (!m_depth || skipWS(line, p) != line.size())
+			return false;
+		m_stmts.push_back({ StmtType::Endif, false, false, {}, {}, 0, 0 });
+		--m_depth;
+		return true;
+	}
+
+	return false;
+}
+
+std::vector<std::string> FastParser::evaluateWord(const Evaluator &eval, const Word &word) const
+{
+	std::vector<std::string> evaluated;
+
+	for (auto i = word.firstAtom; i < word.firstAtom + word.atoms; ++i) {
+		const auto &atom = m_atoms[i];
+		if (atom.id.empty())
+			Evaluator::appendAtom(evaluated, { std::string(atom.text) });
+		else
+			Evaluator::appendAtom(evaluated,
+					      eval.evaluateEvalId(std::string(atom.id), atom.text));
+	}
+
+	if (F2C::verbose > 1) {
+		Clr() << __func__ << ": " << word.text << " -> [" << Clr::NoNL;
+		SlHelpers::String::join(std::cout, evaluated);
+		Clr()<< ']';
+	}
+
+	return evaluated;
+}
+
+void FastParser::walkExpr(const Evaluator &eval, const Stmt &stmt) const
+{
+	const std::string lhs { stmt.lhs };
+	auto interesting = eval.visitor().isInteresting(lhs);
+	auto cond = Evaluator::exprCond(lhs, std::string(stmt.cond));
+
+	if (F2C::verbose > 2)
+		std::cout << __func__ << ": interesting=" << interesting.has_value() <<
+			     ": L='" << lhs << "' COND='" << cond << "' words=" << stmt.words <<
+			     '\n';
+
+	auto resetVar = stmt.resetVar;
+	for (auto i = stmt.firstWord; i < stmt.firstWord + stmt.words; ++i)
+		eval.visitWord(interesting, lhs, stmt.simpleAssign, cond,
+			       evaluateWord(eval, m_words[i]), resetVar);
+}
+
+void FastParser::walk(const Evaluator &eval) const
+{
+	for (const auto &stmt: m_stmts) {
+		switch (stmt.type) {
+		case StmtType::Expr:
+			walkExpr(eval, stmt);
+			break;
+		case StmtType::Include: {
+			const auto &word = m_words[stmt.firstWord];
+			eval.include(evaluateWord(eval, word), word.text);
+			break;
+		}
+		case StmtType::If:
+			eval.visitor().enterConditional(std::string(stmt.cond));
+			break;
+		case StmtType::Else:
+			eval.visitor().exitConditional();
+			eval.visitor().enterConditional(std::string(stmt.cond));
+			break;
+		case StmtType::Endif:
+			eval.visitor().exitConditional();
+			break;
+		}
+	}
+}
@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace MP {
+
+class Evaluator;
+
+/**
+ * @brief Hand-written recognizer of the common Kbuild subset
+ *
+ * It handles assignments of plain words and $(VAR) references, include, and
+ * ifdef/ifndef/ifeq/ifneq/else/endif blocks. parse() returns false for anything else and the
+ * caller is supposed to fall back to the ANTLR grammar then.
+ *
+ * The recognized statements only point into the internal buffer. All the containers are
+ * reused, so there are no allocations per file once they grew large enough.
+ */
+class FastParser {
+public:
+	FastParser() : m_depth(0) {}
+
+	bool parse(const std::filesystem::path &file);
+	bool parse(std::string_view str);
+
+	void walk(const Evaluator &eval) const;
+private:
+	/// @brief Literal text, or $(id) if @p id is non-empty
+	struct Atom {
+		std::string_view text;
+		std::string_view id;
+	};
+
+	struct Word {
+		std::string_view text;
+		unsigned firstAtom;
+		unsigned atoms;
+	};
+
+	enum class StmtType : unsigned char {
+		Expr,
+		Include,
+		If,
+		Else,
+		Endif,
+	};
+
+	struct Stmt {
+		StmtType type;
+		bool resetVar;
+		bool simpleAssign;
+		std::string_view lhs;
+		std::string_view cond;
+		unsigned firstWord;
+		unsigned words;
+	};
+
+	bool parseBuffer();
+	bool removeContinuations();
+	bool parseLine(std::string_view line);
+	bool parseAtom(std::string_view line, size_t &pos, std::string_view *cond = nullptr);
+	bool parseWord(std::string_view line, size_t &pos);
+	bool parseConditional(std::string_view line, size_t &pos, std::string_view keyword,
+			      std::string_view &cond);
+	bool parseIfeqCond(std::string_view line, size_t &pos, bool neq,
+			   std::string_view &cond);
+	bool parseInclude(std::string_view line, size_t pos);
+	bool parseExpr(std::string_view line, size_t pos);
+
+	std::vector<std::string> evaluateWord(const Evaluator &eval, const Word &word) const;
+	void walkExpr(const Evaluator &eval, const Stmt &stmt) const;
+
+	std::string m_buf;
+	std::vector<Atom> m_atoms;
+	std::vector<Word> m_words;
+	std::vector<Stmt> m_stmts;
+	unsigned m_depth;
+};
+
+}
@@ -8,6 +8,7 @@
 #include <sl/helpers/String.h>
 
 #include "EntryVisitor.h"
+#include "Evaluator.h"
 #include "MakeLexer.h"
 #include "MakeParserExprListener.h"
 #include "../../Verbose.h"
@@ -28,22 +29,8 @@ MakeParser::IdContext *MakeExprListener::getEvalId(MakeParser::AtomContext *atom
 
 std::vector<std::string> MakeExprListener::evaluateAtom(MakeParser::AtomContext *atom)
 {
-	if (auto id = getEvalId(atom)) {
-		if (id->CSKYABI())
-			return { "abiv1", "abiv2" };
-		if (id->SRCARCH())
-			return archs;
-		if (id->BITS())
-			return { "32", "64" };
-		auto text = id->getText();
-		if (text == "src")
-			return { m_curDir };
-		if (text == "srctree")
-			return { m_rootDir };
-
-		if (auto res = entryVisitor.getVariable(text); !res.empty())
-			return res;
-	}
+	if (auto id = getEvalId(atom))
+		return m_eval.evaluateEvalId(id->getText(), atom->getText());
 
 	return { atom->getText() };
 }
@@ -52,21 +39,9 @@ std::vector<std::string> MakeExprListener::evaluateWord(MakeParser::WordContext
 {
 	std::vector<std::string> evaluated;
 
-	for (const auto &atom: word->children) {
-		std::vector<std::string> newRes;
-
-		auto evalAtom = evaluateAtom(dynamic_cast<MakeParser::AtomContext *>(atom));
-
-		if (evaluated.empty()) {
-			evaluated = evalAtom;
-		} else {
-			for (const auto &entry: evalAtom)
-				for (const auto &evaluatedEntry: evaluated)
-					newRes.push_back(evaluatedEntry + entry);
-
-			evaluated = newRes;
-		}
-	}
+	for (const auto &atom: word->children)
+		Evaluator::appendAtom(evaluated,
+				      evaluateAtom(dynamic_cast<MakeParser::AtomContext *>(atom)));
 
 	if (F2C::verbose > 1) {
 		Clr() << __func__ << ": " << word->getText() << " -> [" << Clr::NoNL;
@@ -77,64 +52,17 @@ std::vector<std::string> MakeExprListener::evaluateWord(MakeParser::WordContext
 	return evaluated;
 }
 
-bool MakeExprListener::isCompilerFlagsRule(std::string_view lhs)
-{
-	return lhs.starts_with("subdir-asflags-") || lhs.starts_with("subdir-ccflags-");
-}
-
-void MakeExprListener::evaluateWordAndVisit(const std::any &interesting, const std::string &lhs,
-					    bool simpleAssign, const std::string &cond,
-					    MakeParser::WordContext *word,
-					    bool &resetVar)
-{
-	for (auto &wordText: evaluateWord(word)) {
-		if (F2C::verbose > 2)
-			std::cout << "\t\t" << __func__ << ": lhs=" << lhs << " rhs=" << wordText
-				<< "\n";
-
-		if (simpleAssign)
-			entryVisitor.setVariable(lhs, resetVar, wordText);
-
-		resetVar = false;
-
-		if (!interesting.has_value())
-			continue;
-
-		if (!isCompilerFlagsRule(lhs) &&
-		    (wordText.back() == '/' || lhs.starts_with("subdir-"))) {
-			entryVisitor.entry(interesting, cond, EntryType::Directory,
-					   std::move(wordText));
-		} else if (wordText.ends_with(".o")) {
-			entryVisitor.entry(interesting, cond, EntryType::Object,
-					   std::move(wordText));
-		}
-	}
-}
-
 void MakeExprListener::exitExpr(MakeParser::ExprContext *ctx)
 {
 	auto lText = ctx->l->getText();
-	auto interesting = entryVisitor.isInteresting(lText);
+	auto interesting = m_eval.visitor().isInteresting(lText);
 
 	if (F2C::verbose > 2) {
 		std::cout << __func__ << ": interesting=" << interesting.has_value() << ": "
 			  << ctx->getText().substr(0, 150) << '\n';
 	}
 
-	/*
-	 * either it came as obj-$(CONFIG_) or obj-y and is set already or it is some target-y
-	 * and we need to compute
-	 */
-	auto cond = ctx->l->cond;
-	if (cond.empty()) {
-		static constexpr std::string_view suffixes[] = { "-y", "-m", "-objs" };
-
-		for (const auto &s: suffixes)
-			if (lText.ends_with(s)) {
-				cond = s.substr(1);
-				break;
-			}
-	}
+	auto cond = Evaluator::exprCond(lText, ctx->l->cond);
 	if (F2C::verbose > 2) {
 		std::cout << "\tL='" << lText << "' COND='" << cond << "'\n";
 		for (const auto &a: ctx->l->children)
@@ -154,34 +82,15 @@ void MakeExprListener::exitExpr(MakeParser::ExprContext *ctx)
 		auto simpleAssign = ctx->l->children.size() == 1;
 
 		for (const auto &word: ctx->r->words()->w)
-			evaluateWordAndVisit(interesting, lText, simpleAssign, cond, word,
-					     resetVar);
+			m_eval.visitWord(interesting, lText, simpleAssign, cond,
+					 evaluateWord(word), resetVar);
 	}
 }
 
 void MakeExprListener::exitInclude(MakeParser::IncludeContext *ctx)
 {
 	auto inc = ctx->word();
-	for (const auto &e: evaluateWord(inc)) {
-		std::filesystem::path dest { e };
-		if (F2C::verbose > 1)
-			Clr(std::cerr) << __func__ << ": include: " << inc->getText() <<
-				" -> " << dest;
-		if (std::filesystem::exists(dest)) {
-			entryVisitor.include(std::move(dest));
-			continue;
-		}
-		// pre-6.3 trees used --include-dir=$(abs_srctree)
-		auto destIncludeDir = m_rootDir / dest;
-		if (std::filesystem::exists(destIncludeDir)) {
-			entryVisitor.include(std::move(destIncludeDir));
-			continue;
-		}
-
-		if (F2C::verbose > 0)
-			Clr(std::cerr, Clr::YELLOW) << "include " << dest <<
-				" does not exist, cwd=" << m_curDir;
-	}
+	m_eval.include(evaluateWord(inc), inc->getText());
 }
 
 std::string MakeExprListener::handleIfeq(MakeParser::Ifeq_condContext *ieCond, bool neq)
@@ -235,7 +144,7 @@ void MakeExprListener::exitIfeq_exprCommon(MakeParser::Ifeq_exprContext *ctx)
 		}
 	}
 
-	entryVisitor.enterConditional(std::move(cond));
+	m_eval.visitor().enterConditional(std::move(cond));
 }
 
 void MakeExprListener::exitConditional_ifeq_expr(MakeParser::Conditional_ifeq_exprContext *ctx)
@@ -250,5 +159,5 @@ void MakeExprListener::exitConditional_ifeq_expr_cond(MakeParser::Conditional_if
 
 void MakeExprListener::exitConditional_body(MakeParser::Conditional_bodyContext *ctx)
 {
-	entryVisitor.exitConditional();
+	m_eval.visitor().exitConditional();
 }
@@ -7,6 +7,7 @@
 #include <string>
 #include <string_view>
 
+#include "Evaluator.h"
 #include "MakeParserBaseListener.h"
 
 namespace MP {
@@ -18,8 +19,7 @@ public:
 	MakeExprListener() = delete;
 	MakeExprListener(const std::vector<std::string> &archs, const EntryVisitor &entryVisitor,
 			 const std::filesystem::path &rootDir, const std::filesystem::path &curDir)
-		: MakeParserBaseListener(), archs(archs), entryVisitor(entryVisitor),
-		m_rootDir(rootDir), m_curDir(curDir) {}
+		: MakeParserBaseListener(), m_eval(archs, entryVisitor, rootDir, curDir) {}
 
 	virtual void exitExpr(MakeParser::ExprContext *) override;
 	virtual void exitInclude(MakeParser::IncludeContext *ctx) override;
@@ -30,22 +30,14 @@ public:
 	virtual void exitConditional_body(MakeParser::Conditional_bodyContext *ctx) override;
 
 private:
-	static bool isCompilerFlagsRule(std::string_view lhs);
 	static MakeParser::IdContext *getEvalId(MakeParser::AtomContext *atom);
 
 	std::vector<std::string> evaluateAtom(MakeParser::AtomContext *atom);
 	std::vector<std::string> evaluateWord(MakeParser::WordContext *word);
-	void evaluateWordAndVisit(const std::any &interesting, const std::string &lhs,
-				  bool simpleAssign, const std::string &cond,
-				  MakeParser::WordContext *word,
-				  bool &resetVar);
 
 	std::string handleIfeq(MakeParser::Ifeq_condContext *ieCond, bool neq);
 
-	const std::vector<std::string> &archs;
-	const EntryVisitor &entryVisitor;
-	const std::filesystem::path &m_rootDir;
-	const std::filesystem::path &m_curDir;
+	Evaluator m_eval;
 };
 
 }
@@ -1,13 +1,47 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <iostream>
+
+#include <sl/helpers/Color.h>
+
+#include "Evaluator.h"
 #include "MakeParserExprListener.h"
 #include "Parser.h"
+#include "../../Verbose.h"
 
 using namespace MP;
+using Clr = SlHelpers::Color;
+
+bool Parser::parse(std::string_view str, bool trySLL)
+{
+	m_fastParsed = m_fastPath && m_fast.parse(str);
+	if (m_fastParsed)
+		return true;
+
+	return Base::parse(str, trySLL);
+}
+
+bool Parser::parse(const std::filesystem::path &file, bool trySLL)
+{
+	m_fastParsed = m_fastPath && m_fast.parse(file);
+	if (m_fastParsed)
+		return true;
+
+	if (m_fastPath && F2C::verbose > 1)
+		Clr(std::cerr, Clr::YELLOW) << file.string() <<
+			": not handled by the fast path, using ANTLR";
+
+	return Base::parse(file, trySLL);
+}
 
 void Parser::walkAST(const std::vector<std::string> &archs, const EntryVisitor &entryVisitor,
 		     const std::filesystem::path &rootDir, const std::filesystem::path &curDir)
 {
+	if (m_fastParsed) {
+		m_fast.walk(Evaluator{ archs, entryVisitor, rootDir, curDir });
+		return;
+	}
+
 	antlr4::tree::ParseTreeWalker walker;
 	MakeExprListener l{ archs, entryVisitor, rootDir, curDir };
 	walker.walk(&l, m_tree);
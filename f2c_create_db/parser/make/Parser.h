@@ -7,6 +7,7 @@
 #include <vector>
 
 #include "../Parser.h"
+#include "FastParser.h"
 
 class MakeLexer;
 class MakeParser;
@@ -16,11 +17,25 @@ namespace MP {
 class EntryVisitor;
 
 class Parser : public Parsers::Parser<MakeLexer, MakeParser> {
+	using Base = Parsers::Parser<MakeLexer, MakeParser>;
 public:
+	/// @brief @p fastPath tries FastParser first and falls back to ANTLR only if needed
+	Parser(bool fastPath = true) : m_fastPath(fastPath), m_fastParsed(false) {}
+
+	bool parse(std::string_view str, bool trySLL = true);
+	bool parse(const std::filesystem::path &file, bool trySLL = true);
+
+	/// @brief Was the last parse() handled by FastParser?
+	bool fastParsed() const { return m_fastParsed; }
+
 	void walkAST(const std::vector<std::string> &archs, const EntryVisitor &entryVisitor,
 		     const std::filesystem::path &rootDir, const std::filesystem::path &curDir);
 protected:
 	virtual antlr4::ParserRuleContext *getTree();
+private:
+	FastParser m_fast;
+	bool m_fastPath;
+	bool m_fastParsed;
 };
 
 }
@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <chrono>
+#include <iostream>
+
+#include <sl/kerncvs/CollectConfigs.h>
+#include <sl/kerncvs/SupportedConf.h>
+
+#include "../Verbose.h"
+
+#include "MemorySink.h"
+
+using namespace TW;
+
+void MemorySink::beginBranch(const std::string &branch)
+{
+	m_branches.push_back(branch);
+}
+
+void MemorySink::endBranch()
+{
+	if (F2C::verbose)
+		std::cout << "Memory sink: " << m_branches.back() << ": " <<
+			     m_fileSupps.branch.size() << " file supports, " <<
+			     m_configs.branch.size() << " configs, " <<
+			     m_modules.branch.size() << " modules, " <<
+			     m_moduleFiles.branch.size() << " module files in total\n";
+
+	if (m_target) {
+		const auto start = std::chrono::steady_clock::now();
+		replay(*m_target);
+		clear();
+		if (F2C::verbose) {
+			const std::chrono::duration<double> elapsed =
+				std::chrono::steady_clock::now() - start;
+			std::cout << "Memory sink: replayed in " << elapsed.count() << " s\n";
+		}
+	}
+}
+
+void MemorySink::fileSupp(const std::filesystem::path &srcPath,
+			  SlKernCVS::ConfigValue enabled,
+			  const std::optional<std::string> &disabledConfig,
+			  SlKernCVS::SupportState supported)
+{
+	m_fileSupps.branch.push_back(curBranch());
+	m_fileSupps.srcPath.push_back(srcPath);
+	m_fileSupps.enabled.push_back(enabled);
+	m_fileSupps.disabledConfig.push_back(disabledConfig);
+	m_fileSupps.supported.push_back(supported);
+}
+
+void MemorySink::config(const std::filesystem::path &srcPath, const std::string &cond)
+{
+	m_configs.branch.push_back(curBranch());
+	m_configs.srcPath.push_back(srcPath);
+	m_configs.cond.push_back(cond);
+}
+
+void MemorySink::module(const std::filesystem::path &module, const std::string &moduleConf,
+			SlKernCVS::SupportState supported)
+{
+	m_modules.branch.push_back(curBranch());
+	m_modules.module.push_back(module);
+	m_modules.moduleConf.push_back(moduleConf);
+	m_modules.supported.push_back(supported);
+}
+
+void MemorySink::moduleFile(const std::filesystem::path &srcPath,
+			    const std::filesystem::path &module)
+{
+	m_moduleFiles.branch.push_back(curBranch());
+	m_moduleFiles.srcPath.push_back(srcPath);
+	m_moduleFiles.module.push_back(module);
+}
+
+/**
+ * @brief Feed all the stored results to @p sink
+ *
+ * Within each branch, modules are replayed before module files, which refer to them.
+ */
+void MemorySink::replay(ResultSink &sink) const
+{
+	size_t fs = 0, c = 0, m = 0, mf = 0;
+
+	for (unsigned b = 0; b < m_branches.size(); ++b) {
+		sink.beginBranch(m_branches[b]);
+		for (; m < m_modules.branch.size() && m_modules.branch[m] == b; ++m)
+			sink.module(m_modules.module[m], m_modules.moduleConf[m],
+				    m_modules.supported[m]);
+		for (; mf < m_moduleFiles.branch.size() && m_moduleFiles.branch[mf] == b; ++mf)
+			sink.moduleFile(m_moduleFiles.srcPath[mf], m_moduleFiles.module[mf]);
+		for (; fs < m_fileSupps.branch.size() && m_fileSupps.branch[fs] == b; ++fs)
+			sink.fileSupp(m_fileSupps.srcPath[fs], m_fileSupps.enabled[fs],
+				      m_fileSupps.disabledConfig[fs], m_fileSupps.supported[fs]);
+		for (; c < m_configs.branch.size() && m_configs.branch[c] == b; ++c)
+			sink.config(m_configs.srcPath[c], m_configs.cond[c]);
+		sink.endBranch();
+	}
+}
+
+void MemorySink::clear()
+{
+	m_branches.clear();
+	m_fileSupps = {};
+	m_configs = {};
+	m_modules = {};
+	m_moduleFiles = {};
+}
@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "ResultSink.h"
+
+namespace TW {
+
+/**
+ * @brief ResultSink keeping everything in memory, column by column
+ *
+ * Each table holds one vector per column, the branch column being an index into branches().
+ * replay() feeds the stored results, grouped by branch, to another sink. With a target sink,
+ * every branch is replayed to it and dropped at endBranch(), so that the walk and storing its
+ * results can be measured separately.
+ */
+class MemorySink : public ResultSink {
+public:
+	struct FileSuppTable {
+		std::vector<unsigned> branch;
+		std::vector<std::filesystem::path> srcPath;
+		std::vector<SlKernCVS::ConfigValue> enabled;
+		std::vector<std::optional<std::string>> disabledConfig;
+		std::vector<SlKernCVS::SupportState> supported;
+	};
+
+	struct ConfigTable {
+		std::vector<unsigned> branch;
+		std::vector<std::filesystem::path> srcPath;
+		std::vector<std::string> cond;
+	};
+
+	struct ModuleTable {
+		std::vector<unsigned> branch;
+		std::vector<std::filesystem::path> module;
+		std::vector<std::string> moduleConf;
+		std::vector<SlKernCVS::SupportState> supported;
+	};
+
+	struct ModuleFileTable {
+		std::vector<unsigned> branch;
+		std::vector<std::filesystem::path> srcPath;
+		std::vector<std::filesystem::path> module;
+	};
+
+	MemorySink(std::unique_ptr<ResultSink> target = nullptr) : m_target(std::move(target)) {}
+
+	virtual void beginBranch(const std::string &branch) override;
+	virtual void endBranch() override;
+
+	virtual void fileSupp(const std::filesystem::path &srcPath,
+			      SlKernCVS::ConfigValue enabled,
+			      const std::optional<std::string> &disabledConfig,
+			      SlKernCVS::SupportState supported) override;
+
+	virtual void config(const std::filesystem::path &srcPath,
+			    const std::string &cond) override;
+
+	virtual void module(const std::filesystem::path &module,
+			    const std::string &moduleConf,
+			    SlKernCVS::SupportState supported) override;
+
+	virtual void moduleFile(const std::filesystem::path &srcPath,
+				const std::filesystem::path &module) override;
+
+	const std::vector<std::string> &branches() const { return m_branches; }
+	const FileSuppTable &fileSupps() const { return m_fileSupps; }
+	const ConfigTable &configs() const { return m_configs; }
+	const ModuleTable &modules() const { return m_modules; }
+	const ModuleFileTable &moduleFiles() const { return m_moduleFiles; }
+
+	size_t size() const {
+		return m_fileSupps.branch.size() + m_configs.branch.size() +
+			m_modules.branch.size() + m_moduleFiles.branch.size();
+	}
+
+	void replay(ResultSink &sink) const;
+	void clear();
+private:
+	unsigned curBranch() const { return m_branches.size() - 1; }
+
+	std::unique_ptr<ResultSink> m_target;
+	std::vector<std::string> m_branches;
+	FileSuppTable m_fileSupps;
+	ConfigTable m_configs;
+	ModuleTable m_modules;
+	ModuleFileTable m_moduleFiles;
+};
+
+}
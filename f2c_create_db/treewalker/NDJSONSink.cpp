@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <nlohmann/json.hpp>
+
+#include <sl/helpers/Exception.h>
+#include <sl/kerncvs/CollectConfigs.h>
+#include <sl/kerncvs/SupportedConf.h>
+
+#include "NDJSONSink.h"
+
+using namespace TW;
+
+using Json = nlohmann::ordered_json;
+using RunEx = SlHelpers::RuntimeException;
+using SlHelpers::raise;
+
+void NDJSONSink::endBranch()
+{
+	if (!m_os.flush())
+		RunEx("cannot write NDJSON of ") << m_branch << raise;
+}
+
+void NDJSONSink::fileSupp(const std::filesystem::path &srcPath,
+			  SlKernCVS::ConfigValue enabled,
+			  const std::optional<std::string> &disabledConfig,
+			  SlKernCVS::SupportState supported)
+{
+	Json json {
+		{ "table", "file_support_map" },
+		{ "branch", m_branch },
+		{ "file", srcPath.string() },
+		{ "enabled", std::string(1, static_cast<char>(enabled)) },
+		{ "disabled_config", nullptr },
+		{ "supported", std::string(SlKernCVS::getName(supported)) },
+	};
+	if (disabledConfig)
+		json["disabled_config"] = *disabledConfig;
+
+	m_os << json.dump() << '\n';
+}
+
+void NDJSONSink::config(const std::filesystem::path &srcPath, const std::string &cond)
+{
+	m_os << Json {
+		{ "table", "conf_file_map" },
+		{ "branch", m_branch },
+		{ "config", cond },
+		{ "file", srcPath.string() },
+	}.dump() << '\n';
+}
+
+void NDJSONSink::module(const std::filesystem::path &module, const std::string &moduleConf,
+			SlKernCVS::SupportState supported)
+{
+	m_os << Json {
+		{ "table", "module_details_map" },
+		{ "branch", m_branch },
+		{ "module", module.string() },
+		{ "config", moduleConf },
+		{ "supported", std::string(SlKernCVS::getName(supported)) },
+	}.dump() << '\n';
+}
+
+void NDJSONSink::moduleFile(const std::filesystem::path &srcPath,
+			    const std::filesystem::path &module)
+{
+	m_os << Json {
+		{ "table", "module_file_map" },
+		{ "branch", m_branch },
+		{ "module", module.string() },
+		{ "file", srcPath.string() },
+	}.dump() << '\n';
+}
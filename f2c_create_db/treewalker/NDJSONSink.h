@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <ostream>
+#include <string>
+
+#include "ResultSink.h"
+
+namespace TW {
+
+/**
+ * @brief ResultSink writing one JSON object per line
+ *
+ * Each object contains "table" (named after the corresponding DB table), "branch", and the
+ * columns of the row.
+ */
+class NDJSONSink : public ResultSink {
+public:
+	NDJSONSink() = delete;
+	NDJSONSink(std::ostream &os) : m_os(os) {}
+
+	virtual void beginBranch(const std::string &branch) override {
+		m_branch = branch;
+	}
+	virtual void endBranch() override;
+
+	virtual void fileSupp(const std::filesystem::path &srcPath,
+			      SlKernCVS::ConfigValue enabled,
+			      const std::optional<std::string> &disabledConfig,
+			      SlKernCVS::SupportState supported) override;
+
+	virtual void config(const std::filesystem::path &srcPath,
+			    const std::string &cond) override;
+
+	virtual void module(const std::filesystem::path &module,
+			    const std::string &moduleConf,
+			    SlKernCVS::SupportState supported) override;
+
+	virtual void moduleFile(const std::filesystem::path &srcPath,
+				const std::filesystem::path &module) override;
+private:
+	std::ostream &m_os;
+	std::string m_branch;
+};
+
+}
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+
+namespace SlKernCVS {
+enum class ConfigValue : char;
+enum class SupportState;
+}
+
+namespace TW {
+
+/**
+ * @brief Receiver of the results of TreeWalker
+ *
+ * beginBranch() is called before the walk of each branch, endBranch() after it.
+ */
+class ResultSink {
+public:
+	virtual ~ResultSink() = default;
+
+	virtual void beginBranch(const std::string &branch) = 0;
+	virtual void endBranch() {}
+
+	virtual void fileSupp(const std::filesystem::path &srcPath,
+			      SlKernCVS::ConfigValue enabled,
+			      const std::optional<std::string> &disabledConfig,
+			      SlKernCVS::SupportState supported) = 0;
+
+	virtual void config(const std::filesystem::path &srcPath, const std::string &cond) = 0;
+
+	virtual void module(const std::filesystem::path &module,
+			    const std::string &moduleConf,
+			    SlKernCVS::SupportState supported) = 0;
+
+	virtual void moduleFile(const std::filesystem::path &srcPath,
+				const std::filesystem::path &module) = 0;
+};
+
+/// @brief Discards everything, to measure the walk alone
+class NullSink : public ResultSink {
+public:
+	virtual void beginBranch(const std::string &) override {}
+
+	virtual void fileSupp(const std::filesystem::path &, SlKernCVS::ConfigValue,
+			      const std::optional<std::string> &,
+			      SlKernCVS::SupportState) override {}
+	virtual void config(const std::filesystem::path &, const std::string &) override {}
+	virtual void module(const std::filesystem::path &, const std::string &,
+			    SlKernCVS::SupportState) override {}
+	virtual void moduleFile(const std::filesystem::path &,
+				const std::filesystem::path &) override {}
+};
+
+}
@@ -22,7 +22,7 @@ using SlHelpers::raise;
 void SQLiteMakeVisitor::fileSupp(const std::filesystem::path &srcPath,
 				 SlKernCVS::ConfigValue enabled,
 				 const std::optional<std::string> &disabledConfig,
-				 SlKernCVS::SupportState supported) const
+				 SlKernCVS::SupportState supported)
 {
 	auto dirFile = sql.insertPath(srcPath);
 	if (!dirFile || !sql.insertFSMap(branch, std::move(dirFile->first),
@@ -34,7 +34,7 @@ void SQLiteMakeVisitor::fileSupp(const std::filesystem::path &srcPath,
 }
 
 void SQLiteMakeVisitor::config(const std::filesystem::path &srcPath,
-			       const std::string &cond) const
+			       const std::string &cond)
 {
 	if (F2C::verbose > 1)
 		std::cout << "SQL " << cond << " " << srcPath.string() << "\n";
@@ -47,7 +47,7 @@ void SQLiteMakeVisitor::config(const std::filesystem::path &srcPath,
 
 void SQLiteMakeVisitor::module(const std::filesystem::path &module,
 			       const std::string &moduleConf,
-			       SlKernCVS::SupportState supported) const
+			       SlKernCVS::SupportState supported)
 {
 	if (F2C::verbose > 1)
 		Clr() << "SQL MOD " << module.string() << ' ' << moduleConf;
@@ -61,7 +61,7 @@ void SQLiteMakeVisitor::module(const std::filesystem::path &module,
 }
 
 void SQLiteMakeVisitor::moduleFile(const std::filesystem::path &srcPath,
-				   const std::filesystem::path &module) const
+				   const std::filesystem::path &module)
 {
 	if (F2C::verbose > 1)
 		Clr() << "SQL MOD FILE " << module.string() << ' ' << srcPath.string();
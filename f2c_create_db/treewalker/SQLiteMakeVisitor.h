@@ -6,10 +6,7 @@
 #include <optional>
 #include <string>
 
-namespace SlKernCVS {
-enum class ConfigValue : char;
-enum class SupportState;
-}
+#include "ResultSink.h"
 
 namespace F2C {
 class F2CSQLConn;
@@ -17,30 +14,35 @@ class F2CSQLConn;
 
 namespace TW {
 
-class SQLiteMakeVisitor {
+/// @brief ResultSink storing into the DB
+class SQLiteMakeVisitor : public ResultSink {
 public:
 	SQLiteMakeVisitor() = delete;
-	SQLiteMakeVisitor(F2C::F2CSQLConn &sql, const std::string &branch) :
-		sql(sql), branch(branch) {}
+	SQLiteMakeVisitor(F2C::F2CSQLConn &sql) : sql(sql) {}
 
 	~SQLiteMakeVisitor() {}
 
-	void fileSupp(const std::filesystem::path &srcPath,
-		      SlKernCVS::ConfigValue enabled,
-		      const std::optional<std::string> &disabledConfig,
-		      SlKernCVS::SupportState supported) const;
+	virtual void beginBranch(const std::string &branch) override {
+		this->branch = branch;
+	}
+
+	virtual void fileSupp(const std::filesystem::path &srcPath,
+			      SlKernCVS::ConfigValue enabled,
+			      const std::optional<std::string> &disabledConfig,
+			      SlKernCVS::SupportState supported) override;
 
-	void config(const std::filesystem::path &srcPath, const std::string &cond) const;
+	virtual void config(const std::filesystem::path &srcPath,
+			    const std::string &cond) override;
 
-	void module(const std::filesystem::path &module,
-		    const std::string &moduleConf,
-		    SlKernCVS::SupportState supported) const;
+	virtual void module(const std::filesystem::path &module,
+			    const std::string &moduleConf,
+			    SlKernCVS::SupportState supported) override;
 
-	void moduleFile(const std::filesystem::path &srcPath,
-			const std::filesystem::path &module) const;
+	virtual void moduleFile(const std::filesystem::path &srcPath,
+				const std::filesystem::path &module) override;
 private:
 	F2C::F2CSQLConn &sql;
-	const std::string branch;
+	std::string branch;
 };
 
 }
@@ -1,5 +1,6 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -15,6 +16,7 @@
 
 #include "../parser/make/EntryVisitor.h"
 #include "TreeWalker.h"
+#include "../ThreadPool.h"
 #include "../Verbose.h"
 
 using namespace TW;
@@ -81,13 +83,16 @@ void TreeWalker::addDefaultKernelFiles(CondStack s, const std::filesystem::path
 		appendToWalk(std::move(s), std::move(s390Boot));
 }
 
-TreeWalker::TreeWalker(F2C::F2CSQLConn &sql, const SlKernCVS::SupportedConf &supp,
+TreeWalker::TreeWalker(ResultSink &sink, F2C::ThreadPool &pool,
+		       const SlKernCVS::SupportedConf &supp,
 		       const std::string &branch, const std::filesystem::path &start,
 		       const Kconfig::Config::Configs &configs,
 		       const F2C::EnabledConfigMap &enabledConfigs) :
-	m_supp(supp), m_configs(configs), m_enabledConfigs(enabledConfigs),
-	m_makeVisitor(sql, branch), start(start)
+	m_pool(pool), m_supp(supp), m_configs(configs), m_enabledConfigs(enabledConfigs),
+	m_sink(sink), start(start), m_prefetched(0)
 {
+	m_sink.beginBranch(branch);
+
 	CondStack s { "y" };
 
 	if (std::filesystem::exists(start/"Documentation"))
@@ -96,6 +101,14 @@ TreeWalker::TreeWalker(F2C::F2CSQLConn &sql, const SlKernCVS::SupportedConf &sup
 		addDirectory(start, std::move(s), start);
 }
 
+TreeWalker::~TreeWalker()
+{
+	// the parsing tasks refer to this, e.g. when walk() threw
+	for (const auto &e: m_toWalk)
+		if (e.parsed.valid())
+			e.parsed.wait();
+}
+
 void TreeWalker::addTargetEntry(CondStack s,
 				const std::filesystem::path &objPath,
 				std::string cond,
@@ -184,7 +197,7 @@ bool TreeWalker::tryHandleTarget(CondStack s, const std::filesystem::path &objPa
 		bool &found;
 	} visitor(*this, s, objPath, lookingFor, found);
 
-	parser.walkAST(archs, visitor, start, objPath.parent_path());
+	parser->walkAST(archs, visitor, start, objPath.parent_path());
 
 	if (F2C::verbose > 1) {
 		std::cout << __func__ << " DONE: obj=" << objPath << " found=" << found << '\n';
@@ -235,7 +248,48 @@ void TreeWalker::appendToWalk(CondStack s, std::filesystem::path kbPath, std::fi
 	}
 	if (cwd.empty())
 		cwd = kbPath.parent_path();
-	m_toWalk.emplace(std::move(s), std::move(kbPath), std::move(cwd));
+	m_toWalk.emplace_back(std::move(s), std::move(kbPath), std::move(cwd));
+	prefetch();
+}
+
+std::unique_ptr<MP::Parser> TreeWalker::getParser()
+{
+	std::lock_guard lock(m_freeParsersLock);
+	if (m_freeParsers.empty())
+		return std::make_unique<MP::Parser>();
+
+	auto p = std::move(m_freeParsers.back());
+	m_freeParsers.pop_back();
+	return p;
+}
+
+/// @brief Parse @p kbPath using a parser from m_freeParsers. Runs in m_pool.
+std::unique_ptr<MP::Parser> TreeWalker::parse(const std::filesystem::path &kbPath)
+{
+	auto p = getParser();
+	if (!p->parse(kbPath))
+		RunEx("cannot parse ") << kbPath << raise;
+
+	return p;
+}
+
+/**
+ * @brief Parse the files at the front of the queue in m_pool
+ *
+ * The walker consumes the queue in order, so the files it needs next are being (or were
+ * already) parsed while it evaluates the current one and writes the results. The number of
+ * files parsed ahead is limited, as each holds its tree until walked.
+ */
+void TreeWalker::prefetch()
+{
+	const auto window = std::min<size_t>(m_toWalk.size(), m_pool.size() * 4);
+
+	for (; m_prefetched < window; ++m_prefetched) {
+		auto &e = m_toWalk[m_prefetched];
+		e.parsed = m_pool.push([this, kbPath = e.kbPath]() {
+			return parse(kbPath);
+		});
+	}
 }
 
 constexpr int TreeWalker::getSuppStateWeight(SlKernCVS::SupportState supp)
@@ -259,17 +313,18 @@ constexpr bool TreeWalker::moreSupported(SlKernCVS::ConfigValue enabledOld,
 	return getSuppStateWeight(supportedOld) < getSuppStateWeight(supportedNew);
 }
 
-bool TreeWalker::moreSupported(const std::string &cond,
-			       const std::filesystem::path &relSrcPath,
-			       SlKernCVS::ConfigValue enabled,
-			       SlKernCVS::SupportState supported)
+void TreeWalker::updateFileSupp(const std::string &cond,
+				const std::filesystem::path &relSrcPath,
+				SlKernCVS::ConfigValue enabled,
+				const std::optional<std::string> &disabledConfig,
+				SlKernCVS::SupportState supported)
 {
-	auto mapVal = std::make_pair(enabled, supported);
-	auto [old, inserted] = m_visitedSources.try_emplace(relSrcPath, mapVal);
+	auto [old, inserted] = m_visitedSources.try_emplace(relSrcPath, enabled, disabledConfig,
+							     supported);
 	if (inserted)
-		return true;
+		return;
 
-	auto [enabledOld, supportedOld] = old->second;
+	auto &[enabledOld, disabledConfigOld, supportedOld] = old->second;
 	if (!moreSupported(enabledOld, supportedOld, enabled, supported)) {
 		if (F2C::verbose > 1 &&
 		    (enabledOld != enabled || supportedOld != supported))
@@ -278,12 +333,27 @@ bool TreeWalker::moreSupported(const std::string &cond,
 				getName(supportedOld) << ", now with " << cond <<
 				'/' << static_cast<char>(enabled) << '/' <<
 				getName(supported);
-		return false;
+		return;
 	}
 
-	old->second = std::move(mapVal);
+	old->second = { enabled, disabledConfig, supported };
+}
 
-	return true;
+/// @brief Write the final state of all sources to m_sink, sorted by path
+void TreeWalker::flushFileSupps()
+{
+	std::vector<decltype(m_visitedSources)::const_pointer> sorted;
+	sorted.reserve(m_visitedSources.size());
+	for (const auto &e: m_visitedSources)
+		sorted.push_back(&e);
+
+	std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+		return a->first < b->first;
+	});
+
+	for (const auto &e: sorted)
+		m_sink.fileSupp(e->first, e->second.enabled, e->second.disabledConfig,
+				e->second.supported);
 }
 
 /**
@@ -361,16 +431,15 @@ void TreeWalker::handleCSource(const std::string &cond,
 		return;
 
 	if (!relModule.empty())
-		m_makeVisitor.moduleFile(relSrcPath, relModule);
+		m_sink.moduleFile(relSrcPath, relModule);
 
 	if (m_configs.contains(cond))
-		m_makeVisitor.config(relSrcPath, cond);
+		m_sink.config(relSrcPath, cond);
 	else if (F2C::verbose > 0)
 		Clr(std::cerr, Clr::YELLOW) << relSrcPath << " depends on \"" << cond <<
 					       "\", but that is not defined!";
 
-	if (moreSupported(cond, relSrcPath, enabled, supported))
-		m_makeVisitor.fileSupp(relSrcPath, enabled, disabledConfig, supported);
+	updateFileSupp(cond, relSrcPath, enabled, disabledConfig, supported);
 
 	for (auto &includePath: includesInCSource(srcPath))
 		handleCSource(cond, std::move(includePath), enabled, disabledConfig, relModule,
@@ -432,7 +501,7 @@ void TreeWalker::handleObject(CondStack &&s, std::filesystem::path &&objPath,
 		srcPath.replace_extension(suffix);
 		if (std::filesystem::exists(srcPath)) {
 			if (auto confOpt = getTristateConf(s))
-				m_makeVisitor.module(relModule, *confOpt, supported);
+				m_sink.module(relModule, *confOpt, supported);
 			else
 				relModule.clear();
 
@@ -483,8 +552,11 @@ void TreeWalker::handleKbuildFile(ToWalkEntry &&entry)
 	if (F2C::verbose > 1)
 		std::cout << __func__ << ": " << entry.kbPath << "\n";
 
-	if (!parser.parse(entry.kbPath))
-		RunEx("cannot parse ") << entry.kbPath << raise;
+	if (parser) {
+		std::lock_guard lock(m_freeParsersLock);
+		m_freeParsers.push_back(std::move(parser));
+	}
+	parser = entry.parsed.valid() ? entry.parsed.get() : parse(entry.kbPath);
 
 	class RegularVisitor : public MP::EntryVisitor {
 	public:
@@ -544,7 +616,7 @@ void TreeWalker::handleKbuildFile(ToWalkEntry &&entry)
 		ToWalkEntry &m_entry;
 	} visitor(*this, entry);
 
-	parser.walkAST(archs, visitor, start, entry.cwd);
+	parser->walkAST(archs, visitor, start, entry.cwd);
 }
 
 /// @brief Find Kbuild or Makefile in @p path and add it to the queue
@@ -574,6 +646,13 @@ void TreeWalker::addDirectory(const std::filesystem::path &kbPath, CondStack s,
 /// the constructor.
 void TreeWalker::walk()
 {
-	for (; !m_toWalk.empty(); m_toWalk.pop())
+	while (!m_toWalk.empty()) {
+		prefetch();
 		handleKbuildFile(std::move(m_toWalk.front()));
+		m_toWalk.pop_front();
+		m_prefetched--;
+	}
+
+	flushFileSupps();
+	m_sink.endBranch();
 }
@@ -3,10 +3,13 @@
 #pragma once
 
 #include <any>
+#include <deque>
 #include <filesystem>
 #include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <optional>
-#include <queue>
 #include <set>
 #include <unordered_set>
 #include <string>
@@ -15,7 +18,7 @@
 #include "../Configs.h"
 #include "../parser/make/Parser.h"
 #include "../parser/kconfig/Config.h"
-#include "SQLiteMakeVisitor.h"
+#include "ResultSink.h"
 
 namespace SlKernCVS {
 class SupportedConf;
@@ -27,6 +30,10 @@ namespace MP {
 enum EntryType : unsigned int;
 }
 
+namespace F2C {
+class ThreadPool;
+}
+
 namespace TW {
 
 class TreeWalker
@@ -35,10 +42,12 @@ public:
 	using CondStack = std::vector<std::string>;
 
 	TreeWalker() = delete;
-	TreeWalker(F2C::F2CSQLConn &sql, const SlKernCVS::SupportedConf &supp,
+	TreeWalker(ResultSink &sink, F2C::ThreadPool &pool,
+		   const SlKernCVS::SupportedConf &supp,
 		   const std::string &branch, const std::filesystem::path &start,
 		   const Kconfig::Config::Configs &configs,
 		   const F2C::EnabledConfigMap &enabledConfigs);
+	~TreeWalker();
 
 	void walk();
 
@@ -54,6 +63,7 @@ private:
 		CondStack cs;
 		std::filesystem::path kbPath;
 		std::filesystem::path cwd; // kbPath's dir except for make's "include"
+		std::future<std::unique_ptr<MP::Parser>> parsed; // valid once prefetch()ed
 	};
 
 	auto startRelative(const std::filesystem::path &path) const {
@@ -82,10 +92,12 @@ private:
 			  const std::filesystem::path &path);
 	std::pair<SlKernCVS::ConfigValue, std::optional<std::string>>
 	enabledState(const CondStack &s);
-	bool moreSupported(const std::string &cond,
-			   const std::filesystem::path &relSrcPath,
-			   SlKernCVS::ConfigValue enabled,
-			   SlKernCVS::SupportState supported);
+	void updateFileSupp(const std::string &cond,
+			    const std::filesystem::path &relSrcPath,
+			    SlKernCVS::ConfigValue enabled,
+			    const std::optional<std::string> &disabledConfig,
+			    SlKernCVS::SupportState supported);
+	void flushFileSupps();
 	void handleCSource(const std::string &cond,
 			   std::filesystem::path &&srcPath,
 			   SlKernCVS::ConfigValue enabled,
@@ -103,20 +115,35 @@ private:
 	void appendToWalk(CondStack s, std::filesystem::path kbPath,
 			  std::filesystem::path cwd = {});
 
-	MP::Parser parser;
+	std::unique_ptr<MP::Parser> getParser();
+	std::unique_ptr<MP::Parser> parse(const std::filesystem::path &kbPath);
+	void prefetch();
+
+	F2C::ThreadPool &m_pool;
+	/// @brief Parser of the file being walked
+	std::unique_ptr<MP::Parser> parser;
+	std::mutex m_freeParsersLock;
+	std::vector<std::unique_ptr<MP::Parser>> m_freeParsers;
 	std::unordered_multimap<std::string, std::string> m_vars;
 	const SlKernCVS::SupportedConf &m_supp;
 	const Kconfig::Config::Configs &m_configs;
 	const F2C::EnabledConfigMap &m_enabledConfigs;
-	const SQLiteMakeVisitor m_makeVisitor;
+	ResultSink &m_sink;
 
 	std::filesystem::path start;
 	std::vector<std::string> archs;
-	std::queue<ToWalkEntry> m_toWalk;
+	std::deque<ToWalkEntry> m_toWalk;
+	/// @brief Number of entries at the front of m_toWalk being parsed ahead
+	size_t m_prefetched;
 	PathSet m_skipMakefiles;
 	std::set<std::pair<std::filesystem::path, CondStack>> m_visitedMakefiles;
-	std::unordered_map<std::filesystem::path,
-		std::pair<SlKernCVS::ConfigValue, SlKernCVS::SupportState>> m_visitedSources;
+	struct FileSupp {
+		SlKernCVS::ConfigValue enabled;
+		std::optional<std::string> disabledConfig;
+		SlKernCVS::SupportState supported;
+	};
+	/// @brief The most supported state of each source, flushed to m_sink by walk()
+	std::unordered_map<std::filesystem::path, FileSupp> m_visitedSources;
 };
 
 }
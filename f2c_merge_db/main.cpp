@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+#include <cxxopts.hpp>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sl/helpers/Color.h>
+#include <sl/helpers/Exception.h>
+
+#include "AtomicFile.h"
+#include "F2CSQLConn.h"
+#include "Merger.h"
+
+using Clr = SlHelpers::Color;
+using RunEx = SlHelpers::RuntimeException;
+using SlHelpers::raise;
+
+using namespace F2C;
+
+namespace {
+
+struct Opts {
+	std::filesystem::path output;
+	std::vector<std::filesystem::path> shards;
+	bool update;
+};
+
+Opts getOpts(int argc, char **argv)
+{
+	cxxopts::Options options { argv[0], "Merge dbs created by f2c_create_db --shard-dir" };
+	Opts opts {};
+	options.add_options()
+		("h,help", "Print this help message")
+		("o,output", "the merged db (replaced atomically)",
+			cxxopts::value(opts.output)->default_value("conf_file_map.sqlite"))
+		("u,update", "merge into a copy of the existing output, replacing the branches "
+			"(and renames) the shards contain",
+			cxxopts::value(opts.update)->default_value("false"))
+		("shards", "shards to merge (files or directories)",
+			cxxopts::value(opts.shards))
+	;
+	options.parse_positional({ "shards" });
+	options.positional_help("shard...");
+
+	try {
+		auto cxxopts = options.parse(argc, argv);
+		if (cxxopts.contains("help")) {
+			std::cout << options.help();
+			exit(0);
+		}
+
+		if (opts.shards.empty()) {
+			Clr(std::cerr, Clr::RED) << "No shards specified";
+			std::cerr << options.help();
+			exit(EXIT_FAILURE);
+		}
+
+		return opts;
+	} catch (const cxxopts::exceptions::parsing &e) {
+		Clr(std::cerr, Clr::RED) << "arguments error: " << e.what();
+		std::cerr << options.help();
+		exit(EXIT_FAILURE);
+	}
+}
+
+/// @brief Expand directories in @p shards to the *.sqlite files in them
+std::vector<std::filesystem::path> expandShards(const std::vector<std::filesystem::path> &shards)
+{
+	std::vector<std::filesystem::path> ret;
+
+	for (const auto &shard: shards) {
+		if (!std::filesystem::is_directory(shard)) {
+			ret.push_back(shard);
+			continue;
+		}
+
+		std::vector<std::filesystem::path> files;
+		for (const auto &e: std::filesystem::directory_iterator(shard))
+			if (e.is_regular_file() && e.path().extension() == ".sqlite")
+				files.push_back(e.path());
+		std::sort(files.begin(), files.end());
+		ret.insert(ret.end(), files.begin(), files.end());
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Merge the attached shard, replacing what it contains in the output
+ *
+ * The branches of the shard are deleted first, the rest of their rows cascades. A shard with
+ * renames (renames.sqlite) has them for all versions, so it replaces all of them.
+ */
+void replaceAttached(Merger &merger)
+{
+	merger.exec("BEGIN;");
+	merger.exec("DELETE FROM branch WHERE branch IN (SELECT branch FROM shard.branch);");
+	merger.exec("DELETE FROM rename_file_version_map WHERE EXISTS "
+		    "(SELECT 1 FROM shard.rename_file_version_map);");
+	merger.mergeAttached();
+	merger.exec("COMMIT;");
+}
+
+/**
+ * @brief Merge the shards into a temporary db and rename it over --output
+ *
+ * The temporary db is not journaled, it is thrown away on errors anyway. It is analyzed and
+ * synced before the rename, and the directory after it, so that the output is replaced
+ * atomically even across crashes.
+ */
+void handleEx(int argc, char **argv)
+{
+	const auto opts = getOpts(argc, argv);
+	const auto shards = expandShards(opts.shards);
+	const auto update = opts.update && std::filesystem::exists(opts.output);
+
+	auto tmp = opts.output;
+	tmp += ".tmp";
+	std::filesystem::remove(tmp);
+	if (update)
+		std::filesystem::copy_file(opts.output, tmp);
+
+	try {
+		F2CSQLConn sql;
+		if (!sql.openDB(tmp, SlSqlite::OpenFlags::CREATE))
+			RunEx("Cannot create the db at ") << tmp << ": " << sql.lastError() <<
+							     raise;
+		if (!sql.createDB())
+			RunEx("Cannot create tables: ") << sql.lastError() << raise;
+
+		if (!sql.exec("PRAGMA journal_mode = OFF;") || !sql.exec("PRAGMA synchronous = OFF;"))
+			RunEx("Cannot set up the db: ") << sql.lastError() << raise;
+		// the replaced branches cascade
+		if (update && !sql.foreignKeys(true))
+			RunEx("Cannot enable foreign keys: ") << sql.lastError() << raise;
+
+		Merger merger(sql);
+		merger.prepare();
+		for (const auto &shard: shards) {
+			Clr(Clr::GREEN) << "== Merging " << shard << " ==";
+			if (update) {
+				merger.attach(shard);
+				replaceAttached(merger);
+				merger.detach();
+			} else {
+				merger.merge(shard);
+			}
+		}
+
+		if (!sql.exec("ANALYZE;"))
+			RunEx("Cannot ANALYZE the db: ") << sql.lastError() << raise;
+	} catch (...) {
+		std::filesystem::remove(tmp);
+		throw;
+	}
+
+	AtomicFile::sync(tmp);
+	std::filesystem::rename(tmp, opts.output);
+	AtomicFile::sync(std::filesystem::absolute(opts.output).parent_path());
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	try {
+		handleEx(argc, argv);
+	} catch (std::runtime_error &e) {
+		Clr(std::cerr, Clr::RED) << e.what();
+		return EXIT_FAILURE;
+	}
+
+	return 0;
+}
@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <sl/helpers/Color.h>
+
+#include "Delta.h"
+#include "F2CSQLConn.h"
+
+using Clr = SlHelpers::Color;
+using F2C::Delta;
+
+namespace {
+
+class TmpDir {
+public:
+	TmpDir(const std::string &name) :
+		m_dir(std::filesystem::temp_directory_path() / name) {
+		std::filesystem::remove_all(m_dir);
+		std::filesystem::create_directories(m_dir);
+	}
+	~TmpDir() { std::filesystem::remove_all(m_dir); }
+
+	std::filesystem::path operator/(const std::string &file) const { return m_dir / file; }
+private:
+	std::filesystem::path m_dir;
+};
+
+/**
+ * @brief Publish revision @p rev of a db
+ *
+ * 1 has SLE15-SP6 and master, 2 changes master's SHA and adds stable, 3 changes only rows of
+ * SLE15-SP6 (not its SHA) and the renames.
+ */
+void createDB(const std::filesystem::path &file, unsigned rev)
+{
+	std::filesystem::remove(file);
+
+	F2C::F2CSQLConn sql;
+	assert(sql.openDB(file, SlSqlite::OpenFlags::CREATE));
+	assert(sql.createDB());
+	assert(sql.prepDB());
+
+	assert(sql.insertSupported(0, "unsupported"));
+	assert(sql.insertSupported(1, "supported"));
+	assert(sql.insertConfigType(1, "tristate"));
+	for (const auto config: { "FOO", "BAR", "BAZ" })
+		assert(sql.insertConfig(config, 1));
+	for (const auto email: { "dev@suse.com", "other@suse.com" })
+		assert(sql.insertUser(email));
+	assert(sql.insertArch("x86_64"));
+	assert(sql.insertFlavor("default"));
+	for (const auto file: { "foo.c", "bar.c", "baz.c" })
+		assert(sql.insertPath(std::filesystem::path("drivers/net") / file));
+	assert(sql.insertModule("drivers/net", "foo.ko", "FOO"));
+
+	const auto fillBranch = [&sql](const std::string &branch, const std::string &sha,
+				       const std::string &file, const std::string &email) {
+		assert(sql.insertBranch(branch, sha, 6));
+		assert(sql.insertCBColumn(branch, 0, "x86_64", "default"));
+		assert(sql.insertCBMap(branch, "FOO", "m"));
+		assert(sql.insertCFMap(branch, "FOO", "drivers/net", file));
+		assert(sql.insertFSMap(branch, "drivers/net", file, "m", std::nullopt, 1));
+		assert(sql.insertMDMap(branch, "drivers/net", "foo.ko", 1));
+		assert(sql.insertMFMap(branch, "drivers/net", "foo.ko", "drivers/net", file));
+		assert(sql.insertUFMap(branch, email, "drivers/net", file, 3, 2));
+		assert(sql.insertIFBMap(branch, "drivers/net", "baz.c"));
+	};
+
+	fillBranch("SLE15-SP6", "1234", "foo.c", rev < 3 ? "dev@suse.com" : "other@suse.com");
+	fillBranch("master", rev < 2 ? "5678" : "8765", rev < 2 ? "foo.c" : "bar.c",
+		   "dev@suse.com");
+	if (rev >= 2)
+		fillBranch("stable", "abcd", "baz.c", "dev@suse.com");
+
+	assert(sql.insertRFVMap(6, 90, "drivers/net", "foo.c", "drivers/net", "bar.c"));
+	if (rev >= 3)
+		assert(sql.insertRFVMap(7, 80, "drivers/net", "bar.c", "drivers/net", "baz.c"));
+}
+
+/// @brief Like the download in f2c_cli, but from a directory
+Delta::Fetch fetchFrom(const std::filesystem::path &dir)
+{
+	return [dir](const std::string &file, const std::filesystem::path &dest) {
+		std::error_code ec;
+		std::filesystem::copy_file(dir / file, dest,
+					   std::filesystem::copy_options::overwrite_existing, ec);
+		return !ec;
+	};
+}
+
+/// @brief Revisions 1 to 3 published into @p pub with the deltas between them
+void publish(const TmpDir &tmp, const std::filesystem::path &pub)
+{
+	for (auto rev = 1U; rev <= 3; ++rev)
+		createDB(tmp / ("rev" + std::to_string(rev) + ".sqlite"), rev);
+
+	Delta::reset(tmp / "rev1.sqlite", pub / "deltas");
+	Delta::create(tmp / "rev1.sqlite", tmp / "rev2.sqlite", pub / "deltas");
+	Delta::create(tmp / "rev2.sqlite", tmp / "rev3.sqlite", pub / "deltas");
+}
+
+void testState()
+{
+	Clr(std::cerr, Clr::GREEN) << __func__;
+
+	TmpDir tmp("f2c-test-delta-state");
+	createDB(tmp / "a.sqlite", 2);
+	createDB(tmp / "b.sqlite", 2);
+	createDB(tmp / "c.sqlite", 3);
+
+	assert(Delta::state(tmp / "a.sqlite") == Delta::state(tmp / "b.sqlite"));
+	// the same SHAs, but different rows
+	assert(Delta::state(tmp / "a.sqlite") != Delta::state(tmp / "c.sqlite"));
+}
+
+void testUpdate()
+{
+	Clr(std::cerr, Clr::GREEN) << __func__;
+
+	TmpDir tmp("f2c-test-delta-update");
+	const auto pub = tmp / "pub";
+	publish(tmp, pub);
+
+	const auto db = tmp / "client.sqlite";
+	std::filesystem::copy_file(tmp / "rev1.sqlite", db);
+	assert(Delta::update(db, fetchFrom(pub), tmp / "work"));
+	assert(Delta::state(db) == Delta::state(tmp / "rev3.sqlite"));
+
+	// nothing to do
+	assert(Delta::update(db, fetchFrom(pub), tmp / "work"));
+	assert(Delta::state(db) == Delta::state(tmp / "rev3.sqlite"));
+
+	// from the middle of the chain
+	std::filesystem::copy_file(tmp / "rev2.sqlite", db,
+				   std::filesystem::copy_options::overwrite_existing);
+	assert(Delta::update(db, fetchFrom(pub), tmp / "work"));
+	assert(Delta::state(db) == Delta::state(tmp / "rev3.sqlite"));
+}
+
+void testUpdateFails()
+{
+	Clr(std::cerr, Clr::GREEN) << __func__;
+
+	TmpDir tmp("f2c-test-delta-fail");
+	const auto pub = tmp / "pub";
+	publish(tmp, pub);
+
+	const auto db = tmp / "client.sqlite";
+	std::filesystem::copy_file(tmp / "rev1.sqlite", db);
+	const auto state = Delta::state(db);
+
+	// no index
+	assert(!Delta::update(db, fetchFrom(tmp / "nowhere"), tmp / "work"));
+	assert(Delta::state(db) == state);
+
+	// a db the chain does not start from
+	createDB(tmp / "rev0.sqlite", 3);
+	{
+		F2C::F2CSQLConn sql;
+		assert(sql.openDB(tmp / "rev0.sqlite", SlSqlite::OpenFlags::NONE));
+		assert(sql.prepDB());
+		assert(sql.insertBranch("unknown", "0000", 6));
+	}
+	assert(!Delta::update(tmp / "rev0.sqlite", fetchFrom(pub), tmp / "work"));
+
+	// a corrupted delta leaves the db alone
+	for (const auto &e: std::filesystem::directory_iterator(pub / "deltas"))
+		if (e.path().extension() == ".sqlite")
+			std::ofstream(e.path(), std::ios::app) << "garbage";
+	assert(!Delta::update(db, fetchFrom(pub), tmp / "work"));
+	assert(Delta::state(db) == state);
+	assert(!std::filesystem::exists(db.string() + ".tmp"));
+}
+
+} // namespace
+
+int main()
+{
+	testState();
+	testUpdate();
+	testUpdateFails();
+
+	return 0;
+}
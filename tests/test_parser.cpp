@@ -1,15 +1,21 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <set>
 
 #include <sl/helpers/Color.h>
 #include <string_view>
 
+#include "kconfig/Finder.h"
 #include "kconfig/Parser.h"
 #include "make/EntryVisitor.h"
 #include "make/Parser.h"
+#include "MMapCharStream.h"
+#include "ModeCache.h"
 
 using Clr = SlHelpers::Color;
 
@@ -123,6 +129,165 @@ void testMakefiles(const std::filesystem::path &makefiles)
 			testMakefile(entry.path());
 }
 
+class RecordingVisitor : public MP::EntryVisitor {
+public:
+	using Log = std::vector<std::string>;
+
+	RecordingVisitor(Log &log) : m_log(log) {}
+
+	virtual std::any isInteresting(const std::string &lhs) const override {
+		m_log.push_back("interesting " + lhs);
+		return true;
+	}
+
+	virtual void entry(const std::any &, const std::string &cond,
+			   MP::EntryType type, std::string &&word) const override {
+		m_log.push_back("entry " + cond + ' ' + std::to_string(type) + ' ' + word);
+	}
+
+	virtual void include(std::filesystem::path &&dest) const override {
+		m_log.push_back("include " + dest.string());
+	}
+
+	virtual std::vector<std::string> getVariable(const std::string &id) const override {
+		std::vector<std::string> res;
+		for (auto [it, end] = m_vars.equal_range(id); it != end; ++it)
+			res.push_back(it->second);
+		return res;
+	}
+
+	virtual void setVariable(const std::string &id, bool reset,
+				 const std::string &val) const override {
+		m_log.push_back("set " + id + ' ' + std::to_string(reset) + ' ' + val);
+		if (reset)
+			m_vars.erase(id);
+		m_vars.emplace(id, val);
+	}
+
+	virtual void enterConditional(std::string &&cond) const override {
+		m_log.push_back("enter " + cond);
+	}
+
+	virtual void exitConditional() const override {
+		m_log.push_back("exit");
+	}
+private:
+	Log &m_log;
+	mutable std::unordered_multimap<std::string, std::string> m_vars;
+};
+
+RecordingVisitor::Log record(MP::Parser &parser, const std::filesystem::path &dir)
+{
+	RecordingVisitor::Log log;
+	RecordingVisitor visitor(log);
+
+	parser.walkAST({ "arm64", "x86" }, visitor, dir, dir);
+
+	return log;
+}
+
+/// @brief Check that FastParser and ANTLR produce the same callbacks for @p file
+bool compareParsers(MP::Parser &fast, MP::Parser &slow, const std::filesystem::path &file)
+{
+	if (!fast.parse(file) || !fast.fastParsed())
+		return true;
+
+	if (!slow.parse(file)) {
+		Clr(std::cerr, Clr::RED) << file << ": accepted by the fast path only";
+		return false;
+	}
+
+	if (record(fast, file.parent_path()) != record(slow, file.parent_path())) {
+		Clr(std::cerr, Clr::RED) << file << ": fast path differs from ANTLR";
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Differential test of FastParser against ANTLR
+ *
+ * Set F2C_KERNEL_TREE to a kernel tree to compare all its Kbuild files and Makefiles.
+ */
+void testFastPath(const std::filesystem::path &makefiles)
+{
+	Clr(std::cerr, Clr::GREEN) << __func__;
+
+	MP::Parser fast;
+	MP::Parser slow(false);
+
+	static constinit std::string_view kbuild(
+		"# SPDX-License-Identifier: GPL-2.0\n"
+		"VAR := mod-var\n"
+		"VAR += $(VAR)2 \\\n"
+		"\tmore\n"
+		"ccflags-y += -I$(srctree)/include -Wall\n"
+		"obj-y += core.o dir/\n"
+		"obj-$(CONFIG_ABC) += abc.o # comment\n"
+		"obj-y$(CONFIG_MMU_SUN3) += dma.o\n"
+		"abc-y := $(VAR).o abc-$(BITS).o abc-$(SRCARCH).o\n"
+		"abc-objs += ${VAR}-objs.o\n"
+		"subdir-ccflags-y := -Werror\n"
+		"ifeq ($(CONFIG_DEF),y)\n"
+		"  obj-m += def.o\n"
+		"else ifneq ($(CONFIG_GHI),)\n"
+		"\tobj-$(CONFIG_GHI) += ghi/\n"
+		"else\n"
+		"ifdef CONFIG_JKL\n"
+		"obj-y += jkl.o\n"
+		"endif\n"
+		"endif\n"
+		"ifndef CONFIG_MNO\n"
+		"EMPTY :=\n"
+		"endif # CONFIG_MNO\n"
+		"-include $(src)/non-existent\n"
+	);
+
+	assert(fast.parse(kbuild));
+	assert(fast.fastParsed());
+	assert(slow.parse(kbuild));
+	assert(!slow.fastParsed());
+	auto fastLog = record(fast, "/src");
+	assert(!fastLog.empty());
+	assert(fastLog == record(slow, "/src"));
+
+	// rules, functions and the like are left to ANTLR
+	static constinit std::string_view rule(
+		"obj-y += $(addprefix dir/, a.o b.o)\n"
+		"$(obj)/a.o: $(src)/a.c\n"
+		"\t$(call cmd,cc_o_c)\n"
+	);
+	assert(fast.parse(rule));
+	assert(!fast.fastParsed());
+
+	std::error_code ec;
+	for (const auto &entry : std::filesystem::directory_iterator{makefiles, ec})
+		if (entry.is_regular_file())
+			assert(compareParsers(fast, slow, entry.path()));
+	assert(!ec);
+
+	auto kernelTree = std::getenv("F2C_KERNEL_TREE");
+	if (!kernelTree)
+		return;
+
+	auto files = 0U, failed = 0U;
+	for (const auto &entry : std::filesystem::recursive_directory_iterator{kernelTree}) {
+		if (!entry.is_regular_file())
+			continue;
+		const auto name = entry.path().filename().string();
+		if (name != "Kbuild" && !name.starts_with("Makefile"))
+			continue;
+		files++;
+		if (!compareParsers(fast, slow, entry.path()))
+			failed++;
+	}
+
+	Clr(std::cerr) << "compared " << files << " files from " << kernelTree << ", " <<
+			  failed << " differ";
+	assert(!failed);
+}
+
 void testKconfig()
 {
 	Clr(std::cerr, Clr::GREEN) << __func__;
@@ -150,6 +315,337 @@ void testKconfig()
 	assert(configs["DEF"] == Kconfig::ConfType::Bool);
 }
 
+using KconfigLog = std::vector<std::string>;
+
+KconfigLog recordConfigs(const Kconfig::Parser &parser)
+{
+	KconfigLog log;
+
+	parser.walk([&log](auto conf, auto type) {
+		log.push_back("config " + conf + ' ' +
+			      std::string(Kconfig::Config::getName(type)));
+	}, [&log](auto source) {
+		log.push_back("source " + source.path + ' ' + std::to_string(source.relative) +
+			      std::to_string(source.optional));
+	});
+
+	return log;
+}
+
+/// @brief Check that Kconfig::FastParser and ANTLR produce the same configs for @p file
+bool compareKconfigParsers(Kconfig::Parser &fast, Kconfig::Parser &slow,
+			   const std::filesystem::path &file)
+{
+	if (!fast.parse(file) || !fast.fastParsed())
+		return true;
+
+	if (!slow.parse(file, false)) {
+		Clr(std::cerr, Clr::RED) << file << ": accepted by the fast path only";
+		return false;
+	}
+
+	if (recordConfigs(fast) != recordConfigs(slow)) {
+		Clr(std::cerr, Clr::RED) << file << ": fast path differs from ANTLR";
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Differential test of Kconfig::FastParser against ANTLR
+ *
+ * Set F2C_KERNEL_TREE to a kernel tree to compare all its Kconfig files.
+ */
+void testKconfigFastPath()
+{
+	Clr(std::cerr, Clr::GREEN) << __func__;
+
+	Kconfig::Parser fast;
+	Kconfig::Parser slow(false);
+
+	static constinit std::string_view kconf(
+		"# SPDX-License-Identifier: GPL-2.0-only\n"
+		"source \"arch/$(SRCARCH)/Kconfig\"\n"
+		"menuconfig ABC\n"
+		"\ttristate \"some \\\"desc\\\"\" if X \\\n"
+		"\t\t&& Y\n"
+		"\tdepends on XYZ\n"
+		"\tdefault $(shell,echo 'a)' (b))\n"
+		"\thelp\n"
+		"\t  config IN_HELP\n"
+		"\n"
+		"\t  bool in help\n"
+		"config DEF\n"
+		"\tbool\n"
+		"\tint\n"
+		"choice\n"
+		"\tbool \"choice\"\n"
+		"config CH1\n"
+		"\tdef_bool y\n"
+		"endchoice\n"
+		"config NOTYPE\n"
+		"if FOO\n"
+		"config HEX\n"
+		"\t---help---\n"
+		"\t  text\n"
+		"\thex\n"
+		"source drivers/Kconfig\n"
+		"rsource \"Kconfig.sub\"\n"
+		"orsource \"missing/Kconfig\"\n"
+		"endif\n"
+	);
+
+	assert(fast.parse(kconf, false));
+	assert(fast.fastParsed());
+	assert(slow.parse(kconf, false));
+	assert(!slow.fastParsed());
+	auto fastLog = recordConfigs(fast);
+	assert(fastLog.size() == 8);
+	// in the order of the file
+	assert(fastLog.front() == "source arch/$(SRCARCH)/Kconfig 00");
+	assert(fastLog[1] == "config ABC Tristate");
+	assert(fastLog[5] == "source drivers/Kconfig 00");
+	assert(fastLog.back() == "source missing/Kconfig 11");
+	assert(fastLog == recordConfigs(slow));
+
+	// strings spanning lines are left to ANTLR
+	static constinit std::string_view multiLine(
+		"config ABC\n"
+		"\tbool \"multi\n"
+		"line\"\n"
+	);
+	assert(fast.parse(multiLine, false));
+	assert(!fast.fastParsed());
+
+	auto kernelTree = std::getenv("F2C_KERNEL_TREE");
+	if (!kernelTree)
+		return;
+
+	const std::filesystem::path root{kernelTree};
+	const auto excludeDir = root / "scripts" / "kconfig" / "tests";
+	auto files = 0U, failed = 0U;
+	for (auto it = std::filesystem::recursive_directory_iterator(root);
+	     it != std::filesystem::end(it); ++it) {
+		const auto &path = it->path();
+		if (it->is_directory()) {
+			if (path == excludeDir)
+				it.disable_recursion_pending();
+			continue;
+		}
+		if (!it->is_regular_file())
+			continue;
+		if (path.stem() != "Kconfig" && path.stem() != "Kconfig-nommu")
+			continue;
+		files++;
+		if (!compareKconfigParsers(fast, slow, path))
+			failed++;
+	}
+
+	Clr(std::cerr) << "compared " << files << " Kconfigs from " << kernelTree << ", " <<
+			  failed << " differ";
+	assert(!failed);
+}
+
+using KconfigLevels = std::vector<std::vector<std::filesystem::path>>;
+
+/// @brief Run Kconfig::Finder::find() on @p finder, storing the levels to @p levels
+std::vector<std::filesystem::path> findKconfigs(const Kconfig::Finder &finder,
+						KconfigLevels &levels)
+{
+	Kconfig::Parser p;
+	return finder.find([&p, &levels](const auto &level) {
+		levels.push_back(level);
+		Kconfig::Finder::Sources sources;
+		for (const auto &kconfig: level) {
+			assert(p.parse(kconfig));
+			p.walk([](auto, auto) {}, [&sources, &kconfig](auto source) {
+				sources.emplace_back(kconfig, std::move(source));
+			});
+		}
+		return sources;
+	});
+}
+
+/// @brief Kconfig::Finder follows the sources and scans the tree only if they do not resolve
+void testKconfigFinder(const std::filesystem::path &tree)
+{
+	Clr(std::cerr, Clr::GREEN) << __func__;
+
+	const Kconfig::Finder finder(tree);
+	assert((finder.archs() == std::vector<std::string> { "arm64", "x86" }));
+
+	KconfigLevels levels;
+	const auto found = findKconfigs(finder, levels);
+
+	// all but the orphan, without scanning the tree
+	const auto scanned = finder.scan(tree);
+	assert(scanned.size() == 7);
+	assert(found.size() == scanned.size() - 1);
+	assert(std::find(found.begin(), found.end(), tree / "drivers/orphan/Kconfig") ==
+	       found.end());
+
+	assert(levels.size() == 3);
+	assert((levels[0] == std::vector<std::filesystem::path> {
+		tree / "Kconfig", tree / "arch/arm64/Kconfig", tree / "arch/x86/Kconfig",
+	}));
+	assert((levels[1] == std::vector<std::filesystem::path> {
+		tree / "drivers/Kconfig", tree / "arch/x86/Kconfig.cpu",
+	}));
+	assert((levels[2] == std::vector<std::filesystem::path> { tree / "drivers/net/Kconfig" }));
+
+	// a source which cannot be resolved makes it scan, what it finds comes last
+	const auto copy = std::filesystem::temp_directory_path() / "f2c-test-kconfigs";
+	std::filesystem::remove_all(copy);
+	std::filesystem::copy(tree, copy, std::filesystem::copy_options::recursive);
+	std::ofstream(copy / "drivers/Kconfig", std::ios::app) << "source \"drivers/$(UNKNOWN)\"\n";
+
+	levels.clear();
+	const auto foundAll = findKconfigs(Kconfig::Finder(copy), levels);
+	assert(foundAll.size() == scanned.size());
+	assert(levels.size() == 4);
+	assert((levels[3] == std::vector<std::filesystem::path> {
+		copy / "drivers/orphan/Kconfig",
+	}));
+
+	std::filesystem::remove_all(copy);
+}
+
+/// @brief Every byte is one symbol, including those >= 0x80
+void testMMapCharStream()
+{
+	Clr(std::cerr, Clr::GREEN) << __func__;
+
+	using Interval = antlr4::misc::Interval;
+	const auto file = std::filesystem::temp_directory_path() / "f2c-test-parser-mmap";
+	std::ofstream(file, std::ios::binary) << "ab\xc3\xa9\xff\n";
+
+	auto s = Parsers::MMapCharStream::open(file);
+	assert(s);
+	assert(s->size() == 6);
+	assert(s->getSourceName() == file.string());
+	assert(!s->isASCII());
+
+	assert(s->index() == 0);
+	assert(s->LA(1) == 'a');
+	assert(s->LA(3) == 0xc3);
+	assert(s->LA(5) == 0xff);
+	assert(s->LA(6) == '\n');
+	assert(s->LA(7) == antlr4::IntStream::EOF);
+	assert(s->LA(-1) == antlr4::IntStream::EOF);
+
+	s->consume();
+	s->consume();
+	assert(s->index() == 2);
+	assert(s->LA(1) == 0xc3);
+	assert(s->LA(-1) == 'b');
+	assert(s->LA(-2) == 'a');
+
+	s->seek(4);
+	assert(s->LA(1) == 0xff);
+	assert(s->LA(-1) == 0xa9);
+	s->seek(100);
+	assert(s->index() == 6);
+	assert(s->LA(1) == antlr4::IntStream::EOF);
+	bool thrown = false;
+	try {
+		s->consume();
+	} catch (const antlr4::IllegalStateException &) {
+		thrown = true;
+	}
+	assert(thrown);
+	s->seek(1);
+	assert(s->LA(1) == 'b');
+
+	assert(s->getText(Interval(size_t{2}, size_t{4})) == "\xc3\xa9\xff");
+	assert(s->getText(Interval(size_t{4}, size_t{100})) == "\xff\n");
+	assert(s->getText(Interval(size_t{3}, size_t{2})).empty());
+	assert(s->getText(Interval(size_t{6}, size_t{7})).empty());
+	assert(s->toString() == "ab\xc3\xa9\xff\n");
+	s.reset();
+
+	std::ofstream(file, std::ios::trunc);
+	s = Parsers::MMapCharStream::open(file);
+	assert(s);
+	assert(s->size() == 0);
+	assert(s->isASCII());
+	assert(s->LA(1) == antlr4::IntStream::EOF);
+	assert(s->getText(Interval(size_t{0}, size_t{0})).empty());
+	s.reset();
+
+	std::filesystem::remove(file);
+	assert(!Parsers::MMapCharStream::open(file));
+}
+
+/// @brief The reused ANTLR objects must not leak anything from one input to the next
+void testParserReuse(const std::filesystem::path &kconfig)
+{
+	Clr(std::cerr, Clr::GREEN) << __func__;
+
+	static constinit std::string_view other(
+		"config OTHER\n"
+		"\tbool \"other\"\n"
+		"source \"other/Kconfig\"\n"
+	);
+
+	Kconfig::Parser p(false);
+	assert(p.parse(kconfig, false));
+	const auto first = recordConfigs(p);
+	assert(!first.empty());
+
+	assert(p.parse(other));
+	const auto otherLog = recordConfigs(p);
+	assert(otherLog != first);
+
+	assert(p.parse(kconfig, false));
+	assert(recordConfigs(p) == first);
+
+	p.reset();
+	assert(p.parse(kconfig));
+	assert(recordConfigs(p) == first);
+
+	p.reset();
+	assert(p.parse(other));
+	assert(recordConfigs(p) == otherLog);
+}
+
+void testModeCache(const std::filesystem::path &makefiles)
+{
+	Clr(std::cerr, Clr::GREEN) << __func__;
+
+	auto &cache = Parsers::ModeCache::get();
+	const auto hash = Parsers::ModeCache::hash("obj-y += a.o\n");
+
+	assert(hash == Parsers::ModeCache::hash("obj-y += a.o\n"));
+	assert(hash != Parsers::ModeCache::hash("obj-y += b.o\n"));
+
+	assert(!cache.needsLL("Test.g4", hash));
+	cache.store("Test.g4", hash, "/some/Makefile", true);
+	assert(cache.needsLL("Test.g4", hash));
+	assert(!cache.needsLL("Other.g4", hash));
+
+	const auto file = std::filesystem::temp_directory_path() / "f2c-test-parser-modes.cache";
+	assert(cache.save(file));
+	cache.store("Test.g4", hash, "/some/Makefile", false);
+	assert(!cache.needsLL("Test.g4", hash));
+	assert(cache.load(file));
+	assert(cache.needsLL("Test.g4", hash));
+	std::filesystem::remove(file);
+	cache.store("Test.g4", hash, "/some/Makefile", false);
+
+	// every file parse tries SLL or goes to LL directly
+	auto &stats = cache.stats();
+	const auto before = stats.sll + stats.sllFailed + stats.llCached;
+	MP::Parser slow(false);
+	std::error_code ec;
+	auto files = 0U;
+	for (const auto &entry : std::filesystem::directory_iterator{makefiles, ec})
+		if (entry.is_regular_file() && slow.parse(entry.path()))
+			files++;
+	assert(!ec);
+	assert(stats.sll + stats.sllFailed + stats.llCached == before + files);
+}
+
 } // namespace
 
 #ifndef TESTS_DIR
@@ -164,8 +660,15 @@ int main()
 
 	testVisitor();
 	testMakefiles(tests/"makefiles");
+	testFastPath(tests/"makefiles");
+	testModeCache(tests/"makefiles");
 
 	testKconfig();
+	testKconfigFastPath();
+	testKconfigFinder(tests/"kconfigs");
+
+	testMMapCharStream();
+	testParserReuse(tests/"kconfigs/Kconfig");
 
 	return 0;
 }
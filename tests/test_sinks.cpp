@@ -0,0 +1,478 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+#include <cassert>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <sl/helpers/Color.h>
+#include <sl/kerncvs/CollectConfigs.h>
+#include <sl/kerncvs/SupportedConf.h>
+
+#include "F2CSQLConn.h"
+#include "treewalker/MemorySink.h"
+#include "treewalker/NDJSONSink.h"
+#include "treewalker/SQLiteMakeVisitor.h"
+
+using Clr = SlHelpers::Color;
+
+namespace {
+
+using SinkLog = std::vector<std::string>;
+using SlKernCVS::ConfigValue;
+using SlKernCVS::SupportState;
+
+std::string line(std::initializer_list<std::string_view> cols)
+{
+	std::string line;
+	for (const auto &col: cols) {
+		if (!line.empty())
+			line += ' ';
+		line += col;
+	}
+	return line;
+}
+
+/// @brief Records every call as a line of text
+class RecordingSink : public TW::ResultSink {
+public:
+	RecordingSink(SinkLog &log) : m_log(log) {}
+
+	virtual void beginBranch(const std::string &branch) override {
+		m_branch = branch;
+	}
+
+	virtual void fileSupp(const std::filesystem::path &srcPath, ConfigValue enabled,
+			      const std::optional<std::string> &disabledConfig,
+			      SupportState supported) override {
+		m_log.push_back(line({ "fileSupp", m_branch, srcPath.string(),
+				       std::string(1, static_cast<char>(enabled)),
+				       disabledConfig.value_or("-"),
+				       SlKernCVS::getName(supported) }));
+	}
+
+	virtual void config(const std::filesystem::path &srcPath,
+			    const std::string &cond) override {
+		m_log.push_back(line({ "config", m_branch, srcPath.string(), cond }));
+	}
+
+	virtual void module(const std::filesystem::path &module, const std::string &moduleConf,
+			    SupportState supported) override {
+		m_log.push_back(line({ "module", m_branch, module.string(), moduleConf,
+				       SlKernCVS::getName(supported) }));
+	}
+
+	virtual void moduleFile(const std::filesystem::path &srcPath,
+				const std::filesystem::path &module) override {
+		m_log.push_back(line({ "moduleFile", m_branch, srcPath.string(),
+				       module.string() }));
+	}
+private:
+	SinkLog &m_log;
+	std::string m_branch;
+};
+
+std::vector<SupportState> supportStates()
+{
+	std::vector<SupportState> states;
+	for (auto e: SlKernCVS::SupportStateRange{})
+		states.push_back(e);
+	assert(states.size() >= 2);
+	return states;
+}
+
+void feedSLE(TW::ResultSink &sink)
+{
+	const auto states = supportStates();
+	const auto sup = states.back();
+	const auto unsup = states.front();
+
+	sink.beginBranch("SLE15-SP6");
+	sink.module("drivers/net/foo.ko", "FOO", sup);
+	sink.module("drivers/net/bar.ko", "BAR", unsup);
+	sink.moduleFile("drivers/net/foo.c", "drivers/net/foo.ko");
+	sink.moduleFile("drivers/net/foo_main.c", "drivers/net/foo.ko");
+	sink.moduleFile("drivers/net/bar.c", "drivers/net/bar.ko");
+	sink.fileSupp("drivers/net/foo.c", ConfigValue::Module, std::nullopt, sup);
+	sink.fileSupp("drivers/net/bar.c", ConfigValue::Disabled, "BAR", unsup);
+	sink.config("drivers/net/foo.c", "FOO");
+	sink.config("drivers/net/bar.c", "BAR");
+	sink.endBranch();
+}
+
+void feedMaster(TW::ResultSink &sink)
+{
+	const auto sup = supportStates().back();
+
+	sink.beginBranch("master");
+	sink.fileSupp("init/main.c", ConfigValue::BuiltIn, std::nullopt, sup);
+	sink.config("init/main.c", "FOO");
+	sink.endBranch();
+}
+
+/// @brief Two branches of results, in the order MemorySink::replay() emits them
+void feed(TW::ResultSink &sink)
+{
+	feedSLE(sink);
+	feedMaster(sink);
+}
+
+SinkLog expected()
+{
+	SinkLog log;
+	RecordingSink rec(log);
+	feed(rec);
+	return log;
+}
+
+SinkLog sorted(SinkLog log)
+{
+	std::sort(log.begin(), log.end());
+	return log;
+}
+
+void testMemorySink()
+{
+	Clr(std::cerr, Clr::GREEN) << __func__;
+
+	TW::MemorySink mem;
+	feed(mem);
+	assert(mem.branches().size() == 2);
+	assert(mem.size() == expected().size());
+	assert(mem.fileSupps().disabledConfig[1] == "BAR");
+
+	SinkLog log;
+	RecordingSink rec(log);
+	mem.replay(rec);
+	assert(log == expected());
+
+	// replaying twice gives the same, clear() drops everything
+	log.clear();
+	mem.replay(rec);
+	assert(log == expected());
+	mem.clear();
+	assert(!mem.size());
+	assert(mem.branches().empty());
+
+	// with a target, every branch is passed on at its end
+	SinkLog targetLog;
+	TW::MemorySink forwarding(std::make_unique<RecordingSink>(targetLog));
+	feed(forwarding);
+	assert(targetLog == expected());
+	assert(!forwarding.size());
+}
+
+SinkLog parseNDJSON(std::istream &is)
+{
+	SinkLog log;
+	std::string l;
+	while (std::getline(is, l)) {
+		const auto json = nlohmann::json::parse(l);
+		const auto table = json["table"].get<std::string>();
+		const auto branch = json["branch"].get<std::string>();
+		if (table == "file_support_map") {
+			const auto &disabled = json["disabled_config"];
+			log.push_back(line({ "fileSupp", branch, json["file"].get<std::string>(),
+					     json["enabled"].get<std::string>(),
+					     disabled.is_null() ? "-" :
+						disabled.get<std::string>(),
+					     json["supported"].get<std::string>() }));
+		} else if (table == "conf_file_map") {
+			log.push_back(line({ "config", branch, json["file"].get<std::string>(),
+					     json["config"].get<std::string>() }));
+		} else if (table == "module_details_map") {
+			log.push_back(line({ "module", branch, json["module"].get<std::string>(),
+					     json["config"].get<std::string>(),
+					     json["supported"].get<std::string>() }));
+		} else if (table == "module_file_map") {
+			log.push_back(line({ "moduleFile", branch, json["file"].get<std::string>(),
+					     json["module"].get<std::string>() }));
+		} else {
+			assert(false);
+		}
+	}
+
+	return log;
+}
+
+void testNDJSONSink()
+{
+	Clr(std::cerr, Clr::GREEN) << __func__;
+
+	std::stringstream ss;
+	TW::NDJSONSink ndjson(ss);
+	feed(ndjson);
+
+	assert(parseNDJSON(ss) == expected());
+}
+
+/// @brief F2CSQLConn with selects of what SQLiteMakeVisitor stored
+class ReadBackConn : public F2C::F2CSQLConn {
+public:
+	virtual bool prepDB() override {
+		return F2CSQLConn::prepDB() && prepareStatements({
+			{ selFileSupps, "SELECT 'fileSupp', branch, path, enabled, "
+					"IFNULL(disabled_config, '-'), supported "
+				"FROM file_support_map_view;" },
+			{ selConfigs, "SELECT 'config', branch, path, config "
+				"FROM conf_file_map_view;" },
+			{ selModules, "SELECT 'module', map.branch, map.module, "
+					"module_view.config, map.supported "
+				"FROM module_details_map_view AS map "
+				"JOIN module_view "
+					"ON module_view.dir || '/' || module_view.module = "
+					"map.module;" },
+			{ selModuleFiles, "SELECT 'moduleFile', branch, path, module "
+				"FROM module_file_map_view;" },
+			{ selUserFiles, "SELECT 'userFile', email, path, count "
+				"FROM user_file_map_view_grouped;" },
+			{ selCFMapRows, "SELECT 'rows', COUNT(*) FROM conf_file_map;" },
+			{ selCBMap, "SELECT 'cbMap', branch, arch, flavor, config, value "
+				"FROM conf_branch_map_view;" },
+		});
+	}
+
+	SinkLog readBack() {
+		return readBack({ &selFileSupps, &selConfigs, &selModules, &selModuleFiles });
+	}
+
+	SinkLog readUserFiles() { return readBack({ &selUserFiles }); }
+	SinkLog readCFMapRows() { return readBack({ &selCFMapRows }); }
+	SinkLog readCBMap() { return readBack({ &selCBMap }); }
+private:
+	SinkLog readBack(std::initializer_list<SlSqlite::SQLStmtHolder *> stmts) {
+		SinkLog log;
+		for (auto stmt: stmts) {
+			const auto res = select(*stmt, {});
+			assert(res);
+			for (const auto &row: *res) {
+				std::string l;
+				for (const auto &col: row) {
+					if (!l.empty())
+						l += ' ';
+					std::visit([&l](const auto &val) {
+						using T = std::decay_t<decltype(val)>;
+						if constexpr (std::is_same_v<T, std::string>)
+							l += val;
+						else if constexpr (std::is_arithmetic_v<T>)
+							l += std::to_string(val);
+					}, col);
+				}
+				log.push_back(std::move(l));
+			}
+		}
+		return log;
+	}
+
+	SlSqlite::SQLStmtHolder selFileSupps;
+	SlSqlite::SQLStmtHolder selConfigs;
+	SlSqlite::SQLStmtHolder selModules;
+	SlSqlite::SQLStmtHolder selModuleFiles;
+	SlSqlite::SQLStmtHolder selUserFiles;
+	SlSqlite::SQLStmtHolder selCFMapRows;
+	SlSqlite::SQLStmtHolder selCBMap;
+};
+
+void fillStatic(ReadBackConn &sql)
+{
+	for (auto e: supportStates())
+		assert(sql.insertSupported(static_cast<int>(e), std::string(SlKernCVS::getName(e))));
+	assert(sql.insertConfigType(1, "tristate"));
+	assert(sql.insertConfig("FOO", 1));
+	assert(sql.insertConfig("BAR", 1));
+	assert(sql.insertUser("dev@suse.com"));
+}
+
+void testSQLiteSink()
+{
+	Clr(std::cerr, Clr::GREEN) << __func__;
+
+	const auto file = std::filesystem::temp_directory_path() / "f2c-test-sinks.sqlite";
+	std::filesystem::remove(file);
+
+	{
+		ReadBackConn sql;
+		assert(sql.openDB(file, SlSqlite::OpenFlags::CREATE));
+		assert(sql.createDB());
+		assert(sql.prepDB());
+
+		fillStatic(sql);
+		assert(sql.insertBranch("SLE15-SP6", "1234", 6));
+		assert(sql.insertBranch("master", "5678", 7));
+
+		TW::SQLiteMakeVisitor sqlSink(sql);
+		feed(sqlSink);
+
+		assert(sorted(sql.readBack()) == sorted(expected()));
+	}
+
+	std::filesystem::remove(file);
+}
+
+/// @brief Rows of a branch replaced in the WAL mode must not show up, not even before a purge
+void testReplacedBranch()
+{
+	Clr(std::cerr, Clr::GREEN) << __func__;
+
+	const auto file = std::filesystem::temp_directory_path() / "f2c-test-replaced.sqlite";
+	std::filesystem::remove(file);
+
+	{
+		ReadBackConn sql;
+		assert(sql.openDB(file, SlSqlite::OpenFlags::CREATE));
+		assert(sql.createDB());
+		assert(sql.prepDB());
+		assert(sql.enableWAL(0));
+		assert(sql.retiresBranches());
+
+		fillStatic(sql);
+		assert(sql.insertBranch("SLE15-SP6", "1234", 6));
+		assert(sql.insertBranch("master", "5678", 7));
+
+		TW::SQLiteMakeVisitor sqlSink(sql);
+		feed(sqlSink);
+		assert(sql.insertUFMap("SLE15-SP6", "dev@suse.com", "drivers/net", "foo.c", 2, 1));
+		const auto rows = sql.readCFMapRows();
+
+		// like BranchProcessor::processInternal()
+		assert(sql.foreignKeys(false));
+		sql.begin();
+		assert(sql.deleteBranch("SLE15-SP6"));
+		assert(sql.insertBranch("SLE15-SP6", "4321", 6));
+		feedSLE(sqlSink);
+		assert(sql.insertUFMap("SLE15-SP6", "dev@suse.com", "drivers/net", "foo.c", 2, 1));
+		sql.end();
+		assert(sql.foreignKeys(true));
+
+		const SinkLog userFiles { "userFile dev@suse.com drivers/net/foo.c 2" };
+		assert(sorted(sql.readBack()) == sorted(expected()));
+		assert(sql.readUserFiles() == userFiles);
+		assert(sql.readCFMapRows() != rows);
+
+		ReadBackConn reader;
+		assert(reader.openDB(file, SlSqlite::OpenFlags::NONE));
+		assert(reader.prepDB());
+		assert(sorted(reader.readBack()) == sorted(expected()));
+		assert(reader.readUserFiles() == userFiles);
+
+		assert(sql.purgeRetired());
+		assert(sorted(sql.readBack()) == sorted(expected()));
+		assert(sql.readUserFiles() == userFiles);
+		assert(sql.readCFMapRows() == rows);
+	}
+
+	std::filesystem::remove(file);
+	for (const auto suffix: { "-wal", "-shm" })
+		std::filesystem::remove(file.string() + suffix);
+}
+
+/// @brief conf_branch_map with one row per arch/flavor is migrated by createDB()
+void testOldConfBranchMap()
+{
+	Clr(std::cerr, Clr::GREEN) << __func__;
+
+	const auto file = std::filesystem::temp_directory_path() / "f2c-test-old-cbmap.sqlite";
+	std::filesystem::remove(file);
+
+	{
+		ReadBackConn sql;
+		assert(sql.openDB(file, SlSqlite::OpenFlags::CREATE));
+		for (const auto stmt: {
+				"CREATE TABLE branch(id INTEGER PRIMARY KEY, "
+					"branch TEXT NOT NULL UNIQUE, sha TEXT NOT NULL, "
+					"version INTEGER NOT NULL);",
+				"CREATE TABLE config_type(id INTEGER PRIMARY KEY, "
+					"type TEXT NOT NULL UNIQUE);",
+				"CREATE TABLE config(id INTEGER PRIMARY KEY, "
+					"config TEXT NOT NULL UNIQUE, type INTEGER NOT NULL);",
+				"CREATE TABLE arch(id INTEGER PRIMARY KEY, arch TEXT NOT NULL UNIQUE);",
+				"CREATE TABLE flavor(id INTEGER PRIMARY KEY, "
+					"flavor TEXT NOT NULL UNIQUE);",
+				"CREATE TABLE conf_branch_map(id INTEGER PRIMARY KEY, "
+					"branch INTEGER NOT NULL, config INTEGER NOT NULL, "
+					"arch INTEGER NOT NULL, flavor INTEGER NOT NULL, "
+					"value TEXT NOT NULL, "
+					"UNIQUE(branch, config, arch, flavor));",
+				"CREATE INDEX conf_branch_map_config_index ON conf_branch_map(config);",
+				"INSERT INTO branch(id, branch, sha, version) VALUES "
+					"(1, 'SLE15-SP6', '1234', 6), (2, 'master', '5678', 7);",
+				"INSERT INTO config_type(id, type) VALUES (1, 'tristate');",
+				"INSERT INTO config(id, config, type) VALUES (1, 'FOO', 1), (2, 'BAR', 1);",
+				"INSERT INTO arch(id, arch) VALUES (1, 'x86_64'), (2, 'arm64');",
+				"INSERT INTO flavor(id, flavor) VALUES (1, 'default'), (2, 'rt');",
+				"INSERT INTO conf_branch_map(branch, config, arch, flavor, value) VALUES "
+					"(1, 1, 1, 1, 'y'), (1, 1, 1, 2, 'm'), (1, 1, 2, 1, 'y'), "
+					"(1, 2, 2, 1, 'n'), (2, 1, 1, 1, 'm'), (2, 2, 1, 1, 'v');",
+			})
+			assert(sql.exec(stmt));
+
+		assert(sql.createDB());
+		assert(sql.prepDB());
+
+		const SinkLog cbMap {
+			"cbMap SLE15-SP6 arm64 default BAR n",
+			"cbMap SLE15-SP6 arm64 default FOO y",
+			"cbMap SLE15-SP6 x86_64 default FOO y",
+			"cbMap SLE15-SP6 x86_64 rt FOO m",
+			"cbMap master x86_64 default BAR v",
+			"cbMap master x86_64 default FOO m",
+		};
+		assert(sorted(sql.readCBMap()) == cbMap);
+
+		// nothing left to migrate
+		assert(sql.createDB());
+		assert(sql.prepDB());
+		assert(sorted(sql.readCBMap()) == cbMap);
+	}
+
+	std::filesystem::remove(file);
+}
+
+/// @brief Version strings of shards survive reopening, older shards have none
+void testShardVersion()
+{
+	Clr(std::cerr, Clr::GREEN) << __func__;
+
+	const auto file = std::filesystem::temp_directory_path() / "f2c-test-shard.sqlite";
+	std::filesystem::remove(file);
+
+	{
+		ReadBackConn sql;
+		assert(sql.openDB(file, SlSqlite::OpenFlags::CREATE));
+		assert(sql.createDB());
+		assert(sql.prepDB());
+		assert(sql.shardVersions() && sql.shardVersions()->empty());
+
+		assert(sql.insertShardVersion("SLE15-SP6", "6.4"));
+		assert(sql.insertShardVersion("SLE15-SP6", "6.4.0"));
+	}
+
+	{
+		ReadBackConn sql;
+		assert(sql.openDB(file, SlSqlite::OpenFlags::READ_ONLY));
+		const auto versions = sql.shardVersions();
+		assert(versions && versions->size() == 1);
+		assert(versions->front() == std::make_pair(std::string("SLE15-SP6"),
+							    std::string("6.4.0")));
+	}
+
+	std::filesystem::remove(file);
+}
+
+} // namespace
+
+int main()
+{
+	testMemorySink();
+	testNDJSONSink();
+	testSQLiteSink();
+	testReplacedBranch();
+	testOldConfBranchMap();
+	testShardVersion();
+
+	return 0;
+}